@@ -688,6 +688,11 @@ void PubSubClient::disconnect() {
     lastInActivity = lastOutActivity = millis();
 }
 
+void PubSubClient::abort() {
+    _state = MQTT_CONNECTION_LOST;
+    _client->stop();
+}
+
 uint16_t PubSubClient::writeString(const char* string, uint8_t* buf, uint16_t pos) {
     const char* idp = string;
     uint16_t i = 0;
@@ -150,6 +150,9 @@ public:
    boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const char* willMessage, boolean cleanSession);
    boolean connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, boolean willRetain, const uint8_t* willPayload, unsigned int plength, boolean cleanSession);
    void disconnect();
+   // Close the connection without sending DISCONNECT, e.g. partway through a
+   // message, so the broker sees it as lost and publishes the Will
+   void abort();
    boolean publish(const char* topic, const char* payload);
    boolean publish(const char* topic, const char* payload, boolean retained);
    boolean publish(const char* topic, const uint8_t * payload, unsigned int plength);
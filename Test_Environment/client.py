@@ -34,8 +34,9 @@ from sparkplug_b import *
 
 # Application constants
 APP_VERSION             = '1.0'
-COMMS_VERSION           = 2
+COMMS_VERSION           = 16
 COMMS_VERSION_METRIC    = 'Properties/Communications Version'
+PROFILE_PROBES          = ( 'get_Temperature', 'getSeebeck', 'publish_data', 'publish_node_data', 'encode', 'check_brokers' )
 BIRTH_DEATH_SEQ_METRIC  = 'bdSeq'
 NODE_ID                 = 'TEC'
 NUM_MODULES             = 6
@@ -95,16 +96,34 @@ Metrics = (
     [ MetricSpec( None, 'Properties/Calibration INW',                 'strip to /', False ) ] +
     [ MetricSpec( None, 'Properties/Data Selection',                  'strip to /', True ) ] +
     [ MetricSpec( None, 'Properties/Units',                           'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/Log Level',                       'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/Log To MQTT',                     'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/PWM Dither',                      'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/PWM Stagger',                     'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/Power Budget',                    'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/Batch Size',                      'strip to /', True  ) ] +
+    [ MetricSpec( None, 'Properties/Batch Interval',                  'strip to /', True  ) ] +
     [ MetricSpec( None, 'Properties/Firmware Version',                'strip to /', True  ) ] +
     [ MetricSpec( None, 'Properties/Communications Version',          'strip to /', False ) ] +
+    [ MetricSpec( None, 'Properties/Boot Time',                       'strip to /', True  ) ] +
     [ MetricSpec( None, 'Node Control/Reboot',                        'strip to /', False ) ] +
     [ MetricSpec( None, 'Node Control/Rebirth',                       'strip to /', False ) ] +
     [ MetricSpec( None, 'Node Control/Calibration Temperature 1',     'strip to /', False ) ] +
     [ MetricSpec( None, 'Node Control/Calibration Temperature 2',     'strip to /', False ) ] +
     [ MetricSpec( None, 'Node Control/Clear Cal Data',                'strip to /', False ) ] +
+    [ MetricSpec( None, 'Node Control/Profile Report',                'strip to /', False ) ] +
     [ MetricSpec( None, f'Inputs/Power Channel{channel + 1}',             'strip to /', True  ) for channel in range( NUM_TEC ) ] +
     [ MetricSpec( None, f'Outputs/Direction Channel{channel + 1}',        'strip to /', True  ) for channel in range( NUM_TEC ) ] +
-    [ MetricSpec( None, f'Outputs/Data Channel{channel + 1}',             'strip to /', True  ) for channel in range( NUM_TEC ) ] 
+    [ MetricSpec( None, f'Outputs/Data Channel{channel + 1}',             'strip to /', True  ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Inputs/Filter Type Channel{channel + 1}',       'strip to /', True  ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Inputs/Filter Length Channel{channel + 1}',     'strip to /', True  ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Inputs/{control} Channel{channel + 1}',         'strip to /', True  ) for control in ( 'Setpoint', 'Control Mode', 'Kp', 'Ki', 'Kd', 'Slew Rate', 'Reverse Dwell', 'Priority' ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Inputs/Autotune Channel{channel + 1}',          'strip to /', True  ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Outputs/Autotune Status Channel{channel + 1}',  'strip to /', True  ) for channel in range( NUM_TEC ) ] +
+    [ MetricSpec( None, f'Diagnostics/Command {timing} {stat}',           'strip to /', True  ) for timing in ( 'Decode', 'Latency', 'Age' ) for stat in ( 'p50', 'p99', 'Max' ) ] +
+    [ MetricSpec( None, 'Diagnostics/Power Headroom',                 'strip to /', True  ) ] +
+    [ MetricSpec( None, f'Diagnostics/Profile {probe}',                   'strip to /', True  ) for probe in PROFILE_PROBES ] +
+    [ MetricSpec( None, 'Diagnostics/Scheduler',                      'strip to /', True  ) ]
     )
 
 # Reset the aliases and/or values for all the metrics of the specified device
@@ -661,6 +680,12 @@ def request_rebirth():
     if send_simple_node_command( 'Node Control/Rebirth', True ):
         report('Rebirth requested')
 
+# Ask the node to report the time spent in each profiled function since the
+# last report
+def request_profile():
+    if send_simple_node_command( 'Node Control/Profile Report', True ):
+        report( 'Profile report requested', always = True )
+
 # Ask the node to reboot
 def reboot_module():
     if send_simple_node_command( 'Node Control/Reboot', True ):
@@ -960,6 +985,8 @@ if option_no_GUI:
                 continue
         elif command[ 0 ] == 'reboot':
             reboot_module()
+        elif command[ 0 ] == 'profile':
+            request_profile()
         elif command[ 0 ] == 'show':
             if len( command ) != 2:
                 report( 'Invalid use, must be of the form "show SHOW_WHAT"', error = True, always = True )
@@ -1016,6 +1043,7 @@ if option_no_GUI:
             print( f'Commands:' )
             print( f'    module MODULE_ID = switch to the Thermistor Mux module number (0-{NUM_MODULES - 1})' )
             print( f'    reboot = send the Reboot command to the module' )
+            print( f'    profile = ask the module to report the time spent in each profiled function since the last report' )
             print( f'    tec NUMBER VALUE = send the set TEC channel power command to the module:' )
             print( f'        NUMBER = which output to set (1-{NUM_TEC}, or "all" for all TECs)' )
             print( f'        VALUE = the floating-point power to set it to ({MIN_TEC_VALUE:.1f} to {MAX_TEC_VALUE:.1f}' )
@@ -0,0 +1,143 @@
+"""
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+Brief: Measures the round trip of TEC power commands through an MQTT broker.
+Sends Inputs/Power ChannelN NCMD messages to a TEC module and times how long it
+takes for the module to echo the new power in an NDATA message.  Also shows the
+module's own Diagnostics/Command timing metrics.
+
+Usage: python3 latency_test.py [broker=URL] [port=PORT] [module=ID]
+                               [channel=N] [count=N] [interval=SECONDS]
+Start the local broker first with start_test_env.sh.
+"""
+
+import sys
+import time
+import threading
+
+import paho.mqtt.client as mqtt
+from sparkplug_b import *
+
+DEFAULT_BROKER_URL      = 'localhost'
+DEFAULT_BROKER_PORT     = 1884
+DEFAULT_MODULE_ID       = 0
+DEFAULT_CHANNEL         = 1
+DEFAULT_COUNT           = 200
+DEFAULT_INTERVAL        = 0.05
+REPLY_TIMEOUT           = 10.0
+NODE_ID                 = 'TEC'
+
+def node_topic( module_id, message_type ):
+    return f'spBv1.0/VI/{message_type}/{NODE_ID}{module_id}'
+
+# Nearest-rank percentile, matching the firmware
+def percentile( sorted_values, pct ):
+    rank = max( 1, ( pct * len( sorted_values ) + 99 ) // 100 )
+    return sorted_values[ rank - 1 ]
+
+# Parse the command-line options
+options = { 'broker': DEFAULT_BROKER_URL, 'port': DEFAULT_BROKER_PORT, 'module': DEFAULT_MODULE_ID,
+            'channel': DEFAULT_CHANNEL, 'count': DEFAULT_COUNT, 'interval': DEFAULT_INTERVAL }
+for arg in sys.argv[ 1: ]:
+    name, _, value = arg.partition( '=' )
+    if name not in options or value == '':
+        print( __doc__ )
+        sys.exit( 1 )
+    options[ name ] = type( options[ name ] )( value )
+
+birth_topic = node_topic( options[ 'module' ], 'NBIRTH' )
+data_topic  = node_topic( options[ 'module' ], 'NDATA' )
+cmd_topic   = node_topic( options[ 'module' ], 'NCMD' )
+power_name  = f'Inputs/Power Channel{options[ "channel" ]}'
+
+aliases     = {}    # Metric names by alias, from the NBIRTH
+diagnostics = {}    # Latest Diagnostics/Command metrics
+birth       = threading.Event()
+echo        = threading.Event()
+expected    = None
+
+def on_message( client, userdata, msg ):
+    global expected
+    payload = sparkplug_b_pb2.Payload()
+    try:
+        payload.ParseFromString( msg.payload )
+    except:
+        return
+    for metric in payload.metrics:
+        name = metric.name if metric.name else aliases.get( metric.alias )
+        if msg.topic == birth_topic:
+            aliases[ metric.alias ] = metric.name
+        if name is None:
+            continue
+        if name.startswith( 'Diagnostics/Command' ):
+            diagnostics[ name ] = metric.long_value
+        if msg.topic == data_topic and name == power_name and expected is not None \
+           and abs( metric.float_value - expected ) < 1e-3:
+            expected = None
+            echo.set()
+    if msg.topic == birth_topic:
+        birth.set()
+
+client = mqtt.Client()
+client.on_message = on_message
+client.connect( options[ 'broker' ], options[ 'port' ] )
+client.subscribe( birth_topic )
+client.subscribe( data_topic )
+client.loop_start()
+
+# Ask for a rebirth to learn the metric aliases
+payload = sparkplug_b_pb2.Payload()
+payload.timestamp = int( round( time.time() * 1000 ) )
+addMetric( payload, 'Node Control/Rebirth', None, MetricDataType.Boolean, True )
+client.publish( cmd_topic, bytearray( payload.SerializeToString() ), 0, False )
+if not birth.wait( REPLY_TIMEOUT ):
+    print( f'No NBIRTH from {NODE_ID}{options[ "module" ]}' )
+    sys.exit( 1 )
+power_alias = next( ( a for a, n in aliases.items() if n == power_name ), None )
+
+round_trips = []
+timeouts = 0
+for i in range( options[ 'count' ] ):
+    # Alternate between two small powers so every command changes the value
+    value = 1.0 if i % 2 == 0 else 2.0
+    payload = sparkplug_b_pb2.Payload()
+    payload.timestamp = int( round( time.time() * 1000 ) )
+    addMetric( payload, None if power_alias is not None else power_name, power_alias,
+               MetricDataType.Float, value )
+    echo.clear()
+    expected = value
+    start = time.perf_counter()
+    client.publish( cmd_topic, bytearray( payload.SerializeToString() ), 0, False )
+    if echo.wait( REPLY_TIMEOUT ):
+        round_trips.append( ( time.perf_counter() - start ) * 1000 )
+    else:
+        timeouts += 1
+    time.sleep( options[ 'interval' ] )
+
+# Leave the channel off
+payload = sparkplug_b_pb2.Payload()
+payload.timestamp = int( round( time.time() * 1000 ) )
+addMetric( payload, None if power_alias is not None else power_name, power_alias, MetricDataType.Float, 0.0 )
+client.publish( cmd_topic, bytearray( payload.SerializeToString() ), 0, False )
+time.sleep( 0.5 )
+client.loop_stop()
+
+if round_trips:
+    round_trips.sort()
+    print( f'Round trip over {len( round_trips )} commands ({timeouts} timed out), ms: '
+           f'p50 {percentile( round_trips, 50 ):.2f}  p99 {percentile( round_trips, 99 ):.2f}  max {round_trips[ -1 ]:.2f}' )
+else:
+    print( f'No replies ({timeouts} timed out)' )
+for name in sorted( diagnostics ):
+    units = 'ms' if ' Age ' in name else 'us'
+    print( f'{name}: {diagnostics[ name ]} {units}' )
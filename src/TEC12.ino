@@ -12,6 +12,13 @@ Report Thermistor ADC values to serial or over Ethernet port  (this would be a g
 #include "ThermoElectricController.h"
 #include "ThermoElectricGlobal.h"
 #include "ThermoElectricNetwork.h"
+#include "ThermoElectricAcquisition.h"
+#include "ThermoElectricFilter.h"
+#include "ThermoElectricPwm.h"
+#include "ThermoElectricScheduler.h"
+#include "ThermoElectricBoot.h"
+#include "ThermoElectricProfiler.h"
+#include "ThermoElectricPid.h"
 
 /******************
  * Begin Configure
@@ -23,23 +30,24 @@ struct tec_config {
   int thermistorPin;
   bool thermistor ; // is there a thermistor or Seebeck temperature
   int minimum_percent ; // the Diodes, inc parts only go from about 15 percent to 100 percent
+  int burst_ms ; // if not 0, power below minimum_percent bursts at minimum_percent in slots this long
 };
 
 struct tec_config tec_cfg[]=
 {
-  // dir, pwm, thermistor or seebeck, min
-  {12,0,23,0,15},
-  {24,1,22,0,15},
-  {25,2,21,0,15},
-  {26,3,20,0,0},
-  {27,4,19,0,0},
-  {28,5,18,0,0},
-  {29,6,17,0,0},
-  {30,7,16,0,0},
-  {31,8,15,0,0},
-  {32,9,14,0,0},
-  {37,10,41,0,0},
-  {36,11,40,0,0},
+  // dir, pwm, thermistor or seebeck, min, burst
+  {12,0,23,0,15,10},
+  {24,1,22,0,15,10},
+  {25,2,21,0,15,10},
+  {26,3,20,0,0,0},
+  {27,4,19,0,0,0},
+  {28,5,18,0,0,0},
+  {29,6,17,0,0,0},
+  {30,7,16,0,0,0},
+  {31,8,15,0,0,0},
+  {32,9,14,0,0,0},
+  {37,10,41,0,0,0},
+  {36,11,40,0,0,0},
 };
 /*
  ******************
@@ -51,47 +59,171 @@ Thermistor therm[NUM_TEC];
 bool calibrated = false;
 int blink = 0; 
 
+// Time between telemetry messages
+const uint32_t TELEMETRY_PERIOD_MS = 6000;
+// Time between checks on a Seebeck measurement in progress
+const uint32_t ACQUIRE_POLL_MS = 5;
+
+// Latest readings, published by publish_task()
+static float seebeck[NUM_TEC];
+static float temperature[NUM_TEC];
+static bool acquired = false; // new Seebeck readings to publish
+
+// Measure the Seebeck voltages every telemetry period.  Blanked channels need
+// time to settle and fresh samples, so the measurement is started on one run
+// and read on a later one, rather than waiting here.
+static void acquire_task() {
+  static bool measuring = false;
+  static uint32_t due_ms = 0;
+  if (!measuring) {
+    uint32_t now = millis();
+    if ((int32_t) (now - due_ms) < 0) {
+      return;
+    }
+    // stay on the period grid unless a whole period was missed
+    due_ms += TELEMETRY_PERIOD_MS;
+    if ((int32_t) (now - due_ms) >= 0) {
+      due_ms = now + TELEMETRY_PERIOD_MS;
+    }
+    ThermoElectricController::startSeebeckAll(TEC, NUM_TEC);
+    measuring = true;
+  }
+  if (!ThermoElectricController::finishSeebeckAll(TEC, NUM_TEC, seebeck)) {
+    return;
+  }
+  measuring = false;
+  for (int i = 0; i < NUM_TEC; i++) {
+    batch_seebeck(i, seebeck[i]);
+  }
+  acquired = true;
+}
+
+// Convert the filtered thermistor readings to temperatures
+static void filter_task() {
+  for (int i = 0; i < NUM_TEC; i++) {
+    temperature[i] = TEC[i].get_Temperature(i);
+    batch_temperature(i, temperature[i]);
+  }
+}
+
+// Publish once each Seebeck measurement is done
+static void publish_task() {
+  if (!acquired) {
+    return;
+  }
+  acquired = false;
+  for (int i = 0; i < NUM_TEC; i++) {
+      publish_data(i, TEC[i].getPower(), TEC[i].getDirection(), temperature[i], seebeck[i]);
+  }
+  digitalWrite(LED_BUILTIN, (blink++ & 0x01)); 
+  LOG_DEBUG("Publishing Metrics.");
+  publish_node_data();
+}
+
+// Publish the batched data early once a batch is full or due
+static void batch_task() {
+  flush_batches();
+}
+
+// Keep the broker connections up and handle incoming commands
+static void broker_task() {
+  check_brokers();
+}
+
+static void ntp_task() {
+  update_ntp();
+}
+
+// Restagger the PWM outputs as the duties change
+static void stagger_task() {
+  pwm_stagger_service();
+}
+
+// Finish auto-tuning experiments and report their progress
+static void control_task() {
+  if (control_service()) {
+    update_control_metrics();
+  }
+}
+
+// Main loop tasks: name, function, period and deadline in microseconds.
+// Acquire and publish poll, and acquire is ahead of publish in the table so a
+// finished measurement is published on the next run.
+static Task tasks[] = {
+  {"Broker",  broker_task,  1000,                        1000},
+  {"Filter",  filter_task,  100000,                      10000},
+  {"Acquire", acquire_task, ACQUIRE_POLL_MS * 1000,      10000},
+  {"Publish", publish_task, ACQUIRE_POLL_MS * 1000,      100000},
+  {"Batch",   batch_task,   100000,                      100000},
+  {"NTP",     ntp_task,     1000000,                     100000},
+  {"Control", control_task, 1000000,                     10000},
+  {"Stagger", stagger_task, 1000000,                     10000},
+};
+
 void setup() {
   pinMode(LED_BUILTIN, OUTPUT);
   Serial.begin(115200);
-  delay(1000);
-  Serial.println("Configuring the TECs");
+  profile_begin();
+  LOG_INFO("Configuring the TECs");
 
   //Load cal data if thermistors have been calibrated.
   if (EEPROM.read(0) == 0x01) {
-    Serial.println("Retrieving Cal Data.");
+    LOG_INFO("Retrieving Cal Data.");
     therm->load_cal_data();
     calibrated = true;
   }
 
   //setup the TECs
-  delay(10000);
+  int thermistorPins[NUM_TEC];
+  int pwmPins[NUM_TEC];
+  bool seebeck[NUM_TEC];
   for (int i = 0; i < NUM_TEC; i++ ) {
-    TEC[i].begin( tec_cfg[i].dirPin, tec_cfg[i].pwmPin, tec_cfg[i].thermistorPin, 
-                  tec_cfg[i].thermistor, tec_cfg[i].minimum_percent );
+    TEC[i].begin( i, tec_cfg[i].dirPin, tec_cfg[i].pwmPin, tec_cfg[i].thermistorPin, 
+                  tec_cfg[i].thermistor, tec_cfg[i].minimum_percent, tec_cfg[i].burst_ms );
+    thermistorPins[i] = tec_cfg[i].thermistorPin;
+    pwmPins[i] = tec_cfg[i].pwmPin;
+    seebeck[i] = !tec_cfg[i].thermistor;
+  }
+  LOG_INFO("Configured %d TEC current controllers", NUM_TEC);
+  // Keep the TECs from all switching on at once
+  if (!pwm_stagger_begin()) {
+    LOG_WARN("The TEC PWM outputs can't be staggered");
+  }
+
+  // Start sampling the thermistors in the background
+  filter_init();
+  if (!acquisition_begin(thermistorPins, NUM_TEC, ACQ_SAMPLE_RATE_HZ)) {
+    LOG_ERROR("Failed to start acquisition timer");
+  }
+  // Sample the Seebeck channels in their PWM off-phase where the pins allow
+  else if (!pwm_sync_begin(pwmPins, thermistorPins, seebeck, NUM_TEC)) {
+    LOG_WARN("No Seebeck channels can be sampled in the PWM off-phase");
+  }
+
+  // Run the on-board temperature controllers, in manual mode until commanded
+  if (!control_begin(TEC, NUM_TEC)) {
+    LOG_ERROR("Failed to start control timer");
   }
-  Serial.print("Configured "); Serial.print(NUM_TEC); Serial.println(" TEC current controllers");
-  delay(1000);
 
-  bool setup_successful = hardwareID_init() && network_init();
-  //Setup MQTT protocol, connect to broker
-  if(setup_successful){
-    delay(15000);
-    check_brokers();
-    Serial.println("Setup successful.");
+  // Read the module ID, then set up the network and connect to the broker,
+  // moving on as soon as each step is ready
+  boot_begin();
+  while (!boot_step()) {
+    log_drain();
+    yield();
+  }
+  if(boot_stage() == BOOT_DONE){
+    LOG_INFO("Setup successful.");
   }
   else {
-    Serial.println("Setup Failed.");
+    LOG_ERROR("Setup Failed.");
   }
+  scheduler_begin(tasks, sizeof(tasks) / sizeof(tasks[0]));
 }
 
+// Write out the log whenever no task is due
 void loop() {
-  for (int i = 0; i < NUM_TEC; i++) {
-      publish_data(i, TEC[i].getPower(), TEC[i].getDirection(), TEC[i].get_Temperature(i), TEC[i].getSeebeck());
+  if (!scheduler_run()) {
+    log_drain();
   }
-  digitalWrite(LED_BUILTIN, (blink++ & 0x01)); 
-  Serial.println("Publishing Metrics.");
-  publish_node_data();
-  delay(6000);
-  check_brokers();
 }
@@ -0,0 +1,298 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricAcquisition.cpp
+ * @brief Implements fixed-rate ADC acquisition of the thermistor/Seebeck pins,
+ * scanning half of the channels on each of the two ADCs in parallel.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricAcquisition.h"
+#include "ThermoElectricFilter.h"
+
+// Each ADC converts its share of the channels as a chain of back-to-back
+// conversions started by one ADC_ETC trigger, so both ADCs run in parallel and
+// the CPU only starts the scan and collects the latched results.  Trigger 0
+// drives ADC1 and trigger 4 drives ADC2.
+#define ACQ_MAX_CHAIN       8      // Longest ADC_ETC trigger chain
+#define ACQ_MAX_SCAN        (ACQ_MAX_CHAIN - 1)  // The last ADC_HC is ACQ_SYNC_HC
+
+// ADC input of each analog pin on ADC1 and ADC2, or -1 where the pin isn't
+// connected to that ADC (i.MX RT1060 reference manual, ADC external signals).
+typedef struct {
+    int    pin;
+    int8_t input[ACQ_NUM_ADCS];
+} AnalogPinInfo;
+
+static const AnalogPinInfo analog_pins[] = {
+    {14, { 7,  7}}, {15, { 8,  8}}, {16, {12, 12}}, {17, {11, 11}},
+    {18, { 6,  6}}, {19, { 5,  5}}, {20, {15, 15}}, {21, { 0,  0}},
+    {22, {13, 13}}, {23, {14, 14}}, {24, { 1, -1}}, {25, { 2, -1}},
+    {26, {-1,  3}}, {27, {-1,  4}}, {38, {-1,  1}}, {39, {-1,  2}},
+    {40, { 9,  9}}, {41, {10, 10}},
+};
+
+/*
+  Private variables
+*/
+static IntervalTimer m_timer;
+static int   m_num_channels = 0;
+static float m_rate_hz      = ACQ_SAMPLE_RATE_HZ;
+
+// Channel converted by each step of each ADC's chain
+static int      m_chain_channel[ACQ_NUM_ADCS][ACQ_MAX_CHAIN];
+static int      m_chain_length[ACQ_NUM_ADCS];
+static uint32_t m_done_mask  = 0;      // ADC_ETC done flags ending a scan
+static bool     m_scan_busy  = false;  // A scan has been started
+
+// ADC_ETC registers for the trigger driving each ADC
+static volatile uint32_t * const m_etc_ctrl[ACQ_NUM_ADCS] = {
+    &ADC_ETC_TRIG0_CTRL, &ADC_ETC_TRIG4_CTRL
+};
+static volatile uint32_t * const m_etc_chain[ACQ_NUM_ADCS][ACQ_MAX_CHAIN / 2] = {
+    {&ADC_ETC_TRIG0_CHAIN_1_0, &ADC_ETC_TRIG0_CHAIN_3_2, &ADC_ETC_TRIG0_CHAIN_5_4, &ADC_ETC_TRIG0_CHAIN_7_6},
+    {&ADC_ETC_TRIG4_CHAIN_1_0, &ADC_ETC_TRIG4_CHAIN_3_2, &ADC_ETC_TRIG4_CHAIN_5_4, &ADC_ETC_TRIG4_CHAIN_7_6},
+};
+static volatile uint32_t * const m_etc_result[ACQ_NUM_ADCS][ACQ_MAX_CHAIN / 2] = {
+    {&ADC_ETC_TRIG0_RESULT_1_0, &ADC_ETC_TRIG0_RESULT_3_2, &ADC_ETC_TRIG0_RESULT_5_4, &ADC_ETC_TRIG0_RESULT_7_6},
+    {&ADC_ETC_TRIG4_RESULT_1_0, &ADC_ETC_TRIG4_RESULT_3_2, &ADC_ETC_TRIG4_RESULT_5_4, &ADC_ETC_TRIG4_RESULT_7_6},
+};
+static const int m_etc_trigger[ACQ_NUM_ADCS] = {0, 4};
+
+// Ring buffers, written only by the timer interrupt
+static uint16_t m_ring[NUMBER_OF_CHANNELS][ACQ_RING_SIZE];
+static volatile uint32_t m_scan_count = 0;
+
+// Sequence lock: odd while the interrupt is writing, even otherwise.  Readers
+// retry if it was odd or changed while they were copying.
+static volatile uint32_t m_seq = 0;
+
+// Timer interrupt: collect the scan started on the previous tick, then start
+// the next one.  If the ADCs haven't finished, skip this tick.
+static void acquisition_isr(void){
+    if(m_scan_busy){
+        if((ADC_ETC_DONE0_1_IRQ & m_done_mask) != m_done_mask)
+            return;
+        ADC_ETC_DONE0_1_IRQ = m_done_mask;  // write 1 to clear
+
+        uint32_t slot = m_scan_count % ACQ_RING_SIZE;
+        m_seq++;
+        __sync_synchronize();
+        for(int adc = 0; adc < ACQ_NUM_ADCS; adc++){
+            for(int step = 0; step < m_chain_length[adc]; step += 2){
+                uint32_t result = *m_etc_result[adc][step / 2];
+                m_ring[m_chain_channel[adc][step]][slot] = result & 0xFFF;
+                if(step + 1 < m_chain_length[adc])
+                    m_ring[m_chain_channel[adc][step + 1]][slot] = (result >> 16) & 0xFFF;
+            }
+        }
+        m_scan_count++;
+        __sync_synchronize();
+        m_seq++;
+
+        for(int ch = 0; ch < m_num_channels; ch++)
+            filter_sample(ch, m_ring[ch][slot]);
+    }
+
+    // Start the next scan on both ADCs at once
+    for(int adc = 0; adc < ACQ_NUM_ADCS; adc++){
+        if(m_chain_length[adc] > 0)
+            *m_etc_ctrl[adc] |= ADC_ETC_TRIG_CTRL_SW_TRIG;
+    }
+    m_scan_busy = true;
+}
+
+// Split the channels between the two ADCs.  Pins on only one ADC go there;
+// the rest go to whichever ADC has the shorter chain.  Returns false if a pin
+// isn't an analog pin or a chain would be too long.
+static bool assign_chains(const int *pins, int num_channels, int8_t inputs[ACQ_NUM_ADCS][ACQ_MAX_CHAIN]){
+    const AnalogPinInfo *info[NUMBER_OF_CHANNELS];
+    for(int ch = 0; ch < num_channels; ch++){
+        info[ch] = NULL;
+        for(unsigned int i = 0; i < sizeof(analog_pins) / sizeof(*analog_pins); i++){
+            if(analog_pins[i].pin == pins[ch])
+                info[ch] = &analog_pins[i];
+        }
+        if(info[ch] == NULL){
+            LOG_ERROR("Not an analog pin: %d", pins[ch]);
+            return false;
+        }
+    }
+
+    m_chain_length[0] = m_chain_length[1] = 0;
+    for(int pass = 0; pass < 2; pass++){
+        for(int ch = 0; ch < num_channels; ch++){
+            bool both = info[ch]->input[0] >= 0 && info[ch]->input[1] >= 0;
+            // Place the single-ADC pins first, then balance the others
+            if(both != (pass == 1))
+                continue;
+            int adc;
+            if(both)
+                adc = (m_chain_length[1] < m_chain_length[0]) ? 1 : 0;
+            else
+                adc = (info[ch]->input[0] >= 0) ? 0 : 1;
+            if(m_chain_length[adc] >= ACQ_MAX_SCAN)
+                return false;
+            inputs[adc][m_chain_length[adc]] = info[ch]->input[adc];
+            m_chain_channel[adc][m_chain_length[adc]++] = ch;
+        }
+    }
+    return true;
+}
+
+// Program an ADC and its ADC_ETC trigger to convert the given inputs back to
+// back on a software trigger.
+static void setup_chain(int adc, const int8_t *inputs){
+    volatile uint32_t *hc = (adc == 0) ? &ADC1_HC0 : &ADC2_HC0;
+    if(adc == 0)
+        ADC1_CFG |= ADC_CFG_ADTRG;
+    else
+        ADC2_CFG |= ADC_CFG_ADTRG;
+
+    for(int pair = 0; pair < ACQ_MAX_CHAIN / 2; pair++)
+        *m_etc_chain[adc][pair] = 0;
+
+    int length = m_chain_length[adc];
+    for(int step = 0; step < length; step++){
+        // Each step uses its own ADC control register, handed to the ADC_ETC
+        hc[step] = ADC_HC_ADCH(ACQ_ADC_ETC_INPUT);
+        uint32_t segment = ADC_ETC_TRIG_CHAIN_CSEL0(inputs[step]) |
+                           ADC_ETC_TRIG_CHAIN_HWTS0(1 << step) |
+                           ADC_ETC_TRIG_CHAIN_B2B0;
+        // Flag completion after the last conversion
+        if(step == length - 1)
+            segment |= ADC_ETC_TRIG_CHAIN_IE0(1);
+        *m_etc_chain[adc][step / 2] |= (step & 1) ? (segment << 16) : segment;
+    }
+    if(length > 0){
+        *m_etc_ctrl[adc] = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(length - 1) |
+                           ADC_ETC_TRIG_CTRL_TRIG_MODE;
+        m_done_mask |= 1 << m_etc_trigger[adc];
+    }
+}
+
+// ADC input of an analog pin on the given ADC (0 = ADC1, 1 = ADC2), or -1 if
+// the pin isn't connected to that ADC.
+int acquisition_adc_input(int pin, int adc){
+    if(adc < 0 || adc >= ACQ_NUM_ADCS)
+        return -1;
+    for(unsigned int i = 0; i < sizeof(analog_pins) / sizeof(*analog_pins); i++){
+        if(analog_pins[i].pin == pin)
+            return analog_pins[i].input[adc];
+    }
+    return -1;
+}
+
+// Start sampling the given analog pins at the given rate.
+bool acquisition_begin(const int *pins, int num_channels, float rate_hz){
+    if(pins == NULL || num_channels <= 0 || num_channels > NUMBER_OF_CHANNELS || rate_hz <= 0)
+        return false;
+
+    m_timer.end();
+    int8_t inputs[ACQ_NUM_ADCS][ACQ_MAX_CHAIN];
+    if(!assign_chains(pins, num_channels, inputs))
+        return false;
+
+    // Reset the ADC_ETC and hand ADC2 to it instead of the touch controller
+    ADC_ETC_CTRL = ADC_ETC_CTRL_SOFTRST;
+    ADC_ETC_CTRL = 0;
+    m_done_mask = 0;
+    for(int adc = 0; adc < ACQ_NUM_ADCS; adc++)
+        setup_chain(adc, inputs[adc]);
+    ADC_ETC_DONE0_1_IRQ = m_done_mask;
+    ADC_ETC_CTRL = ADC_ETC_CTRL_TSC_BYPASS | ADC_ETC_CTRL_TRIG_ENABLE(m_done_mask);
+
+    m_num_channels = num_channels;
+    m_scan_count = 0;
+    m_scan_busy = false;
+    m_rate_hz = rate_hz;
+    return m_timer.begin(acquisition_isr, 1000000.0f / m_rate_hz);
+}
+
+// Stop sampling.
+void acquisition_end(void){
+    m_timer.end();
+    ADC_ETC_CTRL = ADC_ETC_CTRL_TSC_BYPASS;
+    m_scan_busy = false;
+}
+
+// Change the scan rate while running.
+bool acquisition_set_rate(float rate_hz){
+    if(rate_hz <= 0)
+        return false;
+    m_rate_hz = rate_hz;
+    return m_timer.update(1000000.0f / m_rate_hz);
+}
+
+float acquisition_get_rate(void){
+    return m_rate_hz;
+}
+
+// Number of complete scans taken since acquisition_begin().
+uint32_t acquisition_scan_count(void){
+    return m_scan_count;
+}
+
+// Copy all of the ring buffers.
+void acquisition_snapshot(AcquisitionSnapshot *snapshot){
+    uint32_t seq;
+    do {
+        seq = m_seq;
+        __sync_synchronize();
+        snapshot->scan_count = m_scan_count;
+        memcpy(snapshot->samples, m_ring, sizeof(m_ring));
+        __sync_synchronize();
+    } while((seq & 1) || seq != m_seq);
+}
+
+// Sum the newest num_samples samples of a channel.
+bool acquisition_read_sum(int channel, int num_samples, uint32_t *sum){
+    if(channel < 0 || channel >= m_num_channels || num_samples <= 0 || num_samples > ACQ_RING_SIZE)
+        return false;
+
+    uint32_t seq, count, total;
+    do {
+        seq = m_seq;
+        __sync_synchronize();
+        count = m_scan_count;
+        total = 0;
+        for(int i = 1; i <= num_samples; i++)
+            total += m_ring[channel][(count - i) % ACQ_RING_SIZE];
+        __sync_synchronize();
+    } while((seq & 1) || seq != m_seq);
+
+    if(count < (uint32_t) num_samples)
+        return false;
+    *sum = total;
+    return true;
+}
+
+// Wait until the given number of new scans have completed.
+bool acquisition_wait_for_scans(uint32_t num_scans){
+    uint32_t start_count = m_scan_count;
+    uint32_t timeout = ACQ_SCAN_TIMEOUT_MS + (uint32_t) (num_scans * 1000 / m_rate_hz);
+    uint32_t start = millis();
+    while(m_scan_count - start_count < num_scans){
+        if(millis() - start > timeout)
+            return false;
+        yield();
+    }
+    return true;
+}
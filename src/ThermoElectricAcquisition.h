@@ -0,0 +1,83 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricAcquisition.h
+ * @brief Fixed-rate ADC acquisition of the thermistor/Seebeck pins.  A timer
+ * interrupt collects a scan of every channel, converted by ADC1 and ADC2 in
+ * parallel, into a per-channel ring buffer, and readers take a consistent copy
+ * through a sequence lock.  Each sample is also fed to the channel's filter
+ * (see ThermoElectricFilter.h).
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_ACQUISITION_H
+#define THERMOELECTRIC_ACQUISITION_H
+
+#include "ThermoElectricGlobal.h"
+
+#define ACQ_SAMPLE_RATE_HZ   1000   // Default scan rate of all channels
+#define ACQ_RING_SIZE        64     // Samples kept per channel, power of 2
+#define ACQ_AVERAGE_SHIFT    4
+#define ACQ_AVERAGE_SAMPLES  (1 << ACQ_AVERAGE_SHIFT)  // Samples averaged for each reading
+#define ACQ_SCAN_TIMEOUT_MS  100    // Longest wait for a fresh scan
+
+#define ACQ_NUM_ADCS         2      // ADC1 and ADC2
+#define ACQ_ADC_ETC_INPUT    16     // ADC_HC channel selecting the ADC_ETC
+#define ACQ_SYNC_HC          7      // ADC_HC left free for synchronized conversions
+
+// A consistent copy of the ring buffers.  The newest sample of each channel is
+// at index (scan_count - 1) % ACQ_RING_SIZE.
+typedef struct {
+    uint32_t scan_count;
+    uint16_t samples[NUMBER_OF_CHANNELS][ACQ_RING_SIZE];
+} AcquisitionSnapshot;
+
+// Start sampling the given analog pins at the given rate.  The index of each
+// pin in the array is its channel number.  This takes over both ADCs, so
+// analogRead() can't be used afterwards.  Returns false if a pin isn't an
+// analog pin or there are too many channels for the ADCs.
+bool acquisition_begin(const int *pins, int num_channels, float rate_hz);
+
+// ADC input of an analog pin on the given ADC (0 = ADC1, 1 = ADC2), or -1 if
+// the pin isn't connected to that ADC.
+int acquisition_adc_input(int pin, int adc);
+
+// Stop sampling.
+void acquisition_end(void);
+
+// Change the scan rate while running.
+bool acquisition_set_rate(float rate_hz);
+float acquisition_get_rate(void);
+
+// Number of complete scans taken since acquisition_begin().
+uint32_t acquisition_scan_count(void);
+
+// Copy all of the ring buffers.
+void acquisition_snapshot(AcquisitionSnapshot *snapshot);
+
+// Sum the newest num_samples samples of a channel.  Returns false if the
+// channel is invalid or fewer samples have been taken.
+bool acquisition_read_sum(int channel, int num_samples, uint32_t *sum);
+
+// Wait until the given number of new scans have completed.  Returns false on
+// timeout.
+bool acquisition_wait_for_scans(uint32_t num_scans);
+
+#endif
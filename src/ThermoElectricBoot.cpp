@@ -0,0 +1,137 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricBoot.cpp
+ * @brief Implements the boot sequence.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricBoot.h"
+#include "ThermoElectricController.h"
+#include "ThermoElectricNetwork.h"
+
+static const char * const stage_names[] = {"serial", "id", "link", "ntp", "broker"};
+static const uint32_t stage_timeouts[] = {
+    BOOT_SERIAL_TIMEOUT_MS, BOOT_ID_TIMEOUT_MS, BOOT_LINK_TIMEOUT_MS,
+    BOOT_NTP_TIMEOUT_MS, BOOT_BROKER_TIMEOUT_MS
+};
+
+/*
+  Private variables
+*/
+static BootStage m_stage = BOOT_SERIAL;
+static uint32_t  m_boot_start = 0;     // millis() when boot_begin() was called
+static uint32_t  m_stage_start = 0;
+static uint32_t  m_stage_ms[BOOT_DONE];
+static bool      m_timed_out[BOOT_DONE];
+static bool      m_network_up = false;  // The boot time can be published
+static char      m_summary[128];
+
+// Describe the time taken by each stage so far, in milliseconds, after
+// starting at "start" since reset, e.g.
+// "start 320, serial 0, id 20, link 1450, ntp 12, broker 95, total 1897 ms"
+static void update_summary(void){
+    int len = snprintf(m_summary, sizeof(m_summary), "start %lu", (unsigned long) m_boot_start);
+    for(int i = 0; i < m_stage && i < BOOT_DONE; i++){
+        len += snprintf(m_summary + len, sizeof(m_summary) - len, ", %s %lu%s", stage_names[i],
+                        (unsigned long) m_stage_ms[i], m_timed_out[i] ? " (timeout)" : "");
+    }
+    snprintf(m_summary + len, sizeof(m_summary) - len, ", total %lu ms",
+             (unsigned long) millis());
+    if(m_network_up)
+        publish_boot_time(m_summary);
+}
+
+static void next_stage(BootStage stage, bool timed_out){
+    uint32_t now = millis();
+    if(m_stage < BOOT_DONE){
+        m_stage_ms[m_stage] = now - m_stage_start;
+        m_timed_out[m_stage] = timed_out;
+        if(timed_out){
+            LOG_WARN("Boot timed out waiting for %s", stage_names[m_stage]);
+        }
+    }
+    m_stage = stage;
+    m_stage_start = now;
+    update_summary();
+}
+
+// Start the boot sequence.
+void boot_begin(void){
+    m_boot_start = millis();
+    m_stage_start = m_boot_start;
+    m_stage = BOOT_SERIAL;
+    m_network_up = false;
+    hardwareID_init();
+}
+
+// Do the next piece of the boot sequence.
+bool boot_step(void){
+    if(m_stage >= BOOT_DONE)
+        return true;
+
+    bool timed_out = millis() - m_stage_start >= stage_timeouts[m_stage];
+    switch(m_stage){
+    case BOOT_SERIAL:
+#ifdef DEBUG
+        // Give a serial monitor the chance to see the boot messages
+        if(Serial || timed_out)
+            next_stage(BOOT_ID, timed_out && !Serial);
+#else
+        next_stage(BOOT_ID, false);
+#endif
+        break;
+
+    case BOOT_ID:
+        if(hardwareID_poll(timed_out)){
+            if(!hardwareID_valid() || !network_init()){
+                next_stage(BOOT_FAILED, false);
+                return true;
+            }
+            m_network_up = true;
+            next_stage(BOOT_LINK, timed_out);
+        }
+        break;
+
+    case BOOT_LINK:
+        if(network_link_up() || timed_out)
+            next_stage(BOOT_NTP, timed_out);
+        break;
+
+    case BOOT_NTP:
+        if(update_ntp() || timed_out)
+            next_stage(BOOT_BROKER, timed_out);
+        break;
+
+    case BOOT_BROKER:
+        check_brokers();
+        if(network_broker_connected() || timed_out)
+            next_stage(BOOT_DONE, timed_out);
+        break;
+
+    default:
+        break;
+    }
+    return m_stage >= BOOT_DONE;
+}
+
+BootStage boot_stage(void){
+    return m_stage;
+}
@@ -0,0 +1,60 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricBoot.h
+ * @brief The boot sequence.  Each stage moves on as soon as what it waits for
+ * is ready, or after its own timeout, and the time spent in each stage is
+ * published in the Properties/Boot Time metric.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_BOOT_H
+#define THERMOELECTRIC_BOOT_H
+
+#include "ThermoElectricGlobal.h"
+
+// Longest wait in each stage
+#define BOOT_SERIAL_TIMEOUT_MS   1000   // Serial monitor opened (DEBUG only)
+#define BOOT_ID_TIMEOUT_MS       200    // ID jumpers settled
+#define BOOT_LINK_TIMEOUT_MS     5000   // Ethernet link up
+#define BOOT_NTP_TIMEOUT_MS      5000   // NTP server answered
+#define BOOT_BROKER_TIMEOUT_MS   15000  // Connected to a broker
+
+enum BootStage {
+    BOOT_SERIAL = 0,
+    BOOT_ID,
+    BOOT_LINK,
+    BOOT_NTP,
+    BOOT_BROKER,
+    BOOT_DONE,
+    BOOT_FAILED
+};
+
+// Start the boot sequence.
+void boot_begin(void);
+
+// Do the next piece of the boot sequence without blocking for long.  Call
+// this until it returns true; then boot_stage() is BOOT_DONE, or BOOT_FAILED
+// if the node can't run on the network.
+bool boot_step(void);
+
+BootStage boot_stage(void);
+
+#endif
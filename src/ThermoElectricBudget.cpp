@@ -0,0 +1,80 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricBudget.cpp
+ * @brief Implements the supply sharing.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricBudget.h"
+
+// Share out what's available between the requests.
+float budget_allocate(const float *request, const float *weight, int num,
+                      float available, float *grant){
+    float total = 0;
+    for(int i = 0; i < num; i++){
+        grant[i] = (request[i] > 0 && i < BUDGET_MAX_REQUESTS) ? request[i] : 0;
+        total += grant[i];
+    }
+    if(num > BUDGET_MAX_REQUESTS)
+        num = BUDGET_MAX_REQUESTS;
+    if(total <= available)
+        return total;
+    if(available < 0)
+        available = 0;
+
+    // Raise a common level, per unit of weight, until the available amount
+    // is used up.  Each pass settles the requests that fit under the level,
+    // which raises it for the rest.
+    bool settled[BUDGET_MAX_REQUESTS];
+    float remaining = available;
+    float total_weight = 0;
+    for(int i = 0; i < num; i++){
+        settled[i] = (grant[i] == 0 || !(weight[i] > 0));
+        if(settled[i])
+            grant[i] = 0;
+        else
+            total_weight += weight[i];
+    }
+    while(total_weight > 0){
+        float level = remaining / total_weight;
+        bool any = false;
+        for(int i = 0; i < num; i++){
+            if(!settled[i] && grant[i] <= level * weight[i]){
+                settled[i] = true;
+                any = true;
+                remaining -= grant[i];
+                total_weight -= weight[i];
+            }
+        }
+        if(!any){
+            for(int i = 0; i < num; i++){
+                if(!settled[i])
+                    grant[i] = level * weight[i];
+            }
+            break;
+        }
+    }
+
+    total = 0;
+    for(int i = 0; i < num; i++)
+        total += grant[i];
+    return total;
+}
@@ -0,0 +1,42 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricBudget.h
+ * @brief Sharing a limited supply between the TECs.  Like the PWM timing
+ * calculations, this doesn't touch the hardware, so it can be built and
+ * checked on a host computer.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_BUDGET_H
+#define THERMOELECTRIC_BUDGET_H
+
+#define BUDGET_MAX_REQUESTS  16
+
+// Share out what's available between the requests.  If they all fit, each
+// gets what it asks for.  Otherwise each gets the same share per unit of
+// weight, except that requests smaller than their share get just what they
+// ask for and the rest is shared among the others (weighted max-min
+// fairness).  Requests with no weight get nothing when there isn't enough,
+// as do any beyond the first BUDGET_MAX_REQUESTS.  Returns the total granted.
+float budget_allocate(const float *request, const float *weight, int num,
+                      float available, float *grant);
+
+#endif
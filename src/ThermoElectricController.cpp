@@ -3,6 +3,11 @@
 */
 #include "ThermoElectricController.h"
 #include "ThermoElectricGlobal.h"
+#include "ThermoElectricAcquisition.h"
+#include "ThermoElectricFilter.h"
+#include "ThermoElectricPwm.h"
+#include "ThermoElectricProfiler.h"
+#include "ThermoElectricThermistorTable.h"
 
 /*
 Resistance at 25 degrees C
@@ -11,7 +16,7 @@ The beta coefficient of the thermistor (usually 3000-4000)
 #ifdef thermistor_10K
     #define THERMISTORNOMINAL 10000
     #define BCOEFFICIENT 2.514458134e-4 // = 1/3977, B = 3997 K
-#elif thermistor_2K 
+#elif defined(thermistor_2K)
     #define THERMISTORNOMINAL 2200   
     #define BCOEFFICIENT 2.544529262e-4 // = 1/3930, B = 3930 K
 #else 
@@ -19,31 +24,67 @@ The beta coefficient of the thermistor (usually 3000-4000)
 #endif
 // temperature for nominal resistance (almost always 25 C = 298.15 K)
 #define TEMPERATURENOMINAL 298.15   
+// resistor on the ground side of the thermistor divider
+#define SERIESRESISTOR 10000
+
+// Temperature for every ADC count, computed by the compiler
+static constexpr ThermistorTable thermistor_table =
+  make_thermistor_table(THERMISTORNOMINAL, BCOEFFICIENT, TEMPERATURENOMINAL, SERIESRESISTOR);
+
+// Seebeck amplifier: 3.3 V full scale, 12 bits, gain of 500.  Nanovolts per
+// ADC count in Q16.
+static constexpr int64_t SEEBECK_NV_PER_COUNT_Q16 = (int64_t) (3.3e9 / 4096 / 500 * 65536 + 0.5);
+
+// Nanovolts for the sum of ACQ_AVERAGE_SAMPLES Seebeck samples
+static int32_t seebeck_nanovolts(uint32_t sum) {
+  return (int32_t) ((sum * SEEBECK_NV_PER_COUNT_Q16) >> (16 + ACQ_AVERAGE_SHIFT));
+}
+
+static int32_t millikelvin_to_mc(int32_t mk) {
+  return mk - 273150;
+}
 
 static float ref_Low;
 static float ref_High;
 static int hardware_id = -1;
 
+// Seebeck measurement in progress, from startSeebeckAll() to finishSeebeckAll()
+static uint32_t seebeck_sums[NUMBER_OF_CHANNELS];
+static bool seebeck_blank[NUMBER_OF_CHANNELS];
+static bool seebeck_blanked; // any channel blanked
+static bool seebeck_settled; // blanked channels have settled
+static uint32_t seebeck_since_ms; // when blanked, then when settled
+static uint32_t seebeck_scans; // scan count when settled
+
 ThermoElectricController::ThermoElectricController() {}
 
-int ThermoElectricController::begin( const int dirP, const int pwmP, const int thermistorP, const bool thermistor_installed, const int minVal ) {
+int ThermoElectricController::begin( const int chan, const int dirP, const int pwmP, const int thermistorP, const bool thermistor_installed, const int minVal, const int burstSlot ) {
   /*! @brief     Initializes the contents of the class
     @details   Sets pin definitions, and initializes the variables of the class.
+    @param[in] chan Defines which acquisition channel samples thermistorP
     @param[in] dirPin Defines which pin controls direction
     @param[in] pwmPin Defines which pin provides PWM pulses to the TEC
     @param[in] thermistorP Defines which pin provides PWM pulses to the TEC
+    @param[in] minVal Lowest duty in percent the TEC driver can run at
+    @param[in] burstSlot If not 0, reach powers below minVal by switching
+               between off and minVal in slots of this many milliseconds
     @return    void 
   */
   
+  channel = chan;
   dirPin = dirP;
   pwmPin = pwmP;
   thermistorPin = thermistorP;
   temperature = -40.0;
+  raw_millikelvin = 233150; // -40 C
   raw_data = 0.0 ;
   pwmPct = 0;
   dir = 0;
+  held = false;
+  heldPct = 0;
   thermistorResistor = 10000;
   minPercent = minVal;
+  burstMs = burstSlot;
   thermistorInstalled = thermistor_installed;
 
   // set the pins properly for this TEC
@@ -51,17 +92,70 @@ int ThermoElectricController::begin( const int dirP, const int pwmP, const int t
   pinMode(pwmPin,OUTPUT);
   pinMode(thermistorPin,INPUT_DISABLE);
   // set up the PWM parameters for the PWM pin.
-  analogWriteFrequency(pwmPin, TEC_PWM_FREQ);
+  if (!pwm_output_begin(pwmPin, TEC_PWM_FREQ)) {
+    LOG_ERROR("Pin %d can't drive a TEC", pwmPin);
+  }
+  if (burstMs > 0 && minPercent > 0) {
+    pwm_output_burst(pwmPin, (uint32_t) (minPercent * (PWM_DUTY_ONE / 100.0f) + 0.5f), burstMs);
+  }
   analogReadResolution(12);
   
   return 0;
 }
 
+// Average PWM duty in percent for a power.  In burst mode the power is the
+// duty, with the PWM layer bursting below the minimum; otherwise the power is
+// spread over the minimum to 100%.
+float ThermoElectricController::dutyPercent( const float power ) {
+  float duty = fabs(power);
+  if (burstMs <= 0) {
+    duty = duty/100 * (100-minPercent) + minPercent ;
+  }
+  return duty;
+}
+
 void ThermoElectricController::setPwm( float power ) {
   //Serial.print("Set PWM Power: ");Serial.println(power);
-  float scaled_power = fabs(power)/100 * (100-minPercent) + minPercent ;
-  float tmp = (float) ((scaled_power * 255.0)/100.0 + 0.5);// convert to 0-255 )
-  analogWrite( pwmPin,tmp); //
+  // The control interrupt also writes the PWM, and channels share FlexPWM
+  // registers
+  noInterrupts();
+  writePwm(power);
+  interrupts();
+}
+
+// Write the PWM for a power, with interrupts already disabled
+void ThermoElectricController::writePwm( float power ) {
+  float scaled_power = dutyPercent(power);
+  uint32_t duty = (uint32_t) (scaled_power * (PWM_DUTY_ONE / 100.0f) + 0.5f); // convert to 16 bits
+  pwm_output_write(pwmPin, duty);
+}
+
+// Blank the drive for a Seebeck reading.  Until release(), power changes are
+// only remembered, so the control interrupt can't drive the TEC mid-reading.
+void ThermoElectricController::hold( void ) {
+  noInterrupts();
+  held = true;
+  heldPct = pwmPct;
+  writePwm(0);
+  interrupts();
+}
+
+// Drive the TEC again, at the power last set while it was held
+void ThermoElectricController::release( void ) {
+  noInterrupts();
+  held = false;
+  if((heldPct < 0) != dir) {
+    // the drive is still off, so the direction can change straight away
+    digitalWrite(dirPin, (heldPct < 0));
+    dir = (heldPct < 0);
+  }
+  writePwm(heldPct);
+  pwmPct = heldPct;
+  interrupts();
+}
+
+bool ThermoElectricController::isHeld( void ) {
+  return held;
 }
 
 int ThermoElectricController::setPower( const float power ) {
@@ -70,7 +164,17 @@ int ThermoElectricController::setPower( const float power ) {
   
   if( power > 100 || power < -100 )
     return -1;
-  Serial.print("Setting Power to ");Serial.println( power ); 
+  LOG_DEBUG("Setting Power to %0.2f", power);
+  applyPower(power);
+  return 0; 
+}
+
+// Set the power without checking or logging it, for the control interrupt
+void ThermoElectricController::applyPower( const float power ) {
+  if( held ) {
+    heldPct = power;
+    return;
+  }
   // set direction
   if(((power < 0) && (pwmPct >= 0)) ||
      ((power > 0) && (pwmPct <= 0)))
@@ -83,76 +187,138 @@ int ThermoElectricController::setPower( const float power ) {
   // Set duty cycle
   setPwm(power);
   pwmPct = power; // save the power setting
-  return 0; 
 }
 
 float  ThermoElectricController::getSeebeck( void ) {
-  // read the analog voltage
-  int adcCounts = 0;
-  float save_power  = pwmPct;
-  // check to see if it's configured
-  if( thermistorInstalled ) {
-    return -100;
+  float seebeck;
+  getSeebeckAll(this, 1, &seebeck);
+  return seebeck;
+}
+
+// Measure the Seebeck voltage of every Seebeck-configured channel in the
+// array, waiting for the result.  The main loop uses startSeebeckAll() and
+// finishSeebeckAll() instead, so it isn't held up.
+void ThermoElectricController::getSeebeckAll( ThermoElectricController *tecs, int num_tecs, float *seebeck ) {
+  startSeebeckAll(tecs, num_tecs);
+  while( !finishSeebeckAll(tecs, num_tecs, seebeck) ) {
+    yield();
   }
-  //Serial.print("Getting Temperature from pin ");Serial.println( thermistorPin );
-  // set the power to 0;
-  setPwm(0);
-  // wait a few milliseconds
-  delay(10);
-  for(int i = 0; i < 16; i++) {
-    adcCounts += analogRead(thermistorPin);
+}
+
+// Start measuring the Seebeck voltages.  Channels with a recent reading taken
+// in the off-phase of their own PWM use it and keep driving.  The rest are
+// held off in one window, so they share one settling time and their samples
+// are taken at the same time.
+void ThermoElectricController::startSeebeckAll( ThermoElectricController *tecs, int num_tecs ) {
+  seebeck_blanked = false;
+  pwm_sync_service();
+  for (int i = 0; i < num_tecs; i++) {
+    seebeck_blank[i] = !tecs[i].thermistorInstalled &&
+                       !pwm_sync_read_sum(tecs[i].channel, PWM_SYNC_MAX_AGE_MS, &seebeck_sums[i]);
+    if( seebeck_blank[i] ) {
+      tecs[i].hold();
+      seebeck_blanked = true;
+    }
   }
-  adcCounts = adcCounts >> 4;  // divide by 16
-  setPwm(save_power);
-  // convert to voltage 
-  float voltage = adcCounts * 3.3/4096.0/500;
-  return voltage * 1000;
+  seebeck_settled = false;
+  seebeck_since_ms = millis();
 }
 
-// 0 to 3.3 volts, 12 bits resolution
-// Need to read and average a bunch of these together to beat down the noise...
-float ThermoElectricController::get_Temperature(int channel) {
- 
-  extern Thermistor therm[NUM_TEC];
-  extern bool calibrated;
+// Finish the measurement started by startSeebeckAll(), once the blanked
+// channels have settled and enough fresh samples have been taken to average.
+// Returns false, without waiting, until then.  Channels with a thermistor
+// installed report -100, and blanked channels report NAN if the samples never
+// came or can't be read.
+bool ThermoElectricController::finishSeebeckAll( ThermoElectricController *tecs, int num_tecs, float *seebeck ) {
+  bool timed_out = false;
+  if( seebeck_blanked ) {
+    if( !seebeck_settled ) {
+      if( millis() - seebeck_since_ms < (uint32_t) SEEBECK_SETTLE_MS ) {
+        return false;
+      }
+      seebeck_settled = true;
+      seebeck_since_ms = millis();
+      seebeck_scans = acquisition_scan_count();
+      return false;
+    }
+    if( acquisition_scan_count() - seebeck_scans < ACQ_AVERAGE_SAMPLES ) {
+      if( millis() - seebeck_since_ms <= ACQ_SCAN_TIMEOUT_MS + (uint32_t) (ACQ_AVERAGE_SAMPLES * 1000 / acquisition_get_rate()) ) {
+        return false;
+      }
+      LOG_WARN("Timed out waiting for Seebeck samples");
+      timed_out = true;
+    }
+  }
+  PROFILE_SCOPE(PROBE_GET_SEEBECK);
+  for (int i = 0; i < num_tecs; i++) {
+    if( tecs[i].thermistorInstalled ) {
+      seebeck[i] = -100;
+      continue;
+    }
+    if( seebeck_blank[i] ) {
+      // After a timeout the newest samples may be from before the window,
+      // with the drive still on
+      bool read = !timed_out && acquisition_read_sum(tecs[i].channel, ACQ_AVERAGE_SAMPLES, &seebeck_sums[i]);
+      tecs[i].release();
+      if( !read ) {
+        seebeck[i] = NAN;
+        continue;
+      }
+    }
+    // convert to millivolts for publishing
+    seebeck[i] = seebeck_nanovolts(seebeck_sums[i]) * 1e-6f;
+  }
+  return true;
+}
 
-  //read the analog voltage
-  int adcCounts = 0;
-  //Serial.print("Getting Temperature from pin ");Serial.println( thermistorPin );
-  for(int i = 0; i < 16; i++) {
-    adcCounts += analogRead(thermistorPin);
+// 0 to 3.3 volts, 12 bits resolution
+// The channel's filter beats down the noise, and its output is carried as a
+// fixed-point count with FILTER_FRAC_BITS fraction bits.
+// Returns the last good temperature if the filter hasn't filled yet.
+int32_t ThermoElectricController::get_raw_millikelvin(int channel) {
+  uint32_t adcCounts = 0;
+  if(!filter_read(channel, &adcCounts)) {
+    return raw_millikelvin;
   }
-  raw_data = adcCounts >> 4;  // divide by 16
-  
-  // convert to voltage 
-  float voltage = raw_data * 3.3/4096.0;
- 
-  //thermistance depends on order of resistors in voltage divider circuitry.
-  //10K Ohm resistor assumed
-  float thermistance = 10000 * ((3.3/voltage) - 1); //If voltage drop accross thermistor occurs first.
-  
-  //Simplified B parameter Steinhart-Hart equation.
+  raw_data = adcCounts >> FILTER_FRAC_BITS;
+
+  //Simplified B parameter Steinhart-Hart equation, tabulated per ADC count.
   //B coefficient for thermistor:  TT7-10KC3-11
-  temperature = (1/((1/TEMPERATURENOMINAL) + BCOEFFICIENT*log(thermistance/THERMISTORNOMINAL))) - 273.15;
-  //Serial.printf("RawTemperature: %f\n", temperature);
+  raw_millikelvin = thermistor_lookup(thermistor_table, adcCounts, FILTER_FRAC_BITS);
+  return raw_millikelvin;
+}
 
-  //If calibration data exists, apply calibration equation
+// Calibrated temperature in millikelvin, if calibration data exists
+int32_t ThermoElectricController::get_millikelvin(int channel) {
+  extern Thermistor therm[NUM_TEC];
+  extern bool calibrated;
+
+  int32_t mk = get_raw_millikelvin(channel);
   if (calibrated) {
-    temperature = (((temperature - therm[channel].getRaw_low()) * (ref_High - ref_Low)) / 
-                  (therm[channel].getRaw_high() - therm[channel].getRaw_low()) + ref_Low);
-    Serial.printf("CalTemperature: %f\n", temperature);
+    mk = therm[channel].apply_calibration(mk);
   }
+  return mk;
+}
+
+float ThermoElectricController::get_Temperature(int channel) {
+  PROFILE_SCOPE(PROBE_GET_TEMPERATURE);
+  temperature = millikelvin_to_mc(get_millikelvin(channel)) * 0.001f;
   return temperature;
 }
 
 float  ThermoElectricController::getPower( void ) {
-  return pwmPct;
+  // A held channel reports the power it goes back to
+  return held ? heldPct : pwmPct;
 }
 
 bool  ThermoElectricController::getDirection( void ) {
   return dir;
 }
 
+bool  ThermoElectricController::hasThermistor( void ) {
+  return thermistorInstalled;
+}
+
 /*
 Calibration function, takes reference input from user interface and saves calibration data into 
 teensy EEPROM.
@@ -161,37 +327,38 @@ EEPROM address (0) = calibration flag
     if address(0) = 1 ; calibrated
 */
 bool Thermistor::calibrate( float ref_temp, int tempNum ) {
-  Serial.printf("Set temp is %0.2f, calibration begun.\n", ref_temp); 
+  LOG_INFO("Set temp is %0.2f, calibration begun.", ref_temp);
   extern ThermoElectricController TEC[NUM_TEC];
   extern Thermistor therm[NUM_TEC];  
   extern bool calibrated;
 
   if (tempNum == 1) {
     eeAddr = 1;
-    Serial.println("Cal data 1 INW");
+    LOG_INFO("Cal data 1 INW");
     ref_Low = ref_temp;
     EEPROM.put(eeAddr, ref_Low);
     eeAddr += sizeof(ref_Low); 
     for (int i = 0; i < NUM_TEC; i++) { 
-      therm[i].raw_Low = TEC[i].get_Temperature(i);
+      therm[i].raw_Low = millikelvin_to_mc(TEC[i].get_raw_millikelvin(i)) * 0.001f;
       EEPROM.put(eeAddr, therm[i].raw_Low);
       eeAddr += sizeof(therm[i].raw_Low);
     }
     return false;
   } 
   else if (tempNum == 2) {
-    Serial.println("Cal data 2 INW");
+    LOG_INFO("Cal data 2 INW");
     ref_High = ref_temp;
     EEPROM.put(eeAddr, ref_High);
     eeAddr += sizeof(ref_High); 
     for (int i = 0; i < NUM_TEC; i++) { 
-      therm[i].raw_High = TEC[i].get_Temperature(i);
+      therm[i].raw_High = millikelvin_to_mc(TEC[i].get_raw_millikelvin(i)) * 0.001f;
       EEPROM.put(eeAddr, therm[i].raw_High);
       eeAddr += sizeof(therm[i].raw_High); 
+      therm[i].update_cal_coefficients();
     }
     EEPROM.write(0, 0x01);
     calibrated = true;
-    Serial.println("Calibration complete.");
+    LOG_INFO("Calibration complete.");
   } 
   return true;  
 }
@@ -204,6 +371,7 @@ bool Thermistor::clear_calibration() {
   for (int i = 0; i < NUM_TEC; i++) { 
     therm[i].raw_Low = 0;
     therm[i].raw_High = 0;
+    therm[i].update_cal_coefficients();
   }
   EEPROM.write(0, 0x00);
   calibrated = false;
@@ -245,10 +413,49 @@ bool Thermistor::load_cal_data() {
     EEPROM.get(eeAddr, temp_data);
     therm[i].setRaw_high(temp_data);
     eeAddr += sizeof(temp_data); 
+    therm[i].update_cal_coefficients();
   }
   return true;
 }
 
+// Precompute the calibration line through (raw_Low, ref_Low) and
+// (raw_High, ref_High) as a Q16 gain and a millikelvin offset, so applying it
+// is one multiply and add.  A degenerate calibration passes temperatures
+// through unchanged.
+void Thermistor::update_cal_coefficients() {
+  float span = raw_High - raw_Low;
+  if (span == 0.0f) {
+    cal_gain_q16 = 1 << 16;
+    cal_offset_mk = 0;
+    return;
+  }
+  float gain = (ref_High - ref_Low) / span;
+  float raw_low_mk = (raw_Low + 273.15f) * 1000.0f;
+  float ref_low_mk = (ref_Low + 273.15f) * 1000.0f;
+  cal_gain_q16 = (int32_t) lroundf(gain * 65536.0f);
+  cal_offset_mk = (int32_t) lroundf(ref_low_mk - raw_low_mk * (cal_gain_q16 / 65536.0f));
+}
+
+int32_t Thermistor::apply_calibration(int32_t raw_mk) {
+  return (int32_t) (((int64_t) raw_mk * cal_gain_q16) >> 16) + cal_offset_mk;
+}
+
+// Read the module ID jumpers.  The pins have inverted sense, so the raw values
+// have been reversed.
+static int read_id_pins() {
+  int pin0 = digitalRead(ID_PIN_0) ? 0 : 1;
+  int pin1 = digitalRead(ID_PIN_1) ? 0 : 1;
+  int pin2 = digitalRead(ID_PIN_2) ? 0 : 1;
+  int pin3 = digitalRead(ID_PIN_3) ? 0 : 1;
+  int pin4 = digitalRead(ID_PIN_4) ? 0 : 1;
+
+  return ( pin4 << 4 ) +
+         ( pin3 << 3 ) +
+         ( pin2 << 2 ) +
+         ( pin1 << 1 ) +
+         ( pin0 << 0 );
+}
+
 //Initialized Module ID hardware
 bool hardwareID_init(){
 
@@ -257,34 +464,43 @@ bool hardwareID_init(){
   pinMode(ID_PIN_2,INPUT_PULLUP);
   pinMode(ID_PIN_3,INPUT_PULLUP);
   pinMode(ID_PIN_4,INPUT_PULLUP);
+  return true;
+}
 
-  // Wait for pin inputs to settle
-  delay(100);
+// Poll the jumpers until they have read the same for ID_SETTLE_MS, then latch
+// the hardware ID.  The ID must only be latched once, even if it's invalid, in
+// order to ensure that the jumpers are correctly read.  If force is set, the
+// current reading is latched whether or not it has settled.  Returns true
+// once the ID has been latched.
+bool hardwareID_poll(bool force){
+  static bool latched = false;
+  static int last_id = -1;
+  static uint32_t stable_since = 0;
 
-  // Read the jumpers.  This must only be done once, even if they produce an
-  // invalid ID, in order to ensure that they are correctly read.
-  // The pins have inverted sense, so the raw values have been reversed.
-  int pin0 = digitalRead(ID_PIN_0) ? 0 : 1;
-  int pin1 = digitalRead(ID_PIN_1) ? 0 : 1;
-  int pin2 = digitalRead(ID_PIN_2) ? 0 : 1;
-  int pin3 = digitalRead(ID_PIN_3) ? 0 : 1;
-  int pin4 = digitalRead(ID_PIN_4) ? 0 : 1;
-
-  hardware_id = ( pin4 << 4 ) +
-                ( pin3 << 3 ) +
-                ( pin2 << 2 ) +
-                ( pin1 << 1 ) +
-                ( pin0 << 0 );
-  delay(10000);
-  DebugPrintNoEOL("Hardware ID = ");
-  DebugPrint(hardware_id);
+  if (latched) {
+    return true;
+  }
+  int id = read_id_pins();
+  if (id != last_id) {
+    last_id = id;
+    stable_since = millis();
+  }
+  if (!force && millis() - stable_since < ID_SETTLE_MS) {
+    return false;
+  }
+  hardware_id = id;
+  latched = true;
+  LOG_INFO("Hardware ID = %d", hardware_id);
 
   // Make sure ID is valid
   if(hardware_id < 0 || hardware_id > MAX_BOARD_ID){
-      DebugPrint("invalid board ID detected, check jumpers");
-      return false;
+      LOG_ERROR("invalid board ID detected, check jumpers");
   }
-  return true; //Success
+  return true;
+}
+
+bool hardwareID_valid() {
+  return hardware_id >= 0 && hardware_id <= MAX_BOARD_ID;
 }
 
 int get_hardware_id() {
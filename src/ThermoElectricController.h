@@ -15,34 +15,55 @@ Report Thermistor ADC values to serial or over Ethernet port  (this would be a g
 #include "ThermoElectricGlobal.h"
 
 bool hardwareID_init();
+bool hardwareID_poll(bool force);
+bool hardwareID_valid();
 int get_hardware_id();
 
 const int TEC_PWM_FREQ = 50000;
+const int SEEBECK_SETTLE_MS = 10; // drive off time before sampling Seebeck voltage
+const int ID_SETTLE_MS = 20; // ID jumpers must read the same for this long
 
 class ThermoElectricController {
  public:  
   ThermoElectricController();
-  int begin ( const int dirPin, const int pwmPin, const int thermistorPin, const bool thermistor_installed, const int minVal);
+  int begin ( const int channel, const int dirPin, const int pwmPin, const int thermistorPin, const bool thermistor_installed, const int minVal, const int burstSlot = 0);
   
   int setPower( const float percent );
+  void applyPower( const float percent );
   //void setDirection( const bool direction );
   float get_Temperature(int channel);
+  int32_t get_millikelvin(int channel);
+  int32_t get_raw_millikelvin(int channel);
   float getPower();
   bool getDirection();
+  bool hasThermistor();
+  float dutyPercent( const float percent );
   float getSeebeck();
+  static void getSeebeckAll(ThermoElectricController *tecs, int num_tecs, float *seebeck);
+  static void startSeebeckAll(ThermoElectricController *tecs, int num_tecs);
+  static bool finishSeebeckAll(ThermoElectricController *tecs, int num_tecs, float *seebeck);
+  bool isHeld();
 
  protected:
   void setPwm(float power);
+  void writePwm(float power);
+  void hold();
+  void release();
   float temperature; // cooked ADC value
+  int32_t raw_millikelvin; // uncalibrated temperature
   int thermistor; // raw ADC value
   float pwmPct;
   bool dir;
+  volatile bool held; // drive blanked for a Seebeck reading
+  float heldPct; // power to restore when released
+  int channel; // acquisition channel number
   int dirPin;
   int pwmPin;
   int thermistorPin;
   int thermistorResistor;
   bool thermistorInstalled;
   int minPercent; 
+  int burstMs; // pulse-density slot below minPercent, or 0
   int raw_data;
 };
 
@@ -55,11 +76,15 @@ class Thermistor: public ThermoElectricController {
     float getRaw_high();
     void setRaw_low(float low);
     void setRaw_high(float high);
+    void update_cal_coefficients();
+    int32_t apply_calibration(int32_t raw_mk);
     int eeAddr;
 
   private:
     float raw_Low;
     float raw_High;
+    int32_t cal_gain_q16;   // calibrated = raw * gain / 2^16 + offset
+    int32_t cal_offset_mk;
 };
 
 #endif
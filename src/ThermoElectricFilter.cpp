@@ -0,0 +1,221 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricFilter.cpp
+ * @brief Implements the per-channel digital filters.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricFilter.h"
+
+// The interrupt does a fixed, small amount of work per sample for every filter
+// type: the boxcar keeps a running sum, the IIR and CIC update their state,
+// and the median only stores the sample - it's sorted by the reader.
+typedef struct {
+    uint8_t  type;
+    uint16_t length;
+    uint16_t filled;                        // Samples since configured, up to FILTER_MAX_LENGTH
+    uint16_t next;                          // Slot in history for the next sample
+    uint16_t history[FILTER_MAX_LENGTH];    // Boxcar and median window
+    uint32_t sum;                           // Boxcar running sum
+    int32_t  iir;                           // IIR output, Q16 counts
+    uint32_t integrator[FILTER_CIC_ORDER];  // CIC state, wraps modulo 2^32
+    uint32_t comb[FILTER_CIC_ORDER];
+    uint16_t phase;                         // Samples into the CIC decimation
+    uint16_t cic_outputs;                   // CIC outputs since configured
+    uint32_t cic_out;                       // Latest CIC output, gain length^3
+} ChannelFilter;
+
+/*
+  Private variables
+*/
+static ChannelFilter m_filter[NUMBER_OF_CHANNELS];
+
+static bool valid_length(int type, int length){
+    if(length < 1)
+        return false;
+    switch(type){
+    case FILTER_BOXCAR:
+    case FILTER_CIC:
+        return length <= FILTER_MAX_LENGTH;
+    case FILTER_MEDIAN:
+        return length <= FILTER_MAX_MEDIAN;
+    case FILTER_IIR:
+        return length <= FILTER_MAX_IIR;
+    default:
+        return false;
+    }
+}
+
+// Set every channel to the default filter.
+void filter_init(void){
+    for(int ch = 0; ch < NUMBER_OF_CHANNELS; ch++)
+        filter_configure(ch, FILTER_DEFAULT_TYPE, FILTER_DEFAULT_LENGTH);
+}
+
+// Change the filter of a channel.
+bool filter_configure(int channel, int type, int length){
+    if(channel < 0 || channel >= NUMBER_OF_CHANNELS || !valid_length(type, length))
+        return false;
+
+    noInterrupts();
+    ChannelFilter *f = &m_filter[channel];
+    memset(f, 0, sizeof(*f));
+    f->type = type;
+    f->length = length;
+    interrupts();
+    return true;
+}
+
+int filter_get_type(int channel){
+    if(channel < 0 || channel >= NUMBER_OF_CHANNELS)
+        return -1;
+    return m_filter[channel].type;
+}
+
+int filter_get_length(int channel){
+    if(channel < 0 || channel >= NUMBER_OF_CHANNELS)
+        return -1;
+    return m_filter[channel].length;
+}
+
+// Feed one new sample of a channel.
+void filter_sample(int channel, uint16_t sample){
+    ChannelFilter *f = &m_filter[channel];
+    switch(f->type){
+    case FILTER_BOXCAR:
+    case FILTER_MEDIAN: {
+        if(f->type == FILTER_BOXCAR){
+            // Drop the sample leaving the window from the running sum
+            if(f->filled >= f->length)
+                f->sum -= f->history[(f->next + FILTER_MAX_LENGTH - f->length) % FILTER_MAX_LENGTH];
+            f->sum += sample;
+        }
+        f->history[f->next] = sample;
+        break;
+    }
+    case FILTER_IIR: {
+        int32_t x = (int32_t) sample << 16;
+        if(f->filled == 0)
+            f->iir = x;
+        else
+            f->iir += (x - f->iir) / f->length;
+        break;
+    }
+    case FILTER_CIC: {
+        uint32_t value = sample;
+        for(int i = 0; i < FILTER_CIC_ORDER; i++){
+            f->integrator[i] += value;
+            value = f->integrator[i];
+        }
+        if(++f->phase >= f->length){
+            f->phase = 0;
+            for(int i = 0; i < FILTER_CIC_ORDER; i++){
+                uint32_t delayed = f->comb[i];
+                f->comb[i] = value;
+                value -= delayed;
+            }
+            f->cic_out = value;
+            if(f->cic_outputs <= FILTER_CIC_ORDER)
+                f->cic_outputs++;
+        }
+        break;
+    }
+    }
+    // The slot wraps on its own, and the fill count stops once the window is
+    // full, so neither is thrown by the firmware running for months
+    if(++f->next >= FILTER_MAX_LENGTH)
+        f->next = 0;
+    if(f->filled < FILTER_MAX_LENGTH)
+        f->filled++;
+}
+
+// Latest filtered count of a channel.
+bool filter_read(int channel, uint32_t *count){
+    if(channel < 0 || channel >= NUMBER_OF_CHANNELS)
+        return false;
+
+    ChannelFilter *f = &m_filter[channel];
+    uint16_t window[FILTER_MAX_MEDIAN];
+    uint32_t value = 0;
+    bool ready;
+    int type, length;
+
+    // Take a consistent copy of what the reader needs
+    noInterrupts();
+    type = f->type;
+    length = f->length;
+    switch(type){
+    case FILTER_BOXCAR:
+        ready = f->filled >= f->length;
+        value = f->sum;
+        break;
+    case FILTER_MEDIAN:
+        ready = f->filled >= f->length;
+        for(int i = 0; ready && i < length; i++)
+            window[i] = f->history[(f->next + FILTER_MAX_LENGTH - 1 - i) % FILTER_MAX_LENGTH];
+        break;
+    case FILTER_IIR:
+        ready = f->filled > 0;
+        value = f->iir;
+        break;
+    case FILTER_CIC:
+        // The combs need FILTER_CIC_ORDER outputs of history to settle
+        ready = f->cic_outputs > FILTER_CIC_ORDER;
+        value = f->cic_out;
+        break;
+    default:
+        ready = false;
+        break;
+    }
+    interrupts();
+
+    if(!ready || length == 0)
+        return false;
+
+    switch(type){
+    case FILTER_BOXCAR:
+        *count = (value << FILTER_FRAC_BITS) / length;
+        break;
+    case FILTER_MEDIAN:
+        // Insertion sort; the window is short
+        for(int i = 1; i < length; i++){
+            uint16_t v = window[i];
+            int j = i;
+            for(; j > 0 && window[j - 1] > v; j--)
+                window[j] = window[j - 1];
+            window[j] = v;
+        }
+        if(length & 1)
+            *count = (uint32_t) window[length / 2] << FILTER_FRAC_BITS;
+        else
+            *count = ((uint32_t) window[length / 2 - 1] + window[length / 2]) << (FILTER_FRAC_BITS - 1);
+        break;
+    case FILTER_IIR:
+        *count = value >> (16 - FILTER_FRAC_BITS);
+        break;
+    case FILTER_CIC: {
+        uint64_t gain = (uint64_t) length * length * length;
+        *count = (uint32_t) (((uint64_t) value << FILTER_FRAC_BITS) / gain);
+        break;
+    }
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricFilter.h
+ * @brief Per-channel digital filters between the acquisition and the
+ * temperature conversion.  The acquisition interrupt feeds every sample in;
+ * readers get the filtered count in fixed point with FILTER_FRAC_BITS
+ * fraction bits, ready for the thermistor lookup.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_FILTER_H
+#define THERMOELECTRIC_FILTER_H
+
+#include "ThermoElectricGlobal.h"
+
+#define FILTER_FRAC_BITS       4     // Fraction bits of the filtered count
+#define FILTER_MAX_LENGTH      64    // Longest boxcar, and largest CIC decimation
+#define FILTER_MAX_MEDIAN      15    // Longest median, sorted by the reader
+#define FILTER_MAX_IIR         4096  // Longest IIR time constant, in samples
+#define FILTER_CIC_ORDER       3
+
+#define FILTER_DEFAULT_TYPE    FILTER_BOXCAR
+#define FILTER_DEFAULT_LENGTH  16
+
+// Filter types.  The values are used in the NCMD metrics, so don't renumber.
+enum FilterType {
+    FILTER_BOXCAR = 0,  // Mean of the newest length samples
+    FILTER_MEDIAN,      // Median of the newest length samples
+    FILTER_IIR,         // Single pole low pass with a time constant of length samples
+    FILTER_CIC,         // 3rd order CIC, decimating by length
+    NUM_FILTER_TYPES
+};
+
+// Set every channel to the default filter.
+void filter_init(void);
+
+// Change the filter of a channel.  Its history is cleared, so no output is
+// available until the new filter has filled.  Returns false if the type or
+// length is invalid.
+bool filter_configure(int channel, int type, int length);
+
+int filter_get_type(int channel);
+int filter_get_length(int channel);
+
+// Feed one new sample of a channel.  Called from the acquisition interrupt.
+void filter_sample(int channel, uint16_t sample);
+
+// Latest filtered count of a channel, with FILTER_FRAC_BITS fraction bits.
+// Returns false if the filter hasn't filled since it was configured.
+bool filter_read(int channel, uint32_t *count);
+
+#endif
@@ -37,7 +37,7 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 
 // Overall version of the MQTT messages.  Increment this for any change to
 // the messages: added, deleted, renamed, different type, different function.
-#define COMMS_VERSION  2
+#define COMMS_VERSION  16
 
 // Enable this to display diagnostic messages on the serial port
 #define DEBUG
@@ -55,14 +55,9 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #define NUM_MODULES   6
 #define MAX_BOARD_ID  (NUM_MODULES - 1)
 
-// Display diagnostic messages on serial port if debugging is enabled
-#ifdef DEBUG
-#define DebugPrint( msg )       Serial.println( msg )
-#define DebugPrintNoEOL( msg )  Serial.print( msg )
-#else
-#define DebugPrint( msg )
-#define DebugPrintNoEOL( msg )
-#endif
+// Diagnostic messages go through the deferred log, which includes debug
+// messages only if debugging is enabled
+#include "ThermoElectricLog.h"
 
 #define TEENSY_VERSION ", Teensy 4.1"
 
@@ -0,0 +1,59 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricLatency.cpp
+ * @brief Implements the latency percentile statistics.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricLatency.h"
+
+// Add a sample, replacing the oldest once the window is full.
+void latency_record(LatencyStats *stats, uint32_t sample){
+    stats->samples[stats->count % LATENCY_WINDOW] = sample;
+    stats->count++;
+}
+
+// Nearest-rank percentile of sorted samples
+static uint32_t percentile(const uint32_t *sorted, uint32_t num, uint32_t pct){
+    uint32_t rank = (pct * num + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+// The median, 99th percentile and maximum of the samples in the window.
+bool latency_percentiles(const LatencyStats *stats, uint32_t *p50, uint32_t *p99, uint32_t *max){
+    uint32_t num = min(stats->count, (uint32_t) LATENCY_WINDOW);
+    if(num == 0)
+        return false;
+
+    // Insertion sort a copy; this only runs when the metrics are published
+    uint32_t sorted[LATENCY_WINDOW];
+    for(uint32_t i = 0; i < num; i++){
+        uint32_t v = stats->samples[i];
+        uint32_t j = i;
+        for(; j > 0 && sorted[j - 1] > v; j--)
+            sorted[j] = sorted[j - 1];
+        sorted[j] = v;
+    }
+    *p50 = percentile(sorted, num, 50);
+    *p99 = percentile(sorted, num, 99);
+    *max = sorted[num - 1];
+    return true;
+}
@@ -0,0 +1,46 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricLatency.h
+ * @brief Percentile statistics over a window of the most recent timing
+ * samples, used to report how quickly commands take effect.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_LATENCY_H
+#define THERMOELECTRIC_LATENCY_H
+
+#include "ThermoElectricGlobal.h"
+
+#define LATENCY_WINDOW  128  // Samples the percentiles are taken over
+
+typedef struct {
+    uint32_t count;  // Samples recorded in total
+    uint32_t samples[LATENCY_WINDOW];
+} LatencyStats;
+
+// Add a sample, replacing the oldest once the window is full.
+void latency_record(LatencyStats *stats, uint32_t sample);
+
+// The median, 99th percentile and maximum of the samples in the window.
+// Returns false if there are no samples.
+bool latency_percentiles(const LatencyStats *stats, uint32_t *p50, uint32_t *p99, uint32_t *max);
+
+#endif
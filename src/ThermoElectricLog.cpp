@@ -0,0 +1,131 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricLog.cpp
+ * @brief Implements the deferred log.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricGlobal.h"
+#include <stdarg.h>
+
+/*
+  Private variables
+*/
+static const char m_levelNames[NUM_LOG_LEVELS] = {'E', 'W', 'I', 'D'};
+
+#ifdef DEBUG
+static int m_level = LOG_LEVEL_DEBUG;
+#else
+static int m_level = LOG_LEVEL_INFO;
+#endif
+
+// Messages are stored one after another, each ending with a newline.  The
+// indices run freely and are reduced modulo the buffer size when used.
+static char              m_buffer[LOG_BUFFER_SIZE];
+static volatile uint32_t m_head = 0;        // Where the next message goes
+static volatile uint32_t m_tail = 0;        // Start of the oldest message
+static volatile uint32_t m_dropped = 0;     // Messages lost to a full buffer
+static uint32_t          m_reportedDropped = 0;
+static LogSink           m_sink = NULL;
+
+void log_set_level(int level){
+    if(level >= 0 && level < NUM_LOG_LEVELS)
+        m_level = level;
+}
+
+int log_get_level(void){
+    return m_level;
+}
+
+// Format a message into the log buffer.
+void log_message(int level, const char *format, ...){
+    if(level < 0 || level > m_level)
+        return;
+
+    // Format outside the critical section, prefixed with the time and level
+    char line[LOG_LINE_LEN];
+    int len = snprintf(line, sizeof(line), "%lu %c ", (unsigned long) millis(), m_levelNames[level]);
+    va_list args;
+    va_start(args, format);
+    len += vsnprintf(line + len, sizeof(line) - len, format, args);
+    va_end(args);
+    // Truncate long messages, leaving room for the newline
+    if(len > (int) sizeof(line) - 1)
+        len = sizeof(line) - 1;
+    line[len++] = '\n';
+
+    noInterrupts();
+    uint32_t head = m_head;
+    if(LOG_BUFFER_SIZE - (head - m_tail) < (uint32_t) len){
+        m_dropped++;
+    }
+    else{
+        for(int i = 0; i < len; i++)
+            m_buffer[(head + i) % LOG_BUFFER_SIZE] = line[i];
+        m_head = head + len;
+    }
+    interrupts();
+}
+
+// Write some of the buffered messages to the serial port and the sink.
+void log_drain(void){
+    uint32_t dropped = m_dropped;
+    if(dropped != m_reportedDropped){
+        m_reportedDropped = dropped;
+        LOG_WARN("Log buffer full, %lu messages dropped", (unsigned long) dropped);
+    }
+
+    for(int n = 0; n < LOG_DRAIN_LINES; n++){
+        // Only this function moves the tail, so the message can't change
+        // while it's copied out
+        uint32_t tail = m_tail;
+        uint32_t head = m_head;
+        if(tail == head)
+            return;
+        char line[LOG_LINE_LEN + 1];
+        int len = 0;
+        while(tail + len != head && len < LOG_LINE_LEN){
+            char c = m_buffer[(tail + len) % LOG_BUFFER_SIZE];
+            line[len++] = c;
+            if(c == '\n')
+                break;
+        }
+
+        // Leave the message for later rather than wait for the serial port.
+        // Nothing is written if the USB serial port isn't open.
+        if(Serial){
+            if(Serial.availableForWrite() < len)
+                return;
+            Serial.write((const uint8_t *) line, len);
+        }
+        m_tail = tail + len;
+
+        if(m_sink != NULL){
+            line[len - 1] = '\0';
+            m_sink(line);
+        }
+    }
+}
+
+// Also send each message to this sink, or to no sink if NULL.
+void log_set_sink(LogSink sink){
+    m_sink = sink;
+}
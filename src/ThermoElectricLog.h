@@ -0,0 +1,79 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricLog.h
+ * @brief Leveled, deferred logging.  Messages are formatted into a RAM ring
+ * buffer when they're logged, and written to the serial port and an optional
+ * sink (such as an MQTT topic) later by log_drain(), so logging doesn't hold
+ * up the measurement and command paths.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_LOG_H
+#define THERMOELECTRIC_LOG_H
+
+// Included by ThermoElectricGlobal.h, after DEBUG is defined; include that
+// rather than this file.
+#include <Arduino.h>
+
+#define LOG_BUFFER_SIZE  4096  // Bytes of messages waiting to be written
+#define LOG_LINE_LEN     160   // Longest message, including the timestamp and level
+#define LOG_DRAIN_LINES  4     // Most messages written by each log_drain()
+
+// Log levels, most severe first.  The values are used in the NCMD metrics, so
+// don't renumber.
+enum LogLevel {
+    LOG_LEVEL_ERROR = 0,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_DEBUG,
+    NUM_LOG_LEVELS
+};
+
+// Receives each message, without its newline, as it's drained
+typedef void (*LogSink)(const char *line);
+
+// Only log messages at this level or more severe.
+void log_set_level(int level);
+int  log_get_level(void);
+
+// Format a message into the log buffer.  The message is dropped if the buffer
+// is full.  Safe to call from interrupts.
+void log_message(int level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+// Write some of the buffered messages to the serial port and the sink.  This
+// never waits for the serial port; call it whenever the main loop is idle.
+void log_drain(void);
+
+// Also send each message to this sink, or to no sink if NULL.
+void log_set_sink(LogSink sink);
+
+#define LOG_ERROR( ... )  log_message( LOG_LEVEL_ERROR, __VA_ARGS__ )
+#define LOG_WARN( ... )   log_message( LOG_LEVEL_WARN,  __VA_ARGS__ )
+#define LOG_INFO( ... )   log_message( LOG_LEVEL_INFO,  __VA_ARGS__ )
+
+// Debug messages are only compiled in if debugging is enabled
+#ifdef DEBUG
+#define LOG_DEBUG( ... )  log_message( LOG_LEVEL_DEBUG, __VA_ARGS__ )
+#else
+#define LOG_DEBUG( ... )  do {} while(0)
+#endif
+
+#endif
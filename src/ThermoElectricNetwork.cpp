@@ -29,6 +29,12 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #include "ThermoElectricNetwork.h"
 #include "ThermoElectricGlobal.h"
 #include "ThermoElectricController.h"
+#include "ThermoElectricFilter.h"
+#include "ThermoElectricLatency.h"
+#include "ThermoElectricProfiler.h"
+#include "ThermoElectricPid.h"
+#include "ThermoElectricPwm.h"
+#include "ThermoElectricScheduler.h"
 #include "cf_sparkplug.h"
 #include <NativeEthernet.h>
 #include <PubSubClient.h>
@@ -49,6 +55,23 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 #define SUBNET 255, 255, 0, 0
 #define DNS 128, 96, 11, 233
 #define NUM_BROKERS  1
+#define BROKER_RETRY_MS  5000  // Time between attempts to connect to a broker
+
+// Report-by-exception for the channel metrics: each is published when it moves
+// by more than its deadband, and at least this often regardless
+#define REPORT_MAX_SILENCE_MS  60000
+#define POWER_DEADBAND         0.1f    // Percent
+#define TEMPERATURE_DEADBAND   0.01f   // Degrees C
+#define SEEBECK_DEADBAND       5e-3f   // Millivolts, about three ADC counts
+
+// Batched data: each channel's data samples are kept with their timestamps and
+// sent together in one NDATA, when a batch fills or its oldest sample has
+// waited the flush interval
+#define BATCH_MAX_SAMPLES          64      // Per channel
+#define BATCH_DEFAULT_INTERVAL_MS  6000
+#define BATCH_MIN_INTERVAL_MS      100
+#define BATCH_MAX_INTERVAL_MS      3600000
+#define BATCH_RETRY_MS             1000    // Least time between early flushes that failed
 
 #if defined(production_TEST)
 
@@ -101,6 +124,8 @@ static String nodeBirthTopic = NODE_TOPIC(NBIRTH_MESSAGE_TYPE, NODE_I_dataLATE);
 static String nodeDeathTopic = NODE_TOPIC(NDEATH_MESSAGE_TYPE, NODE_I_dataLATE);
 static String nodeDataTopic  = NODE_TOPIC(NDATA_MESSAGE_TYPE,  NODE_I_dataLATE);
 static String nodeCmdTopic   = NODE_TOPIC(NCMD_MESSAGE_TYPE,   NODE_I_dataLATE);
+// Plain text log messages, outside the Sparkplug namespace
+static String nodeLogTopic   = GROUP_ID "/" NODE_I_dataLATE "/Log";
 
 // These variables hold the last published value of each metric
 static uint64_t m_bdSeq[NUM_BROKERS]  = {0};  // Node birth/death sequence numbers
@@ -110,14 +135,81 @@ static bool     m_nodeClearCal        = false;
 static bool     m_nodeCalibrated      = false;
 static bool     m_nodeCalibrationINW  = false;
 static bool     m_selectData          = false;
+static uint64_t m_logLevel            = 0;
+static bool     m_logToMqtt           = false;
+static bool     m_pwmDither           = false;
+static uint64_t m_pwmStagger          = 0;
+static float    m_powerBudget         = 0.0;  // Sum of the duties, percent
+static uint64_t m_batchSize           = 0;    // Samples per channel, 0 for no batching
+static uint64_t m_batchInterval       = BATCH_DEFAULT_INTERVAL_MS;
 static uint64_t m_commsVersion        = COMMS_VERSION;
 static const char *m_firmwareVersion  = TEC_VERSION_COMPLETE;
+static const char *m_bootTime         = "";
 static float    m_calTemp1            = {0.0};
 static float    m_calTemp2            = {0.0};
 static const char *m_units            = "/" ;// The user units
 static float m_Channel_pwr[NUMBER_OF_CHANNELS] = {0.00};
 static bool m_Channel_dir[NUMBER_OF_CHANNELS] = {false};
 static float m_Channel_data[NUMBER_OF_CHANNELS] = {0.00};
+static uint64_t m_Channel_filterType[NUMBER_OF_CHANNELS] = {0};
+static uint64_t m_Channel_filterLength[NUMBER_OF_CHANNELS] = {0};
+static float m_Channel_setpoint[NUMBER_OF_CHANNELS] = {0.00};  // Degrees C
+static uint64_t m_Channel_mode[NUMBER_OF_CHANNELS] = {0};      // PidMode
+static float m_Channel_kp[NUMBER_OF_CHANNELS] = {0.00};
+static float m_Channel_ki[NUMBER_OF_CHANNELS] = {0.00};
+static float m_Channel_kd[NUMBER_OF_CHANNELS] = {0.00};
+static bool m_Channel_autotune[NUMBER_OF_CHANNELS] = {false};  // Experiment running
+static float m_Channel_slew[NUMBER_OF_CHANNELS] = {0.00};      // Percent per second
+static uint64_t m_Channel_dwell[NUMBER_OF_CHANNELS] = {0};     // Milliseconds
+static float m_Channel_priority[NUMBER_OF_CHANNELS] = {0.00};  // Share of the power budget
+static float m_batchValues[NUMBER_OF_CHANNELS][BATCH_MAX_SAMPLES];  // Oldest first
+static unsigned long long m_batchTimes[NUMBER_OF_CHANNELS][BATCH_MAX_SAMPLES];
+static int m_batchCount[NUMBER_OF_CHANNELS] = {0};
+static char m_autotuneText[NUMBER_OF_CHANNELS][64];
+static const char *m_Channel_autotuneStatus[NUMBER_OF_CHANNELS] = {
+    m_autotuneText[0], m_autotuneText[1], m_autotuneText[2],  m_autotuneText[3],
+    m_autotuneText[4], m_autotuneText[5], m_autotuneText[6],  m_autotuneText[7],
+    m_autotuneText[8], m_autotuneText[9], m_autotuneText[10], m_autotuneText[11],
+};
+static uint64_t m_cmdDecodeP50       = 0;  // Command timing, in microseconds
+static uint64_t m_cmdDecodeP99       = 0;
+static uint64_t m_cmdDecodeMax       = 0;
+static uint64_t m_cmdLatencyP50      = 0;
+static uint64_t m_cmdLatencyP99      = 0;
+static uint64_t m_cmdLatencyMax      = 0;
+static uint64_t m_cmdAgeP50          = 0;  // Command age, in milliseconds
+static uint64_t m_cmdAgeP99          = 0;
+static uint64_t m_cmdAgeMax          = 0;
+static float    m_powerHeadroom      = 0.0;  // Least since the last publish, percent
+static bool     m_profileReport       = false;
+static char     m_profileText[NUM_PROFILE_PROBES][PROFILE_REPORT_LEN];
+static const char *m_profile[NUM_PROFILE_PROBES] = {  // Indexed by ProfileProbe
+    m_profileText[PROBE_GET_TEMPERATURE],
+    m_profileText[PROBE_GET_SEEBECK],
+    m_profileText[PROBE_PUBLISH_DATA],
+    m_profileText[PROBE_PUBLISH_NODE_DATA],
+    m_profileText[PROBE_ENCODE],
+    m_profileText[PROBE_CHECK_BROKERS],
+};
+static char     m_schedulerText[SCHEDULER_REPORT_LEN];
+static const char *m_scheduler       = m_schedulerText;
+
+// Timing of power commands over the most recent LATENCY_WINDOW commands:
+// decoding the NCMD payload, from receiving it to setting the TEC, and from
+// the payload's timestamp to setting the TEC.  Age needs NTP time.
+static LatencyStats m_cmdDecodeStats;
+static LatencyStats m_cmdLatencyStats;
+static LatencyStats m_cmdAgeStats;
+
+// A power command waiting for the control interrupt to act on it
+typedef struct {
+    bool     pending;
+    uint32_t receive_us;
+    unsigned long long timestamp;   // The host's, 0 if unknown
+} PendingCommand;
+
+static PendingCommand m_cmdPending[NUMBER_OF_CHANNELS];
+static uint32_t     m_cmdStatsPublished = 0;
 
 // Alias numbers for each of the node metrics
 enum NodeMetricAlias {
@@ -132,7 +224,15 @@ enum NodeMetricAlias {
     NMA_SelectData,
     NMA_CommsVersion,
     NMA_FirmwareVersion,
+    NMA_BootTime,
     NMA_Units,
+    NMA_LogLevel,
+    NMA_LogToMqtt,
+    NMA_PwmDither,
+    NMA_PwmStagger,
+    NMA_PowerBudget,
+    NMA_BatchSize,
+    NMA_BatchInterval,
     NMA_Channel1_pwr,
     NMA_Channel2_pwr,
     NMA_Channel3_pwr,
@@ -169,6 +269,168 @@ enum NodeMetricAlias {
     NMA_Channel10_data,
     NMA_Channel11_data,
     NMA_Channel12_data,
+    NMA_Channel1_filterType,
+    NMA_Channel2_filterType,
+    NMA_Channel3_filterType,
+    NMA_Channel4_filterType,
+    NMA_Channel5_filterType,
+    NMA_Channel6_filterType,
+    NMA_Channel7_filterType,
+    NMA_Channel8_filterType,
+    NMA_Channel9_filterType,
+    NMA_Channel10_filterType,
+    NMA_Channel11_filterType,
+    NMA_Channel12_filterType,
+    NMA_Channel1_filterLength,
+    NMA_Channel2_filterLength,
+    NMA_Channel3_filterLength,
+    NMA_Channel4_filterLength,
+    NMA_Channel5_filterLength,
+    NMA_Channel6_filterLength,
+    NMA_Channel7_filterLength,
+    NMA_Channel8_filterLength,
+    NMA_Channel9_filterLength,
+    NMA_Channel10_filterLength,
+    NMA_Channel11_filterLength,
+    NMA_Channel12_filterLength,
+    NMA_Channel1_setpoint,
+    NMA_Channel2_setpoint,
+    NMA_Channel3_setpoint,
+    NMA_Channel4_setpoint,
+    NMA_Channel5_setpoint,
+    NMA_Channel6_setpoint,
+    NMA_Channel7_setpoint,
+    NMA_Channel8_setpoint,
+    NMA_Channel9_setpoint,
+    NMA_Channel10_setpoint,
+    NMA_Channel11_setpoint,
+    NMA_Channel12_setpoint,
+    NMA_Channel1_mode,
+    NMA_Channel2_mode,
+    NMA_Channel3_mode,
+    NMA_Channel4_mode,
+    NMA_Channel5_mode,
+    NMA_Channel6_mode,
+    NMA_Channel7_mode,
+    NMA_Channel8_mode,
+    NMA_Channel9_mode,
+    NMA_Channel10_mode,
+    NMA_Channel11_mode,
+    NMA_Channel12_mode,
+    NMA_Channel1_kp,
+    NMA_Channel2_kp,
+    NMA_Channel3_kp,
+    NMA_Channel4_kp,
+    NMA_Channel5_kp,
+    NMA_Channel6_kp,
+    NMA_Channel7_kp,
+    NMA_Channel8_kp,
+    NMA_Channel9_kp,
+    NMA_Channel10_kp,
+    NMA_Channel11_kp,
+    NMA_Channel12_kp,
+    NMA_Channel1_ki,
+    NMA_Channel2_ki,
+    NMA_Channel3_ki,
+    NMA_Channel4_ki,
+    NMA_Channel5_ki,
+    NMA_Channel6_ki,
+    NMA_Channel7_ki,
+    NMA_Channel8_ki,
+    NMA_Channel9_ki,
+    NMA_Channel10_ki,
+    NMA_Channel11_ki,
+    NMA_Channel12_ki,
+    NMA_Channel1_kd,
+    NMA_Channel2_kd,
+    NMA_Channel3_kd,
+    NMA_Channel4_kd,
+    NMA_Channel5_kd,
+    NMA_Channel6_kd,
+    NMA_Channel7_kd,
+    NMA_Channel8_kd,
+    NMA_Channel9_kd,
+    NMA_Channel10_kd,
+    NMA_Channel11_kd,
+    NMA_Channel12_kd,
+    NMA_Channel1_autotune,
+    NMA_Channel2_autotune,
+    NMA_Channel3_autotune,
+    NMA_Channel4_autotune,
+    NMA_Channel5_autotune,
+    NMA_Channel6_autotune,
+    NMA_Channel7_autotune,
+    NMA_Channel8_autotune,
+    NMA_Channel9_autotune,
+    NMA_Channel10_autotune,
+    NMA_Channel11_autotune,
+    NMA_Channel12_autotune,
+    NMA_Channel1_autotuneStatus,
+    NMA_Channel2_autotuneStatus,
+    NMA_Channel3_autotuneStatus,
+    NMA_Channel4_autotuneStatus,
+    NMA_Channel5_autotuneStatus,
+    NMA_Channel6_autotuneStatus,
+    NMA_Channel7_autotuneStatus,
+    NMA_Channel8_autotuneStatus,
+    NMA_Channel9_autotuneStatus,
+    NMA_Channel10_autotuneStatus,
+    NMA_Channel11_autotuneStatus,
+    NMA_Channel12_autotuneStatus,
+    NMA_Channel1_slew,
+    NMA_Channel2_slew,
+    NMA_Channel3_slew,
+    NMA_Channel4_slew,
+    NMA_Channel5_slew,
+    NMA_Channel6_slew,
+    NMA_Channel7_slew,
+    NMA_Channel8_slew,
+    NMA_Channel9_slew,
+    NMA_Channel10_slew,
+    NMA_Channel11_slew,
+    NMA_Channel12_slew,
+    NMA_Channel1_dwell,
+    NMA_Channel2_dwell,
+    NMA_Channel3_dwell,
+    NMA_Channel4_dwell,
+    NMA_Channel5_dwell,
+    NMA_Channel6_dwell,
+    NMA_Channel7_dwell,
+    NMA_Channel8_dwell,
+    NMA_Channel9_dwell,
+    NMA_Channel10_dwell,
+    NMA_Channel11_dwell,
+    NMA_Channel12_dwell,
+    NMA_Channel1_priority,
+    NMA_Channel2_priority,
+    NMA_Channel3_priority,
+    NMA_Channel4_priority,
+    NMA_Channel5_priority,
+    NMA_Channel6_priority,
+    NMA_Channel7_priority,
+    NMA_Channel8_priority,
+    NMA_Channel9_priority,
+    NMA_Channel10_priority,
+    NMA_Channel11_priority,
+    NMA_Channel12_priority,
+    NMA_CommandDecodeP50,
+    NMA_CommandDecodeP99,
+    NMA_CommandDecodeMax,
+    NMA_CommandLatencyP50,
+    NMA_CommandLatencyP99,
+    NMA_CommandLatencyMax,
+    NMA_CommandAgeP50,
+    NMA_CommandAgeP99,
+    NMA_CommandAgeMax,
+    NMA_PowerHeadroom,
+    NMA_ProfileReport,
+    NMA_ProfileGetTemperature,
+    NMA_ProfileGetSeebeck,
+    NMA_ProfilePublishData,
+    NMA_ProfilePublishNodeData,
+    NMA_ProfileEncode,
+    NMA_ProfileCheckBrokers,
+    NMA_SchedulerReport,
     EndNodeMetricAlias
 };
 
@@ -185,14 +447,23 @@ static MetricSpec NodeMetrics[] = {
     {"Properties/Communications Version",         NMA_CommsVersion,           false, METRIC_DATA_TYPE_INT64,     &m_commsVersion,           false, 0},
     {"Properties/Firmware Version",               NMA_FirmwareVersion,        false, METRIC_DATA_TYPE_STRING,    &m_firmwareVersion,        false, 0},
     {"Properties/Units",                          NMA_Units,                  false, METRIC_DATA_TYPE_STRING,    &m_units,                  false, 0},
+    {"Properties/Boot Time",                      NMA_BootTime,               false, METRIC_DATA_TYPE_STRING,    &m_bootTime,               false, 0},
     {"Properties/Calibration INW",                NMA_CalibrationINW,         true, METRIC_DATA_TYPE_BOOLEAN,    &m_nodeCalibrationINW,     false, 0},
     {"Properties/Data Selection",                 NMA_SelectData,             true, METRIC_DATA_TYPE_BOOLEAN,    &m_selectData,             false, 0},
     {"Properties/Calibration Status",             NMA_CalibrationStatus,      true, METRIC_DATA_TYPE_BOOLEAN,    &m_nodeCalibrated,         false, 0},
+    {"Properties/Log Level",                      NMA_LogLevel,               true, METRIC_DATA_TYPE_INT64,      &m_logLevel,               false, 0},
+    {"Properties/Log To MQTT",                    NMA_LogToMqtt,              true, METRIC_DATA_TYPE_BOOLEAN,    &m_logToMqtt,              false, 0},
+    {"Properties/PWM Dither",                     NMA_PwmDither,              true, METRIC_DATA_TYPE_BOOLEAN,    &m_pwmDither,              false, 0},
+    {"Properties/PWM Stagger",                    NMA_PwmStagger,             true, METRIC_DATA_TYPE_INT64,      &m_pwmStagger,             false, 0},
+    {"Properties/Power Budget",                   NMA_PowerBudget,            true, METRIC_DATA_TYPE_FLOAT,      &m_powerBudget,            false, 0},
+    {"Properties/Batch Size",                     NMA_BatchSize,              true, METRIC_DATA_TYPE_INT64,      &m_batchSize,              false, 0},
+    {"Properties/Batch Interval",                 NMA_BatchInterval,          true, METRIC_DATA_TYPE_INT64,      &m_batchInterval,          false, 0},
     {"Node Control/Reboot",                       NMA_Reboot,                 true, METRIC_DATA_TYPE_BOOLEAN,    &m_nodeReboot,             false, 0},
     {"Node Control/Rebirth",                      NMA_Rebirth,                true, METRIC_DATA_TYPE_BOOLEAN,    &m_nodeRebirth,            false, 0},
     {"Node Control/Clear Cal Data",               NMA_ClearCal,               true, METRIC_DATA_TYPE_BOOLEAN,    &m_nodeClearCal,           false, 0},
     {"Node Control/Calibration Temperature 1",    NMA_CalibrationTemp1,       true, METRIC_DATA_TYPE_FLOAT,      &m_calTemp1,               false, 0},        
     {"Node Control/Calibration Temperature 2",    NMA_CalibrationTemp2,       true, METRIC_DATA_TYPE_FLOAT,      &m_calTemp2,               false, 0},    
+    {"Node Control/Profile Report",               NMA_ProfileReport,          true, METRIC_DATA_TYPE_BOOLEAN,    &m_profileReport,          false, 0},
     {"Inputs/Power Channel1",                     NMA_Channel1_pwr,           true, METRIC_DATA_TYPE_FLOAT,      &m_Channel_pwr[0],         false, 0},
     {"Inputs/Power Channel2",                     NMA_Channel2_pwr,           true, METRIC_DATA_TYPE_FLOAT,      &m_Channel_pwr[1],         false, 0},
     {"Inputs/Power Channel3",                     NMA_Channel3_pwr,           true, METRIC_DATA_TYPE_FLOAT,      &m_Channel_pwr[2],         false, 0},
@@ -229,8 +500,233 @@ static MetricSpec NodeMetrics[] = {
     {"Outputs/Data Channel10",                    NMA_Channel10_data,         false, METRIC_DATA_TYPE_FLOAT,     &m_Channel_data[9],        false, 0},
     {"Outputs/Data Channel11",                    NMA_Channel11_data,         false, METRIC_DATA_TYPE_FLOAT,     &m_Channel_data[10],       false, 0},    
     {"Outputs/Data Channel12",                    NMA_Channel12_data,         false, METRIC_DATA_TYPE_FLOAT,     &m_Channel_data[11],       false, 0},
+    {"Inputs/Filter Type Channel1",                NMA_Channel1_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[0],  false, 0},
+    {"Inputs/Filter Type Channel2",                NMA_Channel2_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[1],  false, 0},
+    {"Inputs/Filter Type Channel3",                NMA_Channel3_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[2],  false, 0},
+    {"Inputs/Filter Type Channel4",                NMA_Channel4_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[3],  false, 0},
+    {"Inputs/Filter Type Channel5",                NMA_Channel5_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[4],  false, 0},
+    {"Inputs/Filter Type Channel6",                NMA_Channel6_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[5],  false, 0},
+    {"Inputs/Filter Type Channel7",                NMA_Channel7_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[6],  false, 0},
+    {"Inputs/Filter Type Channel8",                NMA_Channel8_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[7],  false, 0},
+    {"Inputs/Filter Type Channel9",                NMA_Channel9_filterType,    true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[8],  false, 0},
+    {"Inputs/Filter Type Channel10",               NMA_Channel10_filterType,   true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[9],  false, 0},
+    {"Inputs/Filter Type Channel11",               NMA_Channel11_filterType,   true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[10], false, 0},
+    {"Inputs/Filter Type Channel12",               NMA_Channel12_filterType,   true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterType[11], false, 0},
+    {"Inputs/Filter Length Channel1",              NMA_Channel1_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[0],false, 0},
+    {"Inputs/Filter Length Channel2",              NMA_Channel2_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[1],false, 0},
+    {"Inputs/Filter Length Channel3",              NMA_Channel3_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[2],false, 0},
+    {"Inputs/Filter Length Channel4",              NMA_Channel4_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[3],false, 0},
+    {"Inputs/Filter Length Channel5",              NMA_Channel5_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[4],false, 0},
+    {"Inputs/Filter Length Channel6",              NMA_Channel6_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[5],false, 0},
+    {"Inputs/Filter Length Channel7",              NMA_Channel7_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[6],false, 0},
+    {"Inputs/Filter Length Channel8",              NMA_Channel8_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[7],false, 0},
+    {"Inputs/Filter Length Channel9",              NMA_Channel9_filterLength,  true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[8],false, 0},
+    {"Inputs/Filter Length Channel10",             NMA_Channel10_filterLength, true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[9],false, 0},
+    {"Inputs/Filter Length Channel11",             NMA_Channel11_filterLength, true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[10], false, 0},
+    {"Inputs/Filter Length Channel12",             NMA_Channel12_filterLength, true, METRIC_DATA_TYPE_INT64,     &m_Channel_filterLength[11], false, 0},
+    {"Inputs/Setpoint Channel1",                   NMA_Channel1_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[0],   false, 0},
+    {"Inputs/Setpoint Channel2",                   NMA_Channel2_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[1],   false, 0},
+    {"Inputs/Setpoint Channel3",                   NMA_Channel3_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[2],   false, 0},
+    {"Inputs/Setpoint Channel4",                   NMA_Channel4_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[3],   false, 0},
+    {"Inputs/Setpoint Channel5",                   NMA_Channel5_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[4],   false, 0},
+    {"Inputs/Setpoint Channel6",                   NMA_Channel6_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[5],   false, 0},
+    {"Inputs/Setpoint Channel7",                   NMA_Channel7_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[6],   false, 0},
+    {"Inputs/Setpoint Channel8",                   NMA_Channel8_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[7],   false, 0},
+    {"Inputs/Setpoint Channel9",                   NMA_Channel9_setpoint,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[8],   false, 0},
+    {"Inputs/Setpoint Channel10",                  NMA_Channel10_setpoint,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[9],   false, 0},
+    {"Inputs/Setpoint Channel11",                  NMA_Channel11_setpoint,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[10],  false, 0},
+    {"Inputs/Setpoint Channel12",                  NMA_Channel12_setpoint,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_setpoint[11],  false, 0},
+    {"Inputs/Control Mode Channel1",               NMA_Channel1_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[0],       false, 0},
+    {"Inputs/Control Mode Channel2",               NMA_Channel2_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[1],       false, 0},
+    {"Inputs/Control Mode Channel3",               NMA_Channel3_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[2],       false, 0},
+    {"Inputs/Control Mode Channel4",               NMA_Channel4_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[3],       false, 0},
+    {"Inputs/Control Mode Channel5",               NMA_Channel5_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[4],       false, 0},
+    {"Inputs/Control Mode Channel6",               NMA_Channel6_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[5],       false, 0},
+    {"Inputs/Control Mode Channel7",               NMA_Channel7_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[6],       false, 0},
+    {"Inputs/Control Mode Channel8",               NMA_Channel8_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[7],       false, 0},
+    {"Inputs/Control Mode Channel9",               NMA_Channel9_mode,          true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[8],       false, 0},
+    {"Inputs/Control Mode Channel10",              NMA_Channel10_mode,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[9],       false, 0},
+    {"Inputs/Control Mode Channel11",              NMA_Channel11_mode,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[10],      false, 0},
+    {"Inputs/Control Mode Channel12",              NMA_Channel12_mode,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_mode[11],      false, 0},
+    {"Inputs/Kp Channel1",                         NMA_Channel1_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[0],         false, 0},
+    {"Inputs/Kp Channel2",                         NMA_Channel2_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[1],         false, 0},
+    {"Inputs/Kp Channel3",                         NMA_Channel3_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[2],         false, 0},
+    {"Inputs/Kp Channel4",                         NMA_Channel4_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[3],         false, 0},
+    {"Inputs/Kp Channel5",                         NMA_Channel5_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[4],         false, 0},
+    {"Inputs/Kp Channel6",                         NMA_Channel6_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[5],         false, 0},
+    {"Inputs/Kp Channel7",                         NMA_Channel7_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[6],         false, 0},
+    {"Inputs/Kp Channel8",                         NMA_Channel8_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[7],         false, 0},
+    {"Inputs/Kp Channel9",                         NMA_Channel9_kp,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[8],         false, 0},
+    {"Inputs/Kp Channel10",                        NMA_Channel10_kp,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[9],         false, 0},
+    {"Inputs/Kp Channel11",                        NMA_Channel11_kp,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[10],        false, 0},
+    {"Inputs/Kp Channel12",                        NMA_Channel12_kp,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kp[11],        false, 0},
+    {"Inputs/Ki Channel1",                         NMA_Channel1_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[0],         false, 0},
+    {"Inputs/Ki Channel2",                         NMA_Channel2_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[1],         false, 0},
+    {"Inputs/Ki Channel3",                         NMA_Channel3_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[2],         false, 0},
+    {"Inputs/Ki Channel4",                         NMA_Channel4_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[3],         false, 0},
+    {"Inputs/Ki Channel5",                         NMA_Channel5_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[4],         false, 0},
+    {"Inputs/Ki Channel6",                         NMA_Channel6_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[5],         false, 0},
+    {"Inputs/Ki Channel7",                         NMA_Channel7_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[6],         false, 0},
+    {"Inputs/Ki Channel8",                         NMA_Channel8_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[7],         false, 0},
+    {"Inputs/Ki Channel9",                         NMA_Channel9_ki,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[8],         false, 0},
+    {"Inputs/Ki Channel10",                        NMA_Channel10_ki,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[9],         false, 0},
+    {"Inputs/Ki Channel11",                        NMA_Channel11_ki,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[10],        false, 0},
+    {"Inputs/Ki Channel12",                        NMA_Channel12_ki,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_ki[11],        false, 0},
+    {"Inputs/Kd Channel1",                         NMA_Channel1_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[0],         false, 0},
+    {"Inputs/Kd Channel2",                         NMA_Channel2_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[1],         false, 0},
+    {"Inputs/Kd Channel3",                         NMA_Channel3_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[2],         false, 0},
+    {"Inputs/Kd Channel4",                         NMA_Channel4_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[3],         false, 0},
+    {"Inputs/Kd Channel5",                         NMA_Channel5_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[4],         false, 0},
+    {"Inputs/Kd Channel6",                         NMA_Channel6_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[5],         false, 0},
+    {"Inputs/Kd Channel7",                         NMA_Channel7_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[6],         false, 0},
+    {"Inputs/Kd Channel8",                         NMA_Channel8_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[7],         false, 0},
+    {"Inputs/Kd Channel9",                         NMA_Channel9_kd,            true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[8],         false, 0},
+    {"Inputs/Kd Channel10",                        NMA_Channel10_kd,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[9],         false, 0},
+    {"Inputs/Kd Channel11",                        NMA_Channel11_kd,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[10],        false, 0},
+    {"Inputs/Kd Channel12",                        NMA_Channel12_kd,           true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_kd[11],        false, 0},
+    {"Inputs/Autotune Channel1",                   NMA_Channel1_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[0],   false, 0},
+    {"Inputs/Autotune Channel2",                   NMA_Channel2_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[1],   false, 0},
+    {"Inputs/Autotune Channel3",                   NMA_Channel3_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[2],   false, 0},
+    {"Inputs/Autotune Channel4",                   NMA_Channel4_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[3],   false, 0},
+    {"Inputs/Autotune Channel5",                   NMA_Channel5_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[4],   false, 0},
+    {"Inputs/Autotune Channel6",                   NMA_Channel6_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[5],   false, 0},
+    {"Inputs/Autotune Channel7",                   NMA_Channel7_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[6],   false, 0},
+    {"Inputs/Autotune Channel8",                   NMA_Channel8_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[7],   false, 0},
+    {"Inputs/Autotune Channel9",                   NMA_Channel9_autotune,      true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[8],   false, 0},
+    {"Inputs/Autotune Channel10",                  NMA_Channel10_autotune,     true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[9],   false, 0},
+    {"Inputs/Autotune Channel11",                  NMA_Channel11_autotune,     true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[10],  false, 0},
+    {"Inputs/Autotune Channel12",                  NMA_Channel12_autotune,     true, METRIC_DATA_TYPE_BOOLEAN,   &m_Channel_autotune[11],  false, 0},
+    {"Outputs/Autotune Status Channel1",           NMA_Channel1_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[0], false, 0},
+    {"Outputs/Autotune Status Channel2",           NMA_Channel2_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[1], false, 0},
+    {"Outputs/Autotune Status Channel3",           NMA_Channel3_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[2], false, 0},
+    {"Outputs/Autotune Status Channel4",           NMA_Channel4_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[3], false, 0},
+    {"Outputs/Autotune Status Channel5",           NMA_Channel5_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[4], false, 0},
+    {"Outputs/Autotune Status Channel6",           NMA_Channel6_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[5], false, 0},
+    {"Outputs/Autotune Status Channel7",           NMA_Channel7_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[6], false, 0},
+    {"Outputs/Autotune Status Channel8",           NMA_Channel8_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[7], false, 0},
+    {"Outputs/Autotune Status Channel9",           NMA_Channel9_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[8], false, 0},
+    {"Outputs/Autotune Status Channel10",          NMA_Channel10_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[9], false, 0},
+    {"Outputs/Autotune Status Channel11",          NMA_Channel11_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[10], false, 0},
+    {"Outputs/Autotune Status Channel12",          NMA_Channel12_autotuneStatus, false, METRIC_DATA_TYPE_STRING,   &m_Channel_autotuneStatus[11], false, 0},
+    {"Inputs/Slew Rate Channel1",                  NMA_Channel1_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[0],       false, 0},
+    {"Inputs/Slew Rate Channel2",                  NMA_Channel2_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[1],       false, 0},
+    {"Inputs/Slew Rate Channel3",                  NMA_Channel3_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[2],       false, 0},
+    {"Inputs/Slew Rate Channel4",                  NMA_Channel4_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[3],       false, 0},
+    {"Inputs/Slew Rate Channel5",                  NMA_Channel5_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[4],       false, 0},
+    {"Inputs/Slew Rate Channel6",                  NMA_Channel6_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[5],       false, 0},
+    {"Inputs/Slew Rate Channel7",                  NMA_Channel7_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[6],       false, 0},
+    {"Inputs/Slew Rate Channel8",                  NMA_Channel8_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[7],       false, 0},
+    {"Inputs/Slew Rate Channel9",                  NMA_Channel9_slew,          true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[8],       false, 0},
+    {"Inputs/Slew Rate Channel10",                 NMA_Channel10_slew,         true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[9],       false, 0},
+    {"Inputs/Slew Rate Channel11",                 NMA_Channel11_slew,         true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[10],      false, 0},
+    {"Inputs/Slew Rate Channel12",                 NMA_Channel12_slew,         true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_slew[11],      false, 0},
+    {"Inputs/Reverse Dwell Channel1",              NMA_Channel1_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[0],      false, 0},
+    {"Inputs/Reverse Dwell Channel2",              NMA_Channel2_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[1],      false, 0},
+    {"Inputs/Reverse Dwell Channel3",              NMA_Channel3_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[2],      false, 0},
+    {"Inputs/Reverse Dwell Channel4",              NMA_Channel4_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[3],      false, 0},
+    {"Inputs/Reverse Dwell Channel5",              NMA_Channel5_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[4],      false, 0},
+    {"Inputs/Reverse Dwell Channel6",              NMA_Channel6_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[5],      false, 0},
+    {"Inputs/Reverse Dwell Channel7",              NMA_Channel7_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[6],      false, 0},
+    {"Inputs/Reverse Dwell Channel8",              NMA_Channel8_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[7],      false, 0},
+    {"Inputs/Reverse Dwell Channel9",              NMA_Channel9_dwell,         true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[8],      false, 0},
+    {"Inputs/Reverse Dwell Channel10",             NMA_Channel10_dwell,        true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[9],      false, 0},
+    {"Inputs/Reverse Dwell Channel11",             NMA_Channel11_dwell,        true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[10],     false, 0},
+    {"Inputs/Reverse Dwell Channel12",             NMA_Channel12_dwell,        true, METRIC_DATA_TYPE_INT64,     &m_Channel_dwell[11],     false, 0},
+    {"Inputs/Priority Channel1",                   NMA_Channel1_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[0],   false, 0},
+    {"Inputs/Priority Channel2",                   NMA_Channel2_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[1],   false, 0},
+    {"Inputs/Priority Channel3",                   NMA_Channel3_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[2],   false, 0},
+    {"Inputs/Priority Channel4",                   NMA_Channel4_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[3],   false, 0},
+    {"Inputs/Priority Channel5",                   NMA_Channel5_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[4],   false, 0},
+    {"Inputs/Priority Channel6",                   NMA_Channel6_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[5],   false, 0},
+    {"Inputs/Priority Channel7",                   NMA_Channel7_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[6],   false, 0},
+    {"Inputs/Priority Channel8",                   NMA_Channel8_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[7],   false, 0},
+    {"Inputs/Priority Channel9",                   NMA_Channel9_priority,      true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[8],   false, 0},
+    {"Inputs/Priority Channel10",                  NMA_Channel10_priority,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[9],   false, 0},
+    {"Inputs/Priority Channel11",                  NMA_Channel11_priority,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[10],  false, 0},
+    {"Inputs/Priority Channel12",                  NMA_Channel12_priority,     true, METRIC_DATA_TYPE_FLOAT,     &m_Channel_priority[11],  false, 0},
+    {"Diagnostics/Command Decode p50",             NMA_CommandDecodeP50,       false, METRIC_DATA_TYPE_INT64,    &m_cmdDecodeP50,           false, 0},
+    {"Diagnostics/Command Decode p99",             NMA_CommandDecodeP99,       false, METRIC_DATA_TYPE_INT64,    &m_cmdDecodeP99,           false, 0},
+    {"Diagnostics/Command Decode Max",             NMA_CommandDecodeMax,       false, METRIC_DATA_TYPE_INT64,    &m_cmdDecodeMax,           false, 0},
+    {"Diagnostics/Command Latency p50",            NMA_CommandLatencyP50,      false, METRIC_DATA_TYPE_INT64,    &m_cmdLatencyP50,          false, 0},
+    {"Diagnostics/Command Latency p99",            NMA_CommandLatencyP99,      false, METRIC_DATA_TYPE_INT64,    &m_cmdLatencyP99,          false, 0},
+    {"Diagnostics/Command Latency Max",            NMA_CommandLatencyMax,      false, METRIC_DATA_TYPE_INT64,    &m_cmdLatencyMax,          false, 0},
+    {"Diagnostics/Command Age p50",                NMA_CommandAgeP50,          false, METRIC_DATA_TYPE_INT64,    &m_cmdAgeP50,              false, 0},
+    {"Diagnostics/Command Age p99",                NMA_CommandAgeP99,          false, METRIC_DATA_TYPE_INT64,    &m_cmdAgeP99,              false, 0},
+    {"Diagnostics/Command Age Max",                NMA_CommandAgeMax,          false, METRIC_DATA_TYPE_INT64,    &m_cmdAgeMax,              false, 0},
+    {"Diagnostics/Power Headroom",                 NMA_PowerHeadroom,          false, METRIC_DATA_TYPE_FLOAT,    &m_powerHeadroom,          false, 0},
+    {"Diagnostics/Profile get_Temperature",        NMA_ProfileGetTemperature,  false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_GET_TEMPERATURE],   false, 0},
+    {"Diagnostics/Profile getSeebeck",             NMA_ProfileGetSeebeck,      false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_GET_SEEBECK],       false, 0},
+    {"Diagnostics/Profile publish_data",           NMA_ProfilePublishData,     false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_PUBLISH_DATA],      false, 0},
+    {"Diagnostics/Profile publish_node_data",      NMA_ProfilePublishNodeData, false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_PUBLISH_NODE_DATA], false, 0},
+    {"Diagnostics/Profile encode",                 NMA_ProfileEncode,          false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_ENCODE],            false, 0},
+    {"Diagnostics/Profile check_brokers",          NMA_ProfileCheckBrokers,    false, METRIC_DATA_TYPE_STRING,   &m_profile[PROBE_CHECK_BROKERS],     false, 0},
+    {"Diagnostics/Scheduler",                      NMA_SchedulerReport,        false, METRIC_DATA_TYPE_STRING,   &m_scheduler,                        false, 0},
+};
+
+// Metrics published for each channel by publish_data()
+enum ChannelMetric {
+    CM_Power = 0,
+    CM_Direction,
+    CM_Data,
+    NUM_CHANNEL_METRICS
 };
 
+// Handles to each channel's metrics in NodeMetrics, looked up once by
+// setup_channel_metric_handles() so that publishing doesn't search the table
+static MetricSpec *m_channelMetrics[NUMBER_OF_CHANNELS][NUM_CHANNEL_METRICS];
+
+/**
+ * @brief Give each channel's metrics their deadbands, the data's depending on
+ * whether it's the temperature or the Seebeck voltage.
+ */
+static void setup_channel_deadbands(void){
+    float data_deadband = m_selectData ? TEMPERATURE_DEADBAND : SEEBECK_DEADBAND;
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        set_metric_deadband(m_channelMetrics[i][CM_Power],     POWER_DEADBAND, false, REPORT_MAX_SILENCE_MS);
+        set_metric_deadband(m_channelMetrics[i][CM_Direction], 0,              false, REPORT_MAX_SILENCE_MS);
+        set_metric_deadband(m_channelMetrics[i][CM_Data],      data_deadband,  false, REPORT_MAX_SILENCE_MS);
+    }
+}
+
+// Forget the batched samples, e.g. when they're no longer the data selected.
+static void clear_batches(void){
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++)
+        m_batchCount[i] = 0;
+}
+
+/**
+ * @brief Add a sample of a channel's data to its batch, if batching is on and
+ * the sample is of the data selected.  It becomes the channel's data metric
+ * value.  When the batch is full, its oldest sample is dropped.
+ */
+static void batch_sample(int channel, float value, bool temperature){
+    if(m_batchSize == 0 || temperature != m_selectData ||
+       channel < 0 || channel >= NUMBER_OF_CHANNELS)
+        return;
+    int count = m_batchCount[channel];
+    if(count == BATCH_MAX_SAMPLES){
+        count--;
+        memmove(&m_batchValues[channel][0], &m_batchValues[channel][1], count * sizeof(m_batchValues[0][0]));
+        memmove(&m_batchTimes[channel][0],  &m_batchTimes[channel][1],  count * sizeof(m_batchTimes[0][0]));
+    }
+    m_batchValues[channel][count] = value;
+    m_batchTimes[channel][count] = get_current_time_millis();
+    m_batchCount[channel] = count + 1;
+    m_Channel_data[channel] = value;
+}
+
+// Add each channel's batched samples to the module payload.
+static void add_batches(void){
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        if(m_batchCount[i] == 0)
+            continue;
+        if(!add_metric_samples(m_channelMetrics[i][CM_Data], m_batchValues[i],
+                               m_batchTimes[i], m_batchCount[i])) {
+            LOG_ERROR("%s", cf_sparkplug_error);
+        }
+    }
+}
+
 //Verify validity of this function
 void reset_teensy(){
     WRITE_RESTART(0x5FA0004);
@@ -246,33 +742,239 @@ void publish_births(){
 
     for(int br_idx = 0; br_idx < NUM_BROKERS; br_idx++){
         // Create and publish the NBIRTH message containing the bdseq metric
-        // for this broker together with all the node metrics
+        // for this broker together with all the node metrics, which come
+        // from the birth cache
         set_up_nbirth_payload();
-        if(!add_metrics(true, ARRAY_AND_SIZE(bdseqMetrics[br_idx])) || !publish_metrics(&m_broker[br_idx], NUM_BROKERS, nodeBirthTopic.c_str(), true, ARRAY_AND_SIZE(NodeMetrics))) {
-            DebugPrintNoEOL("Failed to add metrics: ");
-            DebugPrint(cf_sparkplug_error);
+        if(!add_metrics(true, ARRAY_AND_SIZE(bdseqMetrics[br_idx])) || !publish_birth_metrics(&m_broker[br_idx], NUM_BROKERS, nodeBirthTopic.c_str(), ARRAY_AND_SIZE(NodeMetrics))) {
+            LOG_ERROR("Failed to add metrics: %s", cf_sparkplug_error);
             // Continue anyway
         }
     }
 }
 
+// Record the timing of a power command that has just set a TEC's target.
+// Its latency and age are recorded by record_command_actuations() once the
+// control interrupt has moved the power.  The age is only known if the host
+// timestamped the payload and we have NTP time.
+static void record_command_timing(int channel, uint32_t receive_us, uint32_t decode_us, const Payload *payload){
+    latency_record(&m_cmdDecodeStats, decode_us);
+    PendingCommand *cmd = &m_cmdPending[channel];
+    cmd->pending = true;
+    cmd->receive_us = receive_us;
+    cmd->timestamp = (payload->has_timestamp && ntp.updated()) ? payload->timestamp : 0;
+}
+
+// Record the latency and age of the power commands whose targets the control
+// interrupt has started moving to.  A command replaced before that isn't
+// recorded.
+static void record_command_actuations(void){
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        PendingCommand *cmd = &m_cmdPending[i];
+        uint32_t actuated_us;
+        if(!cmd->pending || !control_take_actuation(i, &actuated_us))
+            continue;
+        cmd->pending = false;
+        latency_record(&m_cmdLatencyStats, actuated_us - cmd->receive_us);
+        if(cmd->timestamp != 0){
+            unsigned long long actuated = get_current_time_millis() - (micros() - actuated_us) / 1000;
+            if(actuated >= cmd->timestamp)
+                latency_record(&m_cmdAgeStats, (uint32_t) min(actuated - cmd->timestamp, (unsigned long long) UINT32_MAX));
+        }
+    }
+}
+
+// Update the command timing metrics if any commands have been timed since
+// they were last published.
+static void update_command_metrics(void){
+    record_command_actuations();
+    if(m_cmdLatencyStats.count == m_cmdStatsPublished)
+        return;
+    m_cmdStatsPublished = m_cmdLatencyStats.count;
+
+    uint32_t p50, p99, max;
+    if(latency_percentiles(&m_cmdDecodeStats, &p50, &p99, &max)){
+        m_cmdDecodeP50 = p50;
+        m_cmdDecodeP99 = p99;
+        m_cmdDecodeMax = max;
+    }
+    if(latency_percentiles(&m_cmdLatencyStats, &p50, &p99, &max)){
+        m_cmdLatencyP50 = p50;
+        m_cmdLatencyP99 = p99;
+        m_cmdLatencyMax = max;
+    }
+    if(latency_percentiles(&m_cmdAgeStats, &p50, &p99, &max)){
+        m_cmdAgeP50 = p50;
+        m_cmdAgeP99 = p99;
+        m_cmdAgeMax = max;
+    }
+    void *variables[] = {
+        &m_cmdDecodeP50,  &m_cmdDecodeP99,  &m_cmdDecodeMax,
+        &m_cmdLatencyP50, &m_cmdLatencyP99, &m_cmdLatencyMax,
+        &m_cmdAgeP50,     &m_cmdAgeP99,     &m_cmdAgeMax,
+    };
+    for(unsigned int i = 0; i < NUM_ELEM(variables); i++){
+        if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), variables[i])) {
+            LOG_ERROR("%s", cf_sparkplug_error);
+        }
+    }
+}
+
+// Update the power headroom metric with the least since the last publish, if
+// it's changed.
+static void update_budget_metrics(void){
+    float headroom = control_take_headroom();
+    if(headroom == m_powerHeadroom)
+        return;
+    m_powerHeadroom = headroom;
+    if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_powerHeadroom)) {
+        LOG_ERROR("%s", cf_sparkplug_error);
+    }
+}
+
+// Copy each probe's statistics since the last report into its Diagnostics
+// metric, along with the scheduler's task statistics, and start them all
+// afresh.
+static void update_profile_metrics(void){
+    for(int i = 0; i < NUM_PROFILE_PROBES; i++){
+        if(!profile_report(i, m_profileText[i], sizeof(m_profileText[i]))) {
+            snprintf(m_profileText[i], sizeof(m_profileText[i]), "n 0");
+        }
+        profile_reset(i);
+        if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_profile[i])) {
+            LOG_ERROR("%s", cf_sparkplug_error);
+        }
+    }
+    if(!scheduler_report(m_schedulerText, sizeof(m_schedulerText))) {
+        m_schedulerText[0] = '\0';
+    }
+    scheduler_reset();
+    if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_scheduler)) {
+        LOG_ERROR("%s", cf_sparkplug_error);
+    }
+}
+
+// Describe a channel's auto-tuning experiment in its status metric.
+static void describe_autotune(int channel){
+    AutotuneStatus status;
+    if(!control_autotune_status(channel, &status))
+        return;
+    char *text = m_autotuneText[channel];
+    size_t size = sizeof(m_autotuneText[channel]);
+    switch(status.state){
+    case AUTOTUNE_RUNNING:
+        snprintf(text, size, "Running, %d of %d cycles", status.cycles, AUTOTUNE_CYCLES);
+        break;
+    case AUTOTUNE_DONE:
+        snprintf(text, size, "Done, Ku %.3f, Tu %.1f s", status.ku, status.tu);
+        break;
+    case AUTOTUNE_TIMED_OUT:
+        snprintf(text, size, "Failed, timed out");
+        break;
+    case AUTOTUNE_OUT_OF_RANGE:
+        snprintf(text, size, "Failed, over %.1f C from the setpoint", AUTOTUNE_MAX_DEVIATION);
+        break;
+    case AUTOTUNE_NO_OSCILLATION:
+        snprintf(text, size, "Failed, no oscillation");
+        break;
+    case AUTOTUNE_ABORTED:
+        snprintf(text, size, "Aborted");
+        break;
+    default:
+        snprintf(text, size, "Idle");
+        break;
+    }
+    m_Channel_autotune[channel] = (status.state == AUTOTUNE_RUNNING);
+}
+
+/**
+ * @brief Refresh the metrics of the on-board controllers, for when an
+ * auto-tuning experiment has progressed.  The experiment changes the gains
+ * and the mode, as well as its own status.
+ */
+void update_control_metrics(void){
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        describe_autotune(i);
+        m_Channel_mode[i] = control_get_mode(i);
+        control_get_gains(i, &m_Channel_kp[i], &m_Channel_ki[i], &m_Channel_kd[i]);
+        void *variables[] = {
+            &m_Channel_autotune[i], &m_Channel_autotuneStatus[i], &m_Channel_mode[i],
+            &m_Channel_kp[i], &m_Channel_ki[i], &m_Channel_kd[i],
+        };
+        for(unsigned int j = 0; j < NUM_ELEM(variables); j++){
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), variables[j])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+        }
+    }
+}
+
 // Publish the NDATA message with any node metrics that have been updated.
 void publish_node_data(){
+    PROFILE_SCOPE(PROBE_PUBLISH_NODE_DATA);
+    update_command_metrics();
+    update_budget_metrics();
 
-    // Publish any updated metrics in the NDATA message
+    // Publish any updated metrics in the NDATA message, the channel metrics
+    // from the compiled payload when they've all been updated, along with the
+    // batched samples
     set_up_next_payload();
-    if(!publish_metrics(ARRAY_AND_SIZE(m_broker), nodeDataTopic.c_str(), false,
-                        ARRAY_AND_SIZE(NodeMetrics))){
+    add_batches();
+    if(!publish_compiled_metrics(ARRAY_AND_SIZE(m_broker), nodeDataTopic.c_str(),
+                                 ARRAY_AND_SIZE(NodeMetrics))){
         // An empty message means we aren't connected to any brokers, while the
         // no metrics message means no metrics have changed since the last time
-        // we published - ignore both of these cases
+        // we published - ignore both of these cases.  The batches are kept,
+        // losing their oldest samples once they're full.
         if(strcmp(cf_sparkplug_error, ""          ) != 0 &&
            strcmp(cf_sparkplug_error, "No metrics") != 0){
-            DebugPrintNoEOL("Failed to publish NDATA: ");
-            DebugPrint(cf_sparkplug_error);
+            LOG_ERROR("Failed to publish NDATA: %s", cf_sparkplug_error);
         }
         return;
     }
+    clear_batches();
+}
+
+/**
+ * @brief Add a channel's temperature, in degrees C, to its batch, if batching
+ * is on and the temperature is the data selected.
+ */
+void batch_temperature(int channel, float celsius){
+    batch_sample(channel, celsius, true);
+}
+
+/**
+ * @brief Add a channel's Seebeck voltage, in millivolts, to its batch, if
+ * batching is on and the Seebeck voltage is the data selected.
+ */
+void batch_seebeck(int channel, float millivolts){
+    batch_sample(channel, millivolts, false);
+}
+
+/**
+ * @brief Publish the NDATA message early if any channel's batch is full, or
+ * its oldest sample has waited the batch interval.  Nothing is tried without
+ * a broker to publish to, and a flush that fails isn't retried for
+ * BATCH_RETRY_MS, as each try takes the node metrics' updates with it.
+ */
+void flush_batches(void){
+    static uint32_t last_failure;
+    static bool failed = false;
+    if(m_batchSize == 0 || !network_broker_connected())
+        return;
+    if(failed && millis() - last_failure < BATCH_RETRY_MS)
+        return;
+    unsigned long long now = get_current_time_millis();
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        int count = m_batchCount[i];
+        if(count > 0 && ((uint64_t) count >= m_batchSize ||
+                         now - m_batchTimes[i][0] >= m_batchInterval)){
+            publish_node_data();
+            // The batches are only cleared once they've been published
+            failed = m_batchCount[i] > 0;
+            last_failure = millis();
+            return;
+        }
+    }
 }
 
 /**
@@ -285,11 +987,11 @@ void publish_node_data(){
 bool subscribeTopics(PubSubClient* broker){
     bool success = true;
     if(!broker->subscribe(HOST_STATE_TOPIC)) {
-        Serial.println("Failed to subscribe to host state topic.");
+        LOG_ERROR("Failed to subscribe to host state topic.");
         success = false;
     }
     if(!broker->subscribe(nodeCmdTopic.c_str())) {
-        Serial.println("Failed to subscribe to node commands.");
+        LOG_ERROR("Failed to subscribe to node commands.");
         success = false;
     }
     return success;
@@ -301,27 +1003,26 @@ bool connect_to_broker(PubSubClient *broker, int br_idx){
     // message
     m_bdSeq[br_idx]++;
     if(!update_metric(ARRAY_AND_SIZE(bdseqMetrics[br_idx]), &m_bdSeq[br_idx])) {
-        DebugPrint(cf_sparkplug_error);
+        LOG_ERROR("%s", cf_sparkplug_error);
     }
     // Create the NDEATH message with its metrics
     set_up_ndeath_payload();
     if(!add_metrics(true, ARRAY_AND_SIZE(bdseqMetrics[br_idx]))){
-        DebugPrint(cf_sparkplug_error);
-        DebugPrint("Failed to add metrics to NDEATH");
+        LOG_ERROR("Failed to add metrics to NDEATH: %s", cf_sparkplug_error);
         m_bdSeq[br_idx]--;
         return false;
     }
 
     // Connect to the broker, with the NDEATH message as our "will"
     if(!connect(broker, node_id.c_str(), nodeDeathTopic.c_str())){
-        DebugPrint(cf_sparkplug_error);
+        LOG_ERROR("%s", cf_sparkplug_error);
         m_bdSeq[br_idx]--;
         return false;
     }
 
     // Subscribe to the topics we're interested in
     if(!subscribeTopics(broker)){
-        DebugPrint("Unable to subscribe to topics on broker");
+        LOG_ERROR("Unable to subscribe to topics on broker");
         // Disconnect gracefully from the broker
         disconnect(broker, nodeDeathTopic.c_str());
         return false;
@@ -352,10 +1053,21 @@ unsigned long long get_current_time_millis(void){
 }
 
 
+// Send a log message to the log topic on each connected broker.  Failures
+// aren't logged, since that would only add to the log.
+static void publish_log(const char *line){
+    for(int i = 0; i < NUM_BROKERS; ++i){
+        if(m_broker[i].connected()) {
+            m_broker[i].publish(nodeLogTopic.c_str(), line);
+        }
+    }
+}
+
 // Check to see if a received message is a Node command (NCMD) message.  If it
 // is, handle it and return true, even if it's invalid; otherwise return false.
 bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
-    Serial.println("Processing Command.");
+    uint32_t receive_us = micros();
+    LOG_DEBUG("Processing Command.");
     if(strcmp(topic, nodeCmdTopic.c_str()) != 0) {
         // This is not a Node command message
         return false;
@@ -365,11 +1077,13 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
     if(!decoder.decode(payload, len)){
         // Invalid payload - don't do anything
         decoder.free_payload();
-        DebugPrint("Unable to decode Node command payload");
+        LOG_ERROR("Unable to decode Node command payload");
         // This was a Node command message
         return true;
     }
-
+    uint32_t decode_us = micros() - receive_us;
+    bool actuated = false;
+    bool profiled = false;
 
     // Process the metrics
     for(unsigned int idx = 0; idx < decoder.payload.metrics_count; idx++) {
@@ -377,8 +1091,7 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
         MetricSpec *metric_spec = find_received_metric(ARRAY_AND_SIZE(NodeMetrics), metric);
         if(metric_spec == NULL){
             // Invalid metric - skip it
-            DebugPrintNoEOL("Unrecognized Node metric: ");
-            DebugPrint(cf_sparkplug_error);
+            LOG_WARN("Unrecognized Node metric: %s", cf_sparkplug_error);
             continue;
         }
     
@@ -390,7 +1103,7 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
         switch(alias){
         case NMA_Reboot:
             if(metric->value.boolean_value) {
-                DebugPrint("Reboot command received");
+                LOG_INFO("Reboot command received");
                 // Reboot immediately - don't attempt to process the rest of
                 // the message, publish data, send death certificate,
                 // disconnect from broker, or close network
@@ -398,19 +1111,91 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
             }
             break;
         case NMA_Rebirth:
-            DebugPrint("Rebirth Command received");
+            LOG_INFO("Rebirth Command received");
             m_nodeRebirth = metric->value.boolean_value;
             if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_nodeRebirth)) {
-                DebugPrint(cf_sparkplug_error);
+                LOG_ERROR("%s", cf_sparkplug_error);
             }
             if(m_nodeRebirth) {
                 publish_births();
-                DebugPrint("Node Rebirth command received");
+                LOG_DEBUG("Node Rebirth command received");
+            }
+            break;
+        case NMA_LogLevel:
+            log_set_level((int) metric->value.long_value);
+            // Publish the level in use, which is unchanged if it was invalid
+            m_logLevel = log_get_level();
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_logLevel)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_LogToMqtt:
+            m_logToMqtt = metric->value.boolean_value;
+            log_set_sink(m_logToMqtt ? publish_log : NULL);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_logToMqtt)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_PwmDither:
+            pwm_set_dither(metric->value.boolean_value);
+            m_pwmDither = pwm_get_dither();
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_pwmDither)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_PwmStagger:
+            pwm_set_stagger((int) metric->value.long_value);
+            // Publish the mode in use, which is unchanged if it was invalid
+            m_pwmStagger = pwm_get_stagger();
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_pwmStagger)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_PowerBudget:
+            if(!control_set_budget(metric->value.float_value)) {
+                LOG_WARN("Invalid power budget %f", metric->value.float_value);
+            }
+            m_powerBudget = control_get_budget();
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_powerBudget)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_BatchSize:
+            if(metric->value.long_value > BATCH_MAX_SAMPLES) {
+                LOG_WARN("Invalid batch size %d", (int) metric->value.long_value);
+            }
+            else {
+                m_batchSize = metric->value.long_value;
+                if(m_batchSize == 0)
+                    clear_batches();
+            }
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_batchSize)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_BatchInterval:
+            if(metric->value.long_value < BATCH_MIN_INTERVAL_MS ||
+               metric->value.long_value > BATCH_MAX_INTERVAL_MS) {
+                LOG_WARN("Invalid batch interval %d", (int) metric->value.long_value);
+            }
+            else {
+                m_batchInterval = metric->value.long_value;
+            }
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_batchInterval)) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        case NMA_ProfileReport:
+            if(metric->value.boolean_value) {
+                update_profile_metrics();
+                profiled = true;
             }
             break;
         case NMA_SelectData:
             m_selectData = !m_selectData;
-            Serial.println(m_selectData);
+            LOG_INFO("Data selection %d", m_selectData);
+            setup_channel_deadbands();
+            clear_batches();
             publish_births();
             break;
         case NMA_CalibrationTemp1:
@@ -431,31 +1216,153 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
             therm->clear_calibration();
             m_nodeCalibrated = false;
             publish_births();
-            DebugPrint("Calibration data has been permanently erased.");            
+            LOG_INFO("Calibration data has been permanently erased.");
             break;
         case NMA_Channel1_pwr ... NMA_Channel12_pwr: {            
             int channel;
             channel = alias - NMA_Channel1_pwr;
-            if(channel >= 0 && channel < NUMBER_OF_CHANNELS){
+            if(channel >= 0 && channel < NUMBER_OF_CHANNELS && control_get_mode(channel) != PID_MANUAL){
+                // The controller owns the power; republish what it's using
+                LOG_WARN("Channel %d is under automatic control", channel + 1);
+                m_Channel_pwr[channel] = TEC[channel].getPower();
+                if(!force_update_metric_handle(m_channelMetrics[channel][CM_Power])) {
+                    LOG_ERROR("%s", cf_sparkplug_error);
+                }
+            }
+            else if(channel >= 0 && channel < NUMBER_OF_CHANNELS){
                 m_Channel_pwr[channel] = metric->value.float_value;
                 //### Should value be limited to min/max here?
                 //### It will be limited by set_channel(), but should we report the
                 //### commanded (invalid) voltage or the actual voltage set?
-                TEC[channel].setPower(m_Channel_pwr[channel]);
+                // The control interrupt moves the power to the target
+                record_command_actuations();
+                if(control_set_target(channel, m_Channel_pwr[channel])) {
+                    record_command_timing(channel, receive_us, decode_us, &decoder.payload);
+                }
+                actuated = true;
 
                 // Publish this TEC value, even if it hasn't changed.  The
                 // timestamp should show when the value was last set, not when
                 // it last changed.
-                //if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_pwr[channel])) {
-                //    DebugPrint(cf_sparkplug_error);
-                //}
+                if(!force_update_metric_handle(m_channelMetrics[channel][CM_Power])) {
+                    LOG_ERROR("%s", cf_sparkplug_error);
+                }
+            }
+            LOG_DEBUG("Channel %d set to value %0.2f", channel, m_Channel_pwr[channel]);
+            break;
+        }
+        case NMA_Channel1_setpoint ... NMA_Channel12_setpoint: {
+            int channel = alias - NMA_Channel1_setpoint;
+            if(!control_set_setpoint(channel, metric->value.float_value)) {
+                LOG_WARN("Invalid setpoint for channel %d", channel + 1);
+            }
+            m_Channel_setpoint[channel] = control_get_setpoint(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_setpoint[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_slew ... NMA_Channel12_slew: {
+            int channel = alias - NMA_Channel1_slew;
+            if(!control_set_slew(channel, metric->value.float_value)) {
+                LOG_WARN("Invalid slew rate for channel %d", channel + 1);
+            }
+            m_Channel_slew[channel] = control_get_slew(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_slew[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_dwell ... NMA_Channel12_dwell: {
+            int channel = alias - NMA_Channel1_dwell;
+            if(metric->value.long_value > TRAJECTORY_MAX_DWELL ||
+               !control_set_dwell(channel, (uint32_t) metric->value.long_value)) {
+                LOG_WARN("Invalid reverse dwell for channel %d", channel + 1);
+            }
+            m_Channel_dwell[channel] = control_get_dwell(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_dwell[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_priority ... NMA_Channel12_priority: {
+            int channel = alias - NMA_Channel1_priority;
+            if(!control_set_priority(channel, metric->value.float_value)) {
+                LOG_WARN("Invalid priority for channel %d", channel + 1);
+            }
+            m_Channel_priority[channel] = control_get_priority(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_priority[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_mode ... NMA_Channel12_mode: {
+            int channel = alias - NMA_Channel1_mode;
+            if(!control_set_mode(channel, (int) metric->value.long_value)) {
+                LOG_WARN("Channel %d can't use control mode %d", channel + 1, (int) metric->value.long_value);
+            }
+            // Publish the mode in use, which is the old one if the command
+            // was rejected
+            m_Channel_mode[channel] = control_get_mode(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_mode[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_kp ... NMA_Channel12_kp:
+        case NMA_Channel1_ki ... NMA_Channel12_ki:
+        case NMA_Channel1_kd ... NMA_Channel12_kd: {
+            // The gains are in blocks of one per channel: Kp, then Ki, then Kd
+            int gain = (alias - NMA_Channel1_kp) / NUMBER_OF_CHANNELS;
+            int channel = (alias - NMA_Channel1_kp) % NUMBER_OF_CHANNELS;
+            float gains[3];
+            control_get_gains(channel, &gains[0], &gains[1], &gains[2]);
+            gains[gain] = metric->value.float_value;
+            if(!control_set_gains(channel, gains[0], gains[1], gains[2])) {
+                LOG_WARN("Invalid gain for channel %d", channel + 1);
+            }
+            else {
+                control_save_gains(channel);
+            }
+            control_get_gains(channel, &m_Channel_kp[channel], &m_Channel_ki[channel], &m_Channel_kd[channel]);
+            float *variables[] = {&m_Channel_kp[channel], &m_Channel_ki[channel], &m_Channel_kd[channel]};
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), variables[gain])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
+            }
+            break;
+        }
+        case NMA_Channel1_autotune ... NMA_Channel12_autotune: {
+            int channel = alias - NMA_Channel1_autotune;
+            if(!metric->value.boolean_value) {
+                control_autotune_abort(channel);
+            }
+            else if(!control_autotune_start(channel)) {
+                LOG_WARN("Channel %d can't be tuned", channel + 1);
+            }
+            update_control_metrics();
+            break;
+        }
+        case NMA_Channel1_filterType ... NMA_Channel12_filterType:
+        case NMA_Channel1_filterLength ... NMA_Channel12_filterLength: {
+            bool is_type = (alias <= NMA_Channel12_filterType);
+            int channel = alias - (is_type ? NMA_Channel1_filterType : NMA_Channel1_filterLength);
+            int type = is_type ? (int) metric->value.long_value : filter_get_type(channel);
+            int length = is_type ? filter_get_length(channel) : (int) metric->value.long_value;
+            if(!filter_configure(channel, type, length)) {
+                LOG_WARN("Invalid filter for channel %d", channel + 1);
+            }
+            // Publish the filter in use, which is the old one if the command
+            // was rejected
+            m_Channel_filterType[channel] = filter_get_type(channel);
+            m_Channel_filterLength[channel] = filter_get_length(channel);
+            if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_filterType[channel]) ||
+               !update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_filterLength[channel])) {
+                LOG_ERROR("%s", cf_sparkplug_error);
             }
-            Serial.printf("Channel %d set to value %0.2f ", channel, m_Channel_pwr[channel]);            
             break;
         }
         default:
-            DebugPrintNoEOL("Unhandled Node metric alias: ");
-            DebugPrint(alias);
+            LOG_WARN("Unhandled Node metric alias: %lld", (long long) alias);
             break;
         }
     }
@@ -463,6 +1370,12 @@ bool process_node_cmd_message(char* topic, byte* payload, unsigned int len){
     // Free the decoder memory
     decoder.free_payload();
 
+    // Echo the new power settings straight away, so the host sees when they
+    // took effect, and send a requested profile report
+    if(actuated || profiled) {
+        publish_node_data();
+    }
+
     // This was a Node command message
     return true;
 }
@@ -479,17 +1392,17 @@ void callback_worker(char* topic, byte* payload, unsigned int len){
     // Check parameters are valid
     if(topic == NULL || strcmp(topic, "") == 0){
         // Topic was not specified - don't do anything
-        DebugPrint("No topic specified");
+        LOG_WARN("No topic specified");
         return;
     }
     if(payload == NULL){
         // Payload was not specified - don't do anything
-        DebugPrint("No payload specified");
+        LOG_WARN("No payload specified");
         return;
     }
     if(len == 0){
         // Payload is empty - don't do anything
-        DebugPrint("Payload length is zero");
+        LOG_WARN("Payload length is zero");
         return;
     }
 
@@ -498,11 +1411,11 @@ void callback_worker(char* topic, byte* payload, unsigned int len){
     if(process_host_state_message(topic, payload, len, &host_online)){
         // A non-empty error indicates the message was invalid
         if(strcmp(cf_sparkplug_error, "") != 0) {
-            DebugPrint(cf_sparkplug_error);
+            LOG_ERROR("%s", cf_sparkplug_error);
         }
         if(host_online){
             // Primary Host is connected to this broker
-            DebugPrint("Primary Host is ONLINE");
+            LOG_INFO("Primary Host is ONLINE");
             //### Should we publish births to let the Primary Host know we're
             //### here, or wait for the Primary Host to send a Rebirth message?
             //### After all, we might have received this message because *we*
@@ -510,7 +1423,7 @@ void callback_worker(char* topic, byte* payload, unsigned int len){
         }
         else{
             // Primary Host is not connected to this broker
-            DebugPrint("Primary Host is OFFLINE");
+            LOG_INFO("Primary Host is OFFLINE");
             //### Enter safe state (not applicable for this module)
         }
     }
@@ -518,23 +1431,22 @@ void callback_worker(char* topic, byte* payload, unsigned int len){
         // Unrecognized message
         char topic_short[40];
         snprintf(topic_short, sizeof(topic_short), "%s", topic);
-        DebugPrintNoEOL("Unrecognized message topic: \"");
-        DebugPrintNoEOL(topic_short);
-        DebugPrint("\"");
+        LOG_WARN("Unrecognized message topic: \"%s\"", topic_short);
     }
 }
 
 /**
- * @brief Publish metrics for TEC channels and temperature.  Note that we
- * publish this data even if it hasn't changed because the timestamp should
- * show when the data was last read, not when it last changed.
+ * @brief Publish metrics for TEC channels and temperature.  Each metric is
+ * published when it moves out of its deadband, or at least every
+ * REPORT_MAX_SILENCE_MS, and its timestamp shows when that reading was taken.
  *
  * @param Channel_data an array of NUM_Channel_CHANNELS floats representing the averaged
  * Channel voltages
  * @param the average temperature reading
  */
 void publish_data( int channel_num, float channel_pwr, bool channel_dir, float channel_data, float Seebeck ){
-    
+    PROFILE_SCOPE(PROBE_PUBLISH_DATA);
+
     // Store new Channel data, converting from raw Channel values to user units
     m_Channel_pwr[channel_num] = channel_pwr;
     m_Channel_dir[channel_num] = channel_dir;
@@ -544,12 +1456,9 @@ void publish_data( int channel_num, float channel_pwr, bool channel_dir, float c
     else {
         m_Channel_data[channel_num] = Seebeck;
     }
-    for (int i = 0; i < NUM_TEC; i++) {
-        if(!(update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_pwr[i]) &&
-             update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_dir[i]) &&
-             update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_data[i]))) {
-                DebugPrint(cf_sparkplug_error);
-        }
+    // Mark this channel's metrics as updated, with a single timestamp
+    if(!update_metric_handles(ARRAY_AND_SIZE(m_channelMetrics[channel_num]))) {
+        LOG_ERROR("%s", cf_sparkplug_error);
     }
 }
 
@@ -577,6 +1486,7 @@ void generateNames(int hardware_id){
     nodeDeathTopic.replace(NODE_ID_TOKEN, dev_id);
     nodeDataTopic.replace(NODE_ID_TOKEN, dev_id);
     nodeCmdTopic.replace(NODE_ID_TOKEN, dev_id);
+    nodeLogTopic.replace(NODE_ID_TOKEN, dev_id);
 }
 
 /**
@@ -596,6 +1506,26 @@ void setup_bdseq_metrics(void){
     }
 }
 
+/**
+ * @brief Look up the handles for each channel's metrics in NodeMetrics, so
+ * that publish_data() can update them without searching.
+ *
+ * @return true if every channel metric was found
+ * @return false if a channel metric is missing from NodeMetrics
+ */
+bool setup_channel_metric_handles(void){
+    for(int i = 0; i < NUMBER_OF_CHANNELS; i++){
+        m_channelMetrics[i][CM_Power]     = find_metric_by_variable(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_pwr[i]);
+        m_channelMetrics[i][CM_Direction] = find_metric_by_variable(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_dir[i]);
+        m_channelMetrics[i][CM_Data]      = find_metric_by_variable(ARRAY_AND_SIZE(NodeMetrics), &m_Channel_data[i]);
+        for(int j = 0; j < NUM_CHANNEL_METRICS; j++){
+            if(m_channelMetrics[i][j] == NULL)
+                return false;
+        }
+    }
+    return true;
+}
+
 /**
  * @brief Initializes the network, sets up and checks the metric arrays, assigns
  * the IP and MAC addresses based on hardware ID jumpers, connects to NTP, and
@@ -612,6 +1542,21 @@ bool network_init(void){
     else {
         m_nodeCalibrated = false;
     }
+    m_logLevel = log_get_level();
+    m_pwmDither = pwm_get_dither();
+    m_pwmStagger = pwm_get_stagger();
+    m_powerBudget = control_get_budget();
+    for (int i = 0; i < NUMBER_OF_CHANNELS; i++) {
+        m_Channel_filterType[i] = filter_get_type(i);
+        m_Channel_filterLength[i] = filter_get_length(i);
+        m_Channel_setpoint[i] = control_get_setpoint(i);
+        m_Channel_slew[i] = control_get_slew(i);
+        m_Channel_dwell[i] = control_get_dwell(i);
+        m_Channel_priority[i] = control_get_priority(i);
+        m_Channel_mode[i] = control_get_mode(i);
+        control_get_gains(i, &m_Channel_kp[i], &m_Channel_ki[i], &m_Channel_kd[i]);
+        describe_autotune(i);
+    }
     // Set up the metrics arrays holding the node birth/death sequence numbers
     setup_bdseq_metrics();
 
@@ -621,14 +1566,28 @@ bool network_init(void){
     // Check that the alias numbers in the metrics are valid and unique
     for(int i = 0; i < NUM_BROKERS; ++i) {
         if(!check_metrics(ARRAY_AND_SIZE(bdseqMetrics[i]), NMA_bdSeq + 1)){
-            DebugPrint(cf_sparkplug_error);
+            LOG_ERROR("%s", cf_sparkplug_error);
             return false;
         }
     }
     if(!check_metrics(ARRAY_AND_SIZE(NodeMetrics), EndNodeMetricAlias     )){
-        DebugPrint(cf_sparkplug_error);
+        LOG_ERROR("%s", cf_sparkplug_error);
+        return false;
+    }
+    if(!setup_channel_metric_handles()){
+        LOG_ERROR("%s", cf_sparkplug_error);
         return false;
     }
+    setup_channel_deadbands();
+    // The channel metrics go in every NDATA, so compile them.  NDATA is
+    // still published without it.
+    if(!compile_payload(&m_channelMetrics[0][0], NUMBER_OF_CHANNELS * NUM_CHANNEL_METRICS)){
+        LOG_WARN("%s", cf_sparkplug_error);
+    }
+    // Likewise the names, aliases and types in the NBIRTH never change
+    if(!cache_birth_metrics(ARRAY_AND_SIZE(NodeMetrics))){
+        LOG_WARN("%s", cf_sparkplug_error);
+    }
 
     // Point to our function for getting timestamps
     set_gettimestamp_callback(get_current_time_millis);
@@ -643,8 +1602,7 @@ bool network_init(void){
     // Adjust network addresses based on module ID
     int hardware_id = get_hardware_id();
     if(hardware_id < 0 || hardware_id > MAX_BOARD_ID){
-        DebugPrintNoEOL("Invalid hardware ID ");
-        DebugPrint(hardware_id);
+        LOG_ERROR("Invalid hardware ID %d", hardware_id);
         return false;
     }
     ip[3]  += hardware_id;
@@ -655,33 +1613,20 @@ bool network_init(void){
 
     Ethernet.begin(mac, ip, dns, gateway, subnet);
     if(Ethernet.hardwareStatus() == EthernetNoHardware){
-        DebugPrint("Ethernet Shield is not connected");
+        LOG_ERROR("Ethernet Shield is not connected");
         return false;
     }
     if(Ethernet.linkStatus() == LinkOFF){
-        DebugPrint("Ethernet cable is unplugged");
+        LOG_WARN("Ethernet cable is unplugged");
         // This is not a fatal error
     }
 
-    DebugPrintNoEOL("My IP address: ");
-    DebugPrint(ip);
+    LOG_INFO("My IP address: %u.%u.%u.%u", ip[0], ip[1], ip[2], ip[3]);
 
-    // These should only get called once
+    // These should only get called once.  The first NTP request is sent by
+    // update_ntp().
     ntp.setUpdateInterval(SECS_IN_HR);
     ntp.begin();
-    if(!ntp.updated()){
-        DebugPrintNoEOL("Trying NTP update from ");
-        DebugPrintNoEOL(ntpIP);
-        DebugPrintNoEOL("... ");
-        ntp.forceUpdate();
-    }
-    if(ntp.updated()){
-        DebugPrintNoEOL("NTP updated.  Time is ");
-        DebugPrint(ntp.getFormattedTime());
-    }
-    else {
-        DebugPrint("NTP not updated");
-    }
     for(int i = 0; i < NUM_BROKERS; ++i) {
         m_broker[i].setClient(enet[i]);
     }
@@ -689,13 +1634,42 @@ bool network_init(void){
 
     for(int i = 0; i < NUM_BROKERS; ++i){
         m_broker[i].setCallback(callback_worker);
-        m_broker[i].setBufferSize(BIN_BUF_SIZE);
+        m_broker[i].setBufferSize(MQTT_BUF_SIZE);
     }
 
     // Network has been set up successfully
     return true;
 }
 
+/**
+ * @brief Checks whether the Ethernet cable is plugged in and the link is up.
+ */
+bool network_link_up(void){
+    return Ethernet.linkStatus() == LinkON;
+}
+
+/**
+ * @brief Checks whether we're connected to at least one broker.
+ */
+bool network_broker_connected(void){
+    for(int i = 0; i < NUM_BROKERS; ++i){
+        if(m_broker[i].connected())
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Publishes the time taken by each stage of booting.  The string must
+ * stay valid, since the metric points to it.
+ */
+void publish_boot_time(const char *boot_time){
+    m_bootTime = boot_time;
+    if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_bootTime)) {
+        LOG_ERROR("%s", cf_sparkplug_error);
+    }
+}
+
 /**
  * @brief Check each broker is connected, and if not then attempt to connect to
  * it.  Keep the connection to any connected brokers open, process incoming MQTT
@@ -703,19 +1677,29 @@ bool network_init(void){
  * should be called periodically.
  */
 void check_brokers(void){
-    // Try to connect to any brokers that aren't currently connected
+    PROFILE_SCOPE(PROBE_CHECK_BROKERS);
+
+    // Try to connect to any brokers that aren't currently connected.  This
+    // is called often, and a failed connection blocks, so only retry every
+    // BROKER_RETRY_MS.
+    static uint32_t last_attempt[NUM_BROKERS];
+    static bool attempted[NUM_BROKERS];
     bool new_connection = false;
     for(int i = 0; i < NUM_BROKERS; ++i){
         PubSubClient *broker = &m_broker[i];
         if(!broker->connected()){
+            if(attempted[i] && millis() - last_attempt[i] < BROKER_RETRY_MS) {
+                continue;
+            }
+            attempted[i] = true;
+            last_attempt[i] = millis();
             // Try to connect to the broker
             if(!connect_to_broker(broker, i)){
                 // Can't connect - ignore this broker
                 continue;
             }
             new_connection = true;
-            DebugPrintNoEOL("Connected to broker");
-            DebugPrint(i+1);
+            LOG_INFO("Connected to broker %d", i+1);
         }
     }
 
@@ -749,7 +1733,7 @@ void check_brokers(void){
         if(m_nodeRebirth) {
             m_nodeRebirth = false;
             if(!update_metric(ARRAY_AND_SIZE(NodeMetrics), &m_nodeRebirth)) {
-                DebugPrint(cf_sparkplug_error);
+                LOG_ERROR("%s", cf_sparkplug_error);
             }
         }
     }
@@ -32,6 +32,9 @@ this program. If not, see <https://www.gnu.org/licenses/>.
 // Public functions
 bool network_init();
 void check_brokers();
+bool network_link_up();
+bool network_broker_connected();
+void publish_boot_time(const char *boot_time);
 void publish_data( int channel_num, float channel_pwr, bool channel_dir, float channel_temp, float seebeck );
 bool update_ntp();
 unsigned long get_current_time();
@@ -39,6 +42,10 @@ unsigned long long get_current_time_millis();
 void decode_cal_data();
 void publish_calibration_status(bool);
 void publish_node_data();
+void batch_temperature(int channel, float celsius);
+void batch_seebeck(int channel, float millivolts);
+void flush_batches(void);
+void update_control_metrics(void);
 
 
 #endif
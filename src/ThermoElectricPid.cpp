@@ -0,0 +1,569 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPid.cpp
+ * @brief Implements the PID temperature controllers.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricPid.h"
+#include "ThermoElectricBudget.h"
+
+/*
+  Private variables
+*/
+static IntervalTimer m_timer;
+static ThermoElectricController *m_tecs = NULL;
+static int      m_num_tecs = 0;
+
+// A relay experiment, run by the control interrupt.  Temperatures are in
+// degrees C and times in control ticks.
+typedef struct {
+    volatile uint8_t state;     // AutotuneState
+    uint8_t  prev_mode;         // Mode to go back to when done
+    bool     pending;           // Done, but the gains haven't been set yet
+    int8_t   relay;             // +1 pushing the temperature up, -1 down
+    float    bias;              // Starting power
+    float    step;              // Power step, signed to push the temperature up
+    float    setpoint;
+    uint32_t ticks;             // Since the start
+    uint32_t last_up;           // When the relay last switched up
+    int      ups;               // Times the relay has switched up
+    float    peak_max;          // Extremes since the relay last switched up
+    float    peak_min;
+    int      cycles;            // Oscillations measured
+    float    sum_period;
+    float    sum_amplitude;
+    float    ku;
+    float    tu;
+} Autotune;
+
+// Gains as saved in the EEPROM, one after another for each channel
+typedef struct {
+    uint8_t valid;              // 0x01 if saved
+    float   kp;
+    float   ki;
+    float   kd;
+} SavedGains;
+
+// Shared with the control interrupt; change them with interrupts disabled
+static PidState m_pid[NUMBER_OF_CHANNELS];
+static volatile uint8_t m_mode[NUMBER_OF_CHANNELS];
+static float    m_setpoint[NUMBER_OF_CHANNELS];
+static Autotune m_tune[NUMBER_OF_CHANNELS];
+
+// Power trajectories
+static float    m_target[NUMBER_OF_CHANNELS];       // Manual mode power
+static float    m_slew[NUMBER_OF_CHANNELS];         // Percent per second, or 0
+static uint32_t m_dwell[NUMBER_OF_CHANNELS];        // Milliseconds
+static uint32_t m_zero_ticks[NUMBER_OF_CHANNELS];   // Control ticks at zero power
+static int8_t   m_last_sign[NUMBER_OF_CHANNELS];    // Direction before reaching zero
+static bool     m_awaiting[NUMBER_OF_CHANNELS];     // Target set, power not moved yet
+static bool     m_actuated[NUMBER_OF_CHANNELS];     // Moved, not yet taken
+static uint32_t m_actuated_us[NUMBER_OF_CHANNELS];
+
+// Supply budget
+static float    m_budget = BUDGET_DEFAULT_PERCENT;
+static float    m_priority[NUMBER_OF_CHANNELS];
+static float    m_min_headroom = INFINITY;          // Since last taken
+
+// Experiment progress last reported by control_service()
+static uint8_t  m_reported_state[NUMBER_OF_CHANNELS];
+static int      m_reported_cycles[NUMBER_OF_CHANNELS];
+
+// One step of a PID controller.
+float pid_update(PidState *pid, float setpoint, float input, float dt, float out_min, float out_max){
+    float error = setpoint - input;
+    float p = pid->kp * error;
+    float d = -pid->kd * (input - pid->last_input) / dt;
+    pid->last_input = input;
+
+    // Don't integrate further into saturation
+    float step = pid->ki * error * dt;
+    float out = p + pid->integral + step + d;
+    if(!(out > out_max && step > 0) && !(out < out_min && step < 0))
+        pid->integral += step;
+    pid->integral = constrain(pid->integral, out_min, out_max);
+
+    return constrain(p + pid->integral + d, out_min, out_max);
+}
+
+// Start a PID controller so that it follows on smoothly from the given output.
+void pid_reset(PidState *pid, float output, float input, float out_min, float out_max){
+    pid->integral = constrain(output, out_min, out_max);
+    pid->last_input = input;
+}
+
+static float channel_celsius(int channel){
+    return (m_tecs[channel].get_millikelvin(channel) - 273150) * 0.001f;
+}
+
+// The range the power can move to in one tick: within the slew rate of where
+// it is, and not changing direction until it has waited at zero.
+static void trajectory_limits(int channel, float dt, float *lo, float *hi){
+    float power = m_tecs[channel].getPower();
+    float step = (m_slew[channel] > 0) ? m_slew[channel] * dt : 2 * PID_OUTPUT_LIMIT;
+    *lo = max(power - step, -PID_OUTPUT_LIMIT);
+    *hi = min(power + step, PID_OUTPUT_LIMIT);
+    if(m_dwell[channel] > 0){
+        bool waited = m_zero_ticks[channel] >= m_dwell[channel] * PID_RATE_HZ / 1000;
+        if(power > 0 || (power == 0 && m_last_sign[channel] > 0 && !waited))
+            *lo = max(*lo, 0.0f);
+        if(power < 0 || (power == 0 && m_last_sign[channel] < 0 && !waited))
+            *hi = min(*hi, 0.0f);
+    }
+}
+
+// Keep track of how long the power has been at zero, and which way it was
+// before
+static void trajectory_track(int channel){
+    float power = m_tecs[channel].getPower();
+    if(power != 0){
+        m_zero_ticks[channel] = 0;
+        m_last_sign[channel] = (power > 0) ? 1 : -1;
+    }
+    else if(m_zero_ticks[channel] < UINT32_MAX){
+        m_zero_ticks[channel]++;
+    }
+}
+
+// End an experiment, leaving the power where it started
+static void autotune_finish(int channel, int state){
+    Autotune *a = &m_tune[channel];
+    m_tecs[channel].applyPower(a->bias);
+    m_target[channel] = a->bias;
+    m_mode[channel] = PID_MANUAL;
+    a->pending = (state == AUTOTUNE_DONE);
+    a->state = state;
+}
+
+// One tick of a relay experiment.  The relay pushes the temperature up until
+// it's above the setpoint by the hysteresis, then down until it's below.
+// Each oscillation runs from one switch up to the next; the first is the
+// start-up transient, so it isn't measured.
+static void autotune_step(int channel, float celsius){
+    Autotune *a = &m_tune[channel];
+    a->ticks++;
+    if(fabsf(celsius - a->setpoint) > AUTOTUNE_MAX_DEVIATION){
+        autotune_finish(channel, AUTOTUNE_OUT_OF_RANGE);
+        return;
+    }
+    if(a->ticks > (uint32_t) AUTOTUNE_TIMEOUT_S * PID_RATE_HZ){
+        autotune_finish(channel, AUTOTUNE_TIMED_OUT);
+        return;
+    }
+    if(celsius > a->peak_max)
+        a->peak_max = celsius;
+    if(celsius < a->peak_min)
+        a->peak_min = celsius;
+
+    if(a->relay < 0 && celsius < a->setpoint - AUTOTUNE_HYSTERESIS){
+        a->relay = 1;
+        if(++a->ups > 2){
+            a->sum_period += a->ticks - a->last_up;
+            a->sum_amplitude += (a->peak_max - a->peak_min) / 2;
+            a->cycles++;
+        }
+        a->last_up = a->ticks;
+        a->peak_max = a->peak_min = celsius;
+
+        if(a->cycles >= AUTOTUNE_CYCLES){
+            // The describing function of a relay with hysteresis gives the
+            // ultimate gain from the oscillation's amplitude
+            float amplitude = a->sum_amplitude / a->cycles;
+            float excess = amplitude * amplitude - AUTOTUNE_HYSTERESIS * AUTOTUNE_HYSTERESIS;
+            if(excess <= 0){
+                autotune_finish(channel, AUTOTUNE_NO_OSCILLATION);
+                return;
+            }
+            a->ku = 4 * fabsf(a->step) / ((float) M_PI * sqrtf(excess));
+            a->tu = a->sum_period / a->cycles / PID_RATE_HZ;
+            autotune_finish(channel, AUTOTUNE_DONE);
+            return;
+        }
+    }
+    else if(a->relay > 0 && celsius > a->setpoint + AUTOTUNE_HYSTERESIS){
+        a->relay = -1;
+    }
+    m_tecs[channel].applyPower(a->bias + a->relay * a->step);
+}
+
+// Run every auto mode channel's controller, the manual mode channels'
+// trajectories, and any relay experiments.  The relay needs sharp steps, so
+// it isn't slew limited, or cut back to fit the budget.
+static void control_isr(void){
+    const float dt = 1.0f / PID_RATE_HZ;
+    float request[NUMBER_OF_CHANNELS];  // Power each channel wants
+    float need[NUMBER_OF_CHANNELS];     // Duty above its duty at zero power
+    float grant[NUMBER_OF_CHANNELS];
+    float weight[NUMBER_OF_CHANNELS];
+    float available = m_budget;
+    float wanted = 0;
+    for(int i = 0; i < m_num_tecs; i++){
+        if(m_mode[i] == PID_TUNE){
+            autotune_step(i, channel_celsius(i));
+            request[i] = m_tecs[i].getPower();
+            need[i] = 0;
+            weight[i] = 0;
+            available -= m_tecs[i].dutyPercent(request[i]);
+        }
+        else{
+            float lo, hi;
+            trajectory_limits(i, dt, &lo, &hi);
+            if(m_mode[i] == PID_AUTO)
+                request[i] = pid_update(&m_pid[i], m_setpoint[i], channel_celsius(i), dt, lo, hi);
+            else
+                request[i] = constrain(m_target[i], lo, hi);
+            float idle = m_tecs[i].dutyPercent(0);
+            need[i] = m_tecs[i].dutyPercent(request[i]) - idle;
+            weight[i] = m_priority[i];
+            available -= idle;
+        }
+        wanted += m_tecs[i].dutyPercent(request[i]);
+    }
+    if(m_budget - wanted < m_min_headroom)
+        m_min_headroom = m_budget - wanted;
+
+    // The duty above idle is in proportion to the power, so scale the power
+    // by what's granted.  A cut back controller's integral tracks what's
+    // used, so it doesn't wind up.
+    budget_allocate(need, weight, m_num_tecs, available, grant);
+    for(int i = 0; i < m_num_tecs; i++){
+        // A channel blanked for a Seebeck reading is left alone, and carries
+        // on from where it was once it's released
+        if(m_mode[i] != PID_TUNE && !m_tecs[i].isHeld()){
+            float power = request[i];
+            if(grant[i] < need[i]){
+                power *= grant[i] / need[i];
+                if(m_mode[i] == PID_AUTO)
+                    m_pid[i].integral += power - request[i];
+            }
+            // The first move toward a new target is when the command took
+            // effect
+            if(m_awaiting[i] && m_mode[i] == PID_MANUAL &&
+               (power == m_target[i] ||
+                fabsf(m_target[i] - power) < fabsf(m_target[i] - m_tecs[i].getPower()))){
+                m_awaiting[i] = false;
+                m_actuated[i] = true;
+                m_actuated_us[i] = micros();
+            }
+            if(power != m_tecs[i].getPower())
+                m_tecs[i].applyPower(power);
+        }
+        trajectory_track(i);
+    }
+}
+
+// Start the control timer for the TECs, all in manual mode.
+bool control_begin(ThermoElectricController *tecs, int num_tecs){
+    if(tecs == NULL || num_tecs <= 0 || num_tecs > NUMBER_OF_CHANNELS)
+        return false;
+
+    m_timer.end();
+    for(int i = 0; i < num_tecs; i++){
+        m_mode[i] = PID_MANUAL;
+        m_setpoint[i] = PID_DEFAULT_SETPOINT;
+        m_target[i] = tecs[i].getPower();
+        m_slew[i] = TRAJECTORY_DEFAULT_SLEW;
+        m_dwell[i] = TRAJECTORY_DEFAULT_DWELL;
+        m_zero_ticks[i] = 0;
+        m_last_sign[i] = 0;
+        m_awaiting[i] = false;
+        m_actuated[i] = false;
+        m_priority[i] = BUDGET_DEFAULT_PRIORITY;
+        memset(&m_pid[i], 0, sizeof(m_pid[i]));
+        memset(&m_tune[i], 0, sizeof(m_tune[i]));
+        m_reported_state[i] = AUTOTUNE_IDLE;
+        m_reported_cycles[i] = 0;
+
+        // Use the saved gains, if any
+        SavedGains saved;
+        EEPROM.get(PID_EEPROM_ADDR + i * sizeof(SavedGains), saved);
+        if(saved.valid == 0x01){
+            m_pid[i].kp = saved.kp;
+            m_pid[i].ki = saved.ki;
+            m_pid[i].kd = saved.kd;
+        }
+        else{
+            m_pid[i].kp = PID_DEFAULT_KP;
+            m_pid[i].ki = PID_DEFAULT_KI;
+            m_pid[i].kd = PID_DEFAULT_KD;
+        }
+    }
+    m_tecs = tecs;
+    m_num_tecs = num_tecs;
+    m_timer.priority(PID_TIMER_PRIORITY);
+    return m_timer.begin(control_isr, 1000000.0f / PID_RATE_HZ);
+}
+
+// Switch a channel between manual and auto mode.
+bool control_set_mode(int channel, int mode){
+    if(channel < 0 || channel >= m_num_tecs || mode < 0 || mode >= NUM_PID_MODES)
+        return false;
+    if(mode == PID_TUNE || m_mode[channel] == PID_TUNE)
+        return false;
+    if(mode == PID_AUTO && !m_tecs[channel].hasThermistor())
+        return false;
+    if(mode == m_mode[channel])
+        return true;
+
+    if(mode == PID_AUTO){
+        // Carry on from the present power, without a bump
+        float input = channel_celsius(channel);
+        noInterrupts();
+        pid_reset(&m_pid[channel], m_tecs[channel].getPower(), input,
+                  -PID_OUTPUT_LIMIT, PID_OUTPUT_LIMIT);
+        m_mode[channel] = mode;
+        interrupts();
+    }
+    else{
+        // The power stays where the controller left it
+        noInterrupts();
+        m_target[channel] = m_tecs[channel].getPower();
+        m_mode[channel] = mode;
+        interrupts();
+    }
+    return true;
+}
+
+int control_get_mode(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return -1;
+    return m_mode[channel];
+}
+
+// Power for a manual mode channel to move to.
+bool control_set_target(int channel, float percent){
+    if(channel < 0 || channel >= m_num_tecs || m_mode[channel] != PID_MANUAL)
+        return false;
+    if(!(percent >= -PID_OUTPUT_LIMIT && percent <= PID_OUTPUT_LIMIT))
+        return false;
+    LOG_DEBUG("Channel %d power target %0.2f", channel + 1, percent);
+    noInterrupts();
+    m_target[channel] = percent;
+    m_awaiting[channel] = true;
+    m_actuated[channel] = false;
+    interrupts();
+    return true;
+}
+
+float control_get_target(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return NAN;
+    return m_target[channel];
+}
+
+// When the power first moved toward the last target.
+bool control_take_actuation(int channel, uint32_t *actuated_us){
+    if(channel < 0 || channel >= m_num_tecs)
+        return false;
+    noInterrupts();
+    bool actuated = m_actuated[channel];
+    m_actuated[channel] = false;
+    *actuated_us = m_actuated_us[channel];
+    interrupts();
+    return actuated;
+}
+
+bool control_set_slew(int channel, float percent_per_s){
+    if(channel < 0 || channel >= m_num_tecs || !(percent_per_s >= 0))
+        return false;
+    m_slew[channel] = percent_per_s;
+    return true;
+}
+
+float control_get_slew(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return NAN;
+    return m_slew[channel];
+}
+
+bool control_set_dwell(int channel, uint32_t ms){
+    if(channel < 0 || channel >= m_num_tecs || ms > TRAJECTORY_MAX_DWELL)
+        return false;
+    m_dwell[channel] = ms;
+    return true;
+}
+
+uint32_t control_get_dwell(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return 0;
+    return m_dwell[channel];
+}
+
+bool control_set_budget(float percent){
+    if(!(percent >= 0))
+        return false;
+    m_budget = percent;
+    return true;
+}
+
+float control_get_budget(void){
+    return m_budget;
+}
+
+bool control_set_priority(int channel, float weight){
+    if(channel < 0 || channel >= m_num_tecs || !(weight >= 0))
+        return false;
+    m_priority[channel] = weight;
+    return true;
+}
+
+float control_get_priority(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return NAN;
+    return m_priority[channel];
+}
+
+// Least headroom since the last call.
+float control_take_headroom(void){
+    noInterrupts();
+    float headroom = m_min_headroom;
+    m_min_headroom = INFINITY;
+    interrupts();
+    return isinf(headroom) ? m_budget : headroom;
+}
+
+bool control_set_setpoint(int channel, float celsius){
+    if(channel < 0 || channel >= m_num_tecs || isnan(celsius))
+        return false;
+    noInterrupts();
+    m_setpoint[channel] = celsius;
+    interrupts();
+    return true;
+}
+
+float control_get_setpoint(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return NAN;
+    return m_setpoint[channel];
+}
+
+bool control_set_gains(int channel, float kp, float ki, float kd){
+    if(channel < 0 || channel >= m_num_tecs || isnan(kp) || isnan(ki) || isnan(kd))
+        return false;
+    // Mixed signs would fight each other
+    if((kp > 0 || ki > 0 || kd > 0) && (kp < 0 || ki < 0 || kd < 0))
+        return false;
+    noInterrupts();
+    m_pid[channel].kp = kp;
+    m_pid[channel].ki = ki;
+    m_pid[channel].kd = kd;
+    interrupts();
+    return true;
+}
+
+bool control_get_gains(int channel, float *kp, float *ki, float *kd){
+    if(channel < 0 || channel >= m_num_tecs)
+        return false;
+    noInterrupts();
+    *kp = m_pid[channel].kp;
+    *ki = m_pid[channel].ki;
+    *kd = m_pid[channel].kd;
+    interrupts();
+    return true;
+}
+
+// Save a channel's gains to the EEPROM.
+bool control_save_gains(int channel){
+    SavedGains saved;
+    if(!control_get_gains(channel, &saved.kp, &saved.ki, &saved.kd))
+        return false;
+    saved.valid = 0x01;
+    EEPROM.put(PID_EEPROM_ADDR + channel * sizeof(SavedGains), saved);
+    return true;
+}
+
+// Start a relay experiment around the channel's setpoint.
+bool control_autotune_start(int channel){
+    if(channel < 0 || channel >= m_num_tecs || m_mode[channel] == PID_TUNE)
+        return false;
+    if(!m_tecs[channel].hasThermistor())
+        return false;
+
+    float celsius = channel_celsius(channel);
+    noInterrupts();
+    Autotune *a = &m_tune[channel];
+    memset(a, 0, sizeof(*a));
+    a->prev_mode = m_mode[channel];
+    a->setpoint = m_setpoint[channel];
+    // Negative gains mean positive power cools
+    PidState *pid = &m_pid[channel];
+    a->step = (pid->kp < 0 || pid->ki < 0 || pid->kd < 0) ? -AUTOTUNE_RELAY_STEP : AUTOTUNE_RELAY_STEP;
+    a->bias = constrain(m_tecs[channel].getPower(),
+                        -PID_OUTPUT_LIMIT + AUTOTUNE_RELAY_STEP, PID_OUTPUT_LIMIT - AUTOTUNE_RELAY_STEP);
+    a->relay = (celsius < a->setpoint) ? 1 : -1;
+    a->peak_max = a->peak_min = celsius;
+    a->state = AUTOTUNE_RUNNING;
+    m_mode[channel] = PID_TUNE;
+    interrupts();
+    return true;
+}
+
+// Stop a running experiment.
+void control_autotune_abort(int channel){
+    if(channel < 0 || channel >= m_num_tecs)
+        return;
+    noInterrupts();
+    if(m_mode[channel] == PID_TUNE)
+        autotune_finish(channel, AUTOTUNE_ABORTED);
+    interrupts();
+}
+
+bool control_autotune_status(int channel, AutotuneStatus *status){
+    if(channel < 0 || channel >= m_num_tecs)
+        return false;
+    noInterrupts();
+    status->state = m_tune[channel].state;
+    status->cycles = m_tune[channel].cycles;
+    status->ku = m_tune[channel].ku;
+    status->tu = m_tune[channel].tu;
+    interrupts();
+    return true;
+}
+
+// Finish off any completed experiments from the main loop.
+bool control_service(void){
+    bool changed = false;
+    for(int i = 0; i < m_num_tecs; i++){
+        Autotune *a = &m_tune[i];
+        if(a->pending){
+            a->pending = false;
+            // Tyreus-Luyben: gentler than Ziegler-Nichols, which overshoots
+            // badly on slow thermal loads
+            float sign = (a->step < 0) ? -1 : 1;
+            float kp = sign * a->ku / 2.2f;
+            float ti = 2.2f * a->tu;
+            float td = a->tu / 6.3f;
+            if(control_set_gains(i, kp, kp / ti, kp * td)){
+                control_save_gains(i);
+                LOG_INFO("Channel %d tuned: Ku %.3f, Tu %.1f s", i + 1, a->ku, a->tu);
+            }
+            if(a->prev_mode == PID_AUTO)
+                control_set_mode(i, PID_AUTO);
+        }
+        if(a->state != m_reported_state[i] || a->cycles != m_reported_cycles[i]){
+            m_reported_state[i] = a->state;
+            m_reported_cycles[i] = a->cycles;
+            changed = true;
+        }
+    }
+    return changed;
+}
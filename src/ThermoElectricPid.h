@@ -0,0 +1,188 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPid.h
+ * @brief On-board closed-loop temperature control.  Each channel in auto mode
+ * runs a PID controller on its filtered, calibrated thermistor temperature,
+ * from a timer interrupt at PID_RATE_HZ.  The output is the TEC power in
+ * percent, the same as setPower(), so it's mapped onto the part's duty range
+ * the same way.
+ *
+ * A channel can also run a relay feedback (Astrom-Hagglund) experiment to
+ * find its ultimate gain and period, from which it sets and saves its own
+ * gains.
+ *
+ * In manual mode the power moves to its commanded target at a limited slew
+ * rate, and in both modes it can wait at zero for a while before reversing, to
+ * spare the TECs thermal shock.  Both limits are off by default.
+ *
+ * The sum of the channels' duties is kept within a budget, so the supply
+ * isn't overloaded.  When the channels ask for more, it's shared out between
+ * them by priority.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_PID_H
+#define THERMOELECTRIC_PID_H
+
+#include "ThermoElectricGlobal.h"
+#include "ThermoElectricController.h"
+
+#define PID_RATE_HZ           100
+#define PID_TIMER_PRIORITY    192     // Below the acquisition timer
+#define PID_OUTPUT_LIMIT      100.0f  // Power percent, either direction
+
+#define PID_DEFAULT_SETPOINT  20.0f   // Degrees C
+#define PID_DEFAULT_KP        10.0f   // Percent per degree C, positive power heating
+#define PID_DEFAULT_KI        0.5f    // Percent per degree C second
+#define PID_DEFAULT_KD        0.0f    // Percent second per degree C
+
+#define TRAJECTORY_DEFAULT_SLEW   0.0f    // Power percent per second, 0 for no limit
+#define TRAJECTORY_DEFAULT_DWELL  0       // Milliseconds at zero before reversing
+#define TRAJECTORY_MAX_DWELL      3600000
+
+#define BUDGET_DEFAULT_PERCENT    1200.0f // Sum of the duties, 100 per channel at full
+#define BUDGET_DEFAULT_PRIORITY   1.0f
+
+// Saved gains, clear of the calibration data at the start of the EEPROM
+#define PID_EEPROM_ADDR       512
+
+#define AUTOTUNE_RELAY_STEP       20.0f   // Power percent either side of the starting power
+#define AUTOTUNE_HYSTERESIS       0.05f   // Degrees C either side of the setpoint
+#define AUTOTUNE_MAX_DEVIATION    5.0f    // Give up this many degrees C from the setpoint
+#define AUTOTUNE_CYCLES           3       // Oscillations measured, after the first
+#define AUTOTUNE_TIMEOUT_S        3600
+
+// Control modes.  The values are used in the NCMD metrics, so don't renumber.
+enum PidMode {
+    PID_MANUAL = 0,     // Power set by setPower() commands
+    PID_AUTO,           // Power set by the PID controller
+    PID_TUNE,           // Power set by the auto-tuning relay
+    NUM_PID_MODES
+};
+
+enum AutotuneState {
+    AUTOTUNE_IDLE = 0,
+    AUTOTUNE_RUNNING,
+    AUTOTUNE_DONE,
+    AUTOTUNE_TIMED_OUT,
+    AUTOTUNE_OUT_OF_RANGE,  // Strayed more than AUTOTUNE_MAX_DEVIATION
+    AUTOTUNE_NO_OSCILLATION,
+    AUTOTUNE_ABORTED
+};
+
+typedef struct {
+    int   state;            // AutotuneState
+    int   cycles;           // Oscillations measured so far
+    float ku;               // Ultimate gain, percent per degree C, once done
+    float tu;               // Ultimate period, seconds, once done
+} AutotuneStatus;
+
+typedef struct {
+    float kp;
+    float ki;
+    float kd;
+    float integral;     // Integral term, in output units
+    float last_input;   // For the derivative
+} PidState;
+
+// One step of a PID controller, returning the output limited to out_min to
+// out_max.  The derivative acts on the input rather than the error, so
+// setpoint changes don't kick the output, and the integral stops growing while
+// the output is limited in the direction it would push.
+float pid_update(PidState *pid, float setpoint, float input, float dt, float out_min, float out_max);
+
+// Start a PID controller so that its first output follows on smoothly from
+// the given output and input.
+void pid_reset(PidState *pid, float output, float input, float out_min, float out_max);
+
+// Start the control timer for the TECs, all in manual mode.  The array must
+// stay valid while the timer runs.
+bool control_begin(ThermoElectricController *tecs, int num_tecs);
+
+// Switch a channel between manual and auto mode.  Auto mode needs a
+// thermistor on the channel.  Returns false if the mode can't be used, or the
+// channel is tuning.
+bool control_set_mode(int channel, int mode);
+int  control_get_mode(int channel);
+
+// Power for a manual mode channel to move to, in percent.  Returns false if
+// it's out of range, or the channel isn't in manual mode.
+bool  control_set_target(int channel, float percent);
+float control_get_target(int channel);
+
+// When the control interrupt first moved a manual mode channel's power toward
+// the target last set, or found it already there, in micros().  Returns true
+// once for each target set, after that; false until then.
+bool control_take_actuation(int channel, uint32_t *actuated_us);
+
+// Fastest the power may change, in percent per second, or 0 for no limit.
+bool  control_set_slew(int channel, float percent_per_s);
+float control_get_slew(int channel);
+
+// Time the power waits at zero before changing direction, in milliseconds.
+bool     control_set_dwell(int channel, uint32_t ms);
+uint32_t control_get_dwell(int channel);
+
+// Most of the supply the channels may use together, as the sum of their PWM
+// duties in percent.
+bool  control_set_budget(float percent);
+float control_get_budget(void);
+
+// Share of the budget a channel gets, relative to the others, when they ask
+// for more than it allows.  Channels with 0 get nothing then.
+bool  control_set_priority(int channel, float weight);
+float control_get_priority(int channel);
+
+// Least headroom since the last call: the budget less the sum of the duties
+// the channels asked for, in percent.  Negative if they've been cut back.
+float control_take_headroom(void);
+
+// Setpoint in degrees C.
+bool  control_set_setpoint(int channel, float celsius);
+float control_get_setpoint(int channel);
+
+// Gains, in percent per degree C, per degree C second, and second per degree C.
+// Positive gains suit a TEC that heats the load with positive power; make
+// them all negative for one that cools it.  Returns false if the signs are
+// mixed.
+bool control_set_gains(int channel, float kp, float ki, float kd);
+bool control_get_gains(int channel, float *kp, float *ki, float *kd);
+
+// Save a channel's gains to the EEPROM, to be used from the next reboot.
+bool control_save_gains(int channel);
+
+// Start a relay experiment around the channel's setpoint, stepping the power
+// AUTOTUNE_RELAY_STEP either side of where it is now, in the direction given
+// by the sign of the gains.  Needs a thermistor on the channel.
+bool control_autotune_start(int channel);
+
+// Stop a running experiment and put the power back where it started.
+void control_autotune_abort(int channel);
+
+bool control_autotune_status(int channel, AutotuneStatus *status);
+
+// Finish off any completed experiments from the main loop: set the gains
+// from the results with the Tyreus-Luyben rules, save them, and go back to
+// the mode the channel was in.  Returns true if any channel's experiment has
+// progressed since the last call.
+bool control_service(void);
+
+#endif
@@ -0,0 +1,94 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricProfiler.cpp
+ * @brief Implements the cycle counter profiler.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricProfiler.h"
+
+typedef struct {
+    uint32_t count;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+    uint32_t histogram[PROFILE_HISTOGRAM_BINS];
+} ProbeStats;
+
+/*
+  Private variables
+*/
+static ProbeStats m_probes[NUM_PROFILE_PROBES];
+
+// Start the cycle counter and clear the statistics.
+void profile_begin(void){
+    ARM_DEMCR |= ARM_DEMCR_TRCENA;
+    ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+    for(int i = 0; i < NUM_PROFILE_PROBES; i++)
+        profile_reset(i);
+}
+
+// Add the cycles taken by one call to a probe's statistics.
+void profile_record(int probe, uint32_t cycles){
+    if(probe < 0 || probe >= NUM_PROFILE_PROBES)
+        return;
+    ProbeStats *p = &m_probes[probe];
+    if(p->count == 0 || cycles < p->min_cycles)
+        p->min_cycles = cycles;
+    if(cycles > p->max_cycles)
+        p->max_cycles = cycles;
+    p->total_cycles += cycles;
+    p->count++;
+    // The bin is the position of the highest set bit; zero cycles go in bin 0
+    int bin = cycles ? 31 - __builtin_clz(cycles) : 0;
+    p->histogram[bin]++;
+}
+
+// Describe a probe's statistics since it was last reset.
+bool profile_report(int probe, char *report, size_t size){
+    if(probe < 0 || probe >= NUM_PROFILE_PROBES || size == 0)
+        return false;
+    const ProbeStats *p = &m_probes[probe];
+    if(p->count == 0){
+        report[0] = '\0';
+        return false;
+    }
+
+    float us_per_cycle = 1e6f / F_CPU_ACTUAL;
+    int len = snprintf(report, size, "n %lu, min %.2f, avg %.2f, max %.2f us; log2 cycles",
+                       (unsigned long) p->count,
+                       p->min_cycles * us_per_cycle,
+                       (float) p->total_cycles / p->count * us_per_cycle,
+                       p->max_cycles * us_per_cycle);
+    for(int bin = 0; bin < PROFILE_HISTOGRAM_BINS && len >= 0 && (size_t) len < size; bin++){
+        if(p->histogram[bin] == 0)
+            continue;
+        len += snprintf(report + len, size - len, " %d:%lu", bin, (unsigned long) p->histogram[bin]);
+    }
+    return true;
+}
+
+// Clear a probe's statistics.
+void profile_reset(int probe){
+    if(probe < 0 || probe >= NUM_PROFILE_PROBES)
+        return;
+    memset(&m_probes[probe], 0, sizeof(m_probes[probe]));
+}
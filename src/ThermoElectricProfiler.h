@@ -0,0 +1,75 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricProfiler.h
+ * @brief Lightweight profiler using the Cortex-M7 DWT cycle counter.  A probe
+ * times each call of a function it's placed in, keeping the minimum, average
+ * and maximum, and a histogram of the cycles by power of two.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_PROFILER_H
+#define THERMOELECTRIC_PROFILER_H
+
+#include "ThermoElectricGlobal.h"
+
+#define PROFILE_HISTOGRAM_BINS  32    // Bin n counts calls of 2^n to 2^(n+1)-1 cycles
+#define PROFILE_REPORT_LEN      192   // Longest report string, including the terminator
+
+// The functions with probes.  The values index the Diagnostics/Profile
+// metrics, so keep them in the same order.
+enum ProfileProbe {
+    PROBE_GET_TEMPERATURE = 0,
+    PROBE_GET_SEEBECK,
+    PROBE_PUBLISH_DATA,
+    PROBE_PUBLISH_NODE_DATA,
+    PROBE_ENCODE,
+    PROBE_CHECK_BROKERS,
+    NUM_PROFILE_PROBES
+};
+
+// Start the cycle counter and clear the statistics.
+void profile_begin(void);
+
+// Add the cycles taken by one call to a probe's statistics.
+void profile_record(int probe, uint32_t cycles);
+
+// Describe a probe's statistics since it was last reset, in microseconds, with
+// the non-empty histogram bins as log2(cycles):calls.  Returns false if the
+// probe hasn't been called.
+bool profile_report(int probe, char *report, size_t size);
+
+// Clear a probe's statistics.
+void profile_reset(int probe);
+
+// Times the scope it's declared in, from the declaration to the end of the
+// scope.  Only use this from the main loop, not from interrupts.
+class ProfileScope {
+public:
+    explicit ProfileScope(int probe) : probe(probe), start(ARM_DWT_CYCCNT) {}
+    ~ProfileScope() { profile_record(probe, ARM_DWT_CYCCNT - start); }
+private:
+    int      probe;
+    uint32_t start;
+};
+
+#define PROFILE_SCOPE(probe)  ProfileScope profile_scope_(probe)
+
+#endif
@@ -0,0 +1,624 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPwm.cpp
+ * @brief Implements the FlexPWM access and PWM-synchronized Seebeck sampling.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricPwm.h"
+#include "ThermoElectricPwmPlan.h"
+#include "ThermoElectricAcquisition.h"
+
+// FlexPWM outputs of a submodule
+#define PWM_OUT_X  0
+#define PWM_OUT_A  1
+#define PWM_OUT_B  2
+
+// XBAR1 signal numbers (i.MX RT1060 reference manual, XBAR1 signal
+// assignments)
+#define XBAR_IN_FLEXPWM_TRIG(module, sm)  (40 + 4 * ((module) - 1) + (sm))
+#define XBAR_OUT_ADC_ETC_TRIG(trig)       (103 + (trig))
+
+// The ADC_ETC trigger used for synchronized conversions on each ADC.  The
+// acquisition scan uses triggers 0 and 4.
+static const int m_sync_trigger[ACQ_NUM_ADCS] = {1, 5};
+#define SYNC_DONE1_FLAGS  ((1 << (16 + 1)) | (1 << (16 + 5)))
+
+// FlexPWM submodule and output driving each Teensy PWM pin, or module 0 for
+// pins driven by a QuadTimer1 channel, given as the submodule (from the
+// Teensy 4.1 core pwm.c).
+typedef struct {
+    uint8_t module;
+    uint8_t submodule;
+    uint8_t output;
+} PwmPinInfo;
+
+static const PwmPinInfo pwm_pins[] = {
+    {1, 1, PWM_OUT_X},  // 0
+    {1, 0, PWM_OUT_X},  // 1
+    {4, 2, PWM_OUT_A},  // 2
+    {4, 2, PWM_OUT_B},  // 3
+    {2, 0, PWM_OUT_A},  // 4
+    {2, 1, PWM_OUT_A},  // 5
+    {2, 2, PWM_OUT_A},  // 6
+    {1, 3, PWM_OUT_B},  // 7
+    {1, 3, PWM_OUT_A},  // 8
+    {2, 2, PWM_OUT_B},  // 9
+    {0, 0, 0},          // 10, QuadTimer1 channel 0
+    {0, 2, 0},          // 11, QuadTimer1 channel 2
+};
+
+#define NUM_PWM_PINS  ((int) (sizeof(pwm_pins) / sizeof(pwm_pins[0])))
+
+static IMXRT_FLEXPWM_t * const flexpwm[] = {
+    NULL, &IMXRT_FLEXPWM1, &IMXRT_FLEXPWM2, &IMXRT_FLEXPWM3, &IMXRT_FLEXPWM4
+};
+
+// Duty of an output driven by pwm_output_write()
+typedef struct {
+    bool     enabled;
+    uint32_t period;    // Counts per PWM period
+    uint32_t duty;      // PWM_DUTY_ONE is always on
+    uint32_t residue;   // Fraction of a count carried to the next step, 16 bits
+    uint32_t count;     // Count in the compare register
+    uint32_t start;     // Count at which A and B outputs switch on
+    uint32_t burst_duty;    // Burst mode below this duty, or 0
+    uint32_t burst_steps;   // Dither steps per burst slot
+    uint32_t burst_left;    // Dither steps left in this slot
+    uint32_t burst_acc;     // Pulse-density accumulator, in duty units
+    bool     burst_on;      // This slot is on
+} PwmOutput;
+
+// Synchronized sampling set up for one channel
+typedef struct {
+    bool     usable;
+    uint8_t  module;
+    uint8_t  submodule;
+    uint8_t  trigger_val;   // Free VALn register used as the trigger compare
+    int      adc;           // 0 = ADC1, 1 = ADC2
+    int      adc_input;
+} SyncChannel;
+
+/*
+  Private variables
+*/
+static SyncChannel m_channels[NUMBER_OF_CHANNELS];
+static int m_num_channels = 0;
+
+// Rotation state, owned by the ADC_ETC interrupt once started
+static volatile int m_active = -1;      // Channel being sampled, or -1
+static uint32_t m_accum        = 0;
+static int      m_accum_count  = 0;
+static uint32_t m_active_since = 0;
+
+// Latest complete reading of each channel
+static uint32_t m_sum[NUMBER_OF_CHANNELS];
+static uint32_t m_time[NUMBER_OF_CHANNELS];
+static bool     m_valid[NUMBER_OF_CHANNELS];
+
+// Outputs, by pin, and their dithering
+static PwmOutput     m_outputs[NUM_PWM_PINS];
+static bool          m_dither = true;
+static bool          m_ditherRunning = false;
+static IntervalTimer m_ditherTimer;
+
+// Phase staggering of the FlexPWM outputs that have the same period
+static int      m_stagger = PWM_STAGGER_PLANNED;
+static uint32_t m_staggerPeriod = 0;    // 0 until pwm_stagger_begin()
+
+// Connect an XBAR1 input to an XBAR1 output
+static void xbar_connect(unsigned int input, unsigned int output){
+    volatile uint16_t *xbar = &XBARA1_SEL0 + (output / 2);
+    uint16_t val = *xbar;
+    if(!(output & 1))
+        val = (val & 0xFF00) | input;
+    else
+        val = (val & 0x00FF) | (input << 8);
+    *xbar = val;
+}
+
+// Access a submodule VALn register by number
+static volatile uint16_t * val_register(IMXRT_FLEXPWM_t *p, int sm, int n){
+    volatile uint16_t *val[] = {
+        &p->SM[sm].VAL0, &p->SM[sm].VAL1, &p->SM[sm].VAL2,
+        &p->SM[sm].VAL3, &p->SM[sm].VAL4, &p->SM[sm].VAL5
+    };
+    return val[n];
+}
+
+// Work out when the enabled outputs of a submodule are on, from its registers
+static int submodule_timeline(IMXRT_FLEXPWM_t *p, int sm, uint32_t period, PwmInterval *on){
+    int num_on = 0;
+    uint16_t outen = p->OUTEN;
+    if(outen & FLEXPWM_OUTEN_PWMX_EN(1 << sm)){
+        // X is on from VAL0 to the end of the period
+        uint32_t val0 = p->SM[sm].VAL0;
+        on[num_on].start  = (val0 + 1) % period;
+        on[num_on].length = (val0 < period - 1) ? period - 1 - val0 : 0;
+        num_on++;
+    }
+    if(outen & FLEXPWM_OUTEN_PWMA_EN(1 << sm)){
+        uint32_t on_at = p->SM[sm].VAL2, off_at = p->SM[sm].VAL3;
+        on[num_on].start  = on_at;
+        on[num_on].length = (off_at > on_at) ? min(off_at - on_at, period) : 0;
+        num_on++;
+    }
+    if(outen & FLEXPWM_OUTEN_PWMB_EN(1 << sm)){
+        uint32_t on_at = p->SM[sm].VAL4, off_at = p->SM[sm].VAL5;
+        on[num_on].start  = on_at;
+        on[num_on].length = (off_at > on_at) ? min(off_at - on_at, period) : 0;
+        num_on++;
+    }
+    return num_on;
+}
+
+// Convert nanoseconds to ticks of a submodule's counter
+static uint32_t ns_to_ticks(IMXRT_FLEXPWM_t *p, int sm, uint32_t ns){
+    uint32_t prescale = (p->SM[sm].CTRL >> 4) & 0x7;
+    return (uint32_t) ((uint64_t) ns * (F_BUS_ACTUAL / 1000000) / 1000) >> prescale;
+}
+
+// Plan the trigger for a channel from the current duty cycles and load it.
+// Returns false if the channel has no usable off-phase right now.
+static bool program_trigger(int ch){
+    SyncChannel *c = &m_channels[ch];
+    IMXRT_FLEXPWM_t *p = flexpwm[c->module];
+    int sm = c->submodule;
+
+    uint32_t period = (uint32_t) p->SM[sm].VAL1 + 1;
+    PwmInterval on[3];
+    int num_on = submodule_timeline(p, sm, period, on);
+    uint32_t trigger;
+    if(!plan_offphase_trigger(on, num_on, period,
+                              ns_to_ticks(p, sm, PWM_SYNC_SETTLE_NS),
+                              ns_to_ticks(p, sm, PWM_SYNC_WINDOW_NS), &trigger))
+        return false;
+
+    volatile uint16_t *val = val_register(p, sm, c->trigger_val);
+    if(*val != trigger){
+        p->MCTRL |= FLEXPWM_MCTRL_CLDOK(1 << sm);
+        *val = trigger;
+        p->MCTRL |= FLEXPWM_MCTRL_LDOK(1 << sm);
+    }
+    return true;
+}
+
+// Stop the trigger of the active channel
+static void stop_active(void){
+    if(m_active < 0)
+        return;
+    SyncChannel *c = &m_channels[m_active];
+    flexpwm[c->module]->SM[c->submodule].TCTRL = 0;
+    ADC_ETC_CTRL &= ~ADC_ETC_CTRL_TRIG_ENABLE(1 << m_sync_trigger[c->adc]);
+    m_active = -1;
+}
+
+// Start sampling the first channel at or after the given one that currently
+// has a usable off-phase
+static void start_next(int first){
+    stop_active();
+    for(int i = 0; i < m_num_channels; i++){
+        int ch = (first + i) % m_num_channels;
+        SyncChannel *c = &m_channels[ch];
+        if(!c->usable || !program_trigger(ch))
+            continue;
+
+        // Route this submodule's output trigger to the ADC's sync trigger,
+        // which converts this channel's input
+        int trig = m_sync_trigger[c->adc];
+        volatile uint32_t *chain = (c->adc == 0) ? &ADC_ETC_TRIG1_CHAIN_1_0 : &ADC_ETC_TRIG5_CHAIN_1_0;
+        *chain = ADC_ETC_TRIG_CHAIN_CSEL0(c->adc_input) |
+                 ADC_ETC_TRIG_CHAIN_HWTS0(1 << ACQ_SYNC_HC) |
+                 ADC_ETC_TRIG_CHAIN_IE0(2);
+        xbar_connect(XBAR_IN_FLEXPWM_TRIG(c->module, c->submodule), XBAR_OUT_ADC_ETC_TRIG(trig));
+        flexpwm[c->module]->SM[c->submodule].TCTRL = FLEXPWM_SMTCTRL_OUT_TRIG_EN(1 << c->trigger_val);
+        ADC_ETC_CTRL |= ADC_ETC_CTRL_TRIG_ENABLE(1 << trig);
+
+        // The first conversion may use the previous trigger value, so skip it
+        m_accum = 0;
+        m_accum_count = -1;
+        m_active_since = millis();
+        m_active = ch;
+        return;
+    }
+}
+
+// ADC_ETC done interrupt: one synchronized conversion has finished
+static void pwm_sync_isr(void){
+    ADC_ETC_DONE0_1_IRQ = SYNC_DONE1_FLAGS;  // write 1 to clear
+    int ch = m_active;
+    if(ch < 0)
+        return;
+
+    SyncChannel *c = &m_channels[ch];
+    uint32_t result = ((c->adc == 0) ? ADC_ETC_TRIG1_RESULT_1_0 : ADC_ETC_TRIG5_RESULT_1_0) & 0xFFF;
+    if(m_accum_count >= 0)
+        m_accum += result;
+    if(++m_accum_count >= ACQ_AVERAGE_SAMPLES){
+        m_sum[ch] = m_accum;
+        m_time[ch] = millis();
+        m_valid[ch] = true;
+        start_next(ch + 1);
+    }
+    else if(!program_trigger(ch)){
+        // The duty cycle changed and there's no longer room to sample
+        start_next(ch + 1);
+    }
+}
+
+// Write a count to the compare registers of a pin, the same way as the
+// core's analogWrite(), so the output is on for count of the period's counts.
+// A and B outputs switch on at their start count, or earlier if the count
+// wouldn't fit in the rest of the period.  The count must be less than the
+// period.
+static void write_count(int pin, uint32_t count, uint32_t period){
+    const PwmPinInfo *info = &pwm_pins[pin];
+    uint32_t start = min(m_outputs[pin].start, period - 1 - count);
+    if(info->module == 0){
+        // On for count, then off for the rest of the period
+        IMXRT_TMR_CH_t *ch = &IMXRT_TMR1.CH[info->submodule];
+        ch->LOAD = 65537 - (period - count);
+        ch->CMPLD1 = count;
+        return;
+    }
+    IMXRT_FLEXPWM_t *p = flexpwm[info->module];
+    int sm = info->submodule;
+    p->MCTRL |= FLEXPWM_MCTRL_CLDOK(1 << sm);
+    switch(info->output){
+    case PWM_OUT_X:
+        p->SM[sm].VAL0 = period - 1 - count;
+        break;
+    case PWM_OUT_A:
+        p->SM[sm].VAL2 = start;
+        p->SM[sm].VAL3 = start + count;
+        break;
+    case PWM_OUT_B:
+        p->SM[sm].VAL4 = start;
+        p->SM[sm].VAL5 = start + count;
+        break;
+    }
+    p->MCTRL |= FLEXPWM_MCTRL_LDOK(1 << sm);
+}
+
+// One step of an output's sigma-delta modulator, or rounding if dithering is
+// off.  Only writes the hardware if the count changes.
+static void output_step(int pin){
+    PwmOutput *o = &m_outputs[pin];
+    uint32_t duty = o->duty;
+    if(duty < o->burst_duty)
+        duty = o->burst_on ? o->burst_duty : 0;
+    uint64_t counts = (uint64_t) duty * o->period;      // 16 fraction bits
+    uint32_t count;
+    if(m_dither){
+        counts += o->residue;
+        count = (uint32_t) (counts >> 16);
+        o->residue = (uint32_t) counts & 0xFFFF;
+    }
+    else{
+        count = (uint32_t) ((counts + 0x8000) >> 16);
+        o->residue = 0;
+    }
+    // Like analogWrite(), full power leaves a count off
+    if(count > o->period - 1){
+        count = o->period - 1;
+        o->residue = 0;
+    }
+    if(count != o->count){
+        o->count = count;
+        write_count(pin, count, o->period);
+    }
+}
+
+// Decide whether the next burst slot is on: first-order pulse-density
+// modulation between off and the burst duty.
+static void burst_step(PwmOutput *o){
+    if(o->burst_left > 1){
+        o->burst_left--;
+        return;
+    }
+    o->burst_left = o->burst_steps;
+    if(o->duty == 0 || o->duty >= o->burst_duty){
+        o->burst_acc = 0;
+        o->burst_on = false;
+        return;
+    }
+    o->burst_acc += o->duty;
+    o->burst_on = (o->burst_acc >= o->burst_duty);
+    if(o->burst_on)
+        o->burst_acc -= o->burst_duty;
+}
+
+// Dither timer: step every output
+static void pwm_dither_isr(void){
+    for(int pin = 0; pin < NUM_PWM_PINS; pin++){
+        PwmOutput *o = &m_outputs[pin];
+        if(!o->enabled)
+            continue;
+        // Keep the register writes together, as the sync interrupt also
+        // loads the FlexPWM registers
+        noInterrupts();
+        if(o->burst_duty != 0)
+            burst_step(o);
+        output_step(pin);
+        interrupts();
+    }
+}
+
+// Drive a PWM pin at the given frequency.
+bool pwm_output_begin(int pin, float frequency){
+    if(pin < 0 || pin >= NUM_PWM_PINS)
+        return false;
+
+    // Let the core set up the timer and the pin, then read back the period
+    analogWriteFrequency(pin, frequency);
+    analogWrite(pin, 0);
+    PwmOutput *o = &m_outputs[pin];
+    const PwmPinInfo *info = &pwm_pins[pin];
+    if(info->module == 0){
+        IMXRT_TMR_CH_t *ch = &IMXRT_TMR1.CH[info->submodule];
+        o->period = 65537 - ch->LOAD + ch->CMPLD1;
+    }
+    else{
+        o->period = (uint32_t) flexpwm[info->module]->SM[info->submodule].VAL1 + 1;
+    }
+    o->duty = 0;
+    o->residue = 0;
+    o->count = 0;
+    o->start = 0;
+    o->burst_duty = 0;
+    write_count(pin, 0, o->period);
+    o->enabled = true;
+
+    if(!m_ditherRunning){
+        m_ditherTimer.priority(PWM_DITHER_PRIORITY);
+        m_ditherRunning = m_ditherTimer.begin(pwm_dither_isr, 1000000.0f / PWM_DITHER_RATE_HZ);
+    }
+    return true;
+}
+
+// Set the duty of a pin, from 0 to PWM_DUTY_ONE.
+void pwm_output_write(int pin, uint32_t duty){
+    if(pin < 0 || pin >= NUM_PWM_PINS || !m_outputs[pin].enabled)
+        return;
+    m_outputs[pin].duty = min(duty, (uint32_t) PWM_DUTY_ONE);
+    // Take effect now rather than at the next dither step, so the drive can
+    // be switched off for a Seebeck measurement
+    output_step(pin);
+}
+
+// Switch a pin between off and min_duty below min_duty.
+void pwm_output_burst(int pin, uint32_t min_duty, uint32_t slot_ms){
+    if(pin < 0 || pin >= NUM_PWM_PINS || !m_outputs[pin].enabled)
+        return;
+    PwmOutput *o = &m_outputs[pin];
+    noInterrupts();
+    o->burst_duty = min(min_duty, (uint32_t) PWM_DUTY_ONE);
+    o->burst_steps = max(slot_ms * PWM_DITHER_RATE_HZ / 1000, (uint32_t) 1);
+    o->burst_left = o->burst_steps;
+    o->burst_acc = 0;
+    o->burst_on = false;
+    output_step(pin);
+    interrupts();
+}
+
+void pwm_set_dither(bool on){
+    m_dither = on;
+}
+
+bool pwm_get_dither(void){
+    return m_dither;
+}
+
+// Restart the counters of the FlexPWM outputs together.
+bool pwm_stagger_begin(void){
+    // Only outputs with the same period as the first FlexPWM output are
+    // staggered
+    m_staggerPeriod = 0;
+    for(int pin = 0; pin < NUM_PWM_PINS && m_staggerPeriod == 0; pin++){
+        if(m_outputs[pin].enabled && pwm_pins[pin].module != 0)
+            m_staggerPeriod = m_outputs[pin].period;
+    }
+    if(m_staggerPeriod == 0)
+        return false;
+
+    // The submodules share a clock, so once their counters are restarted
+    // together they stay together.  A FORCE event with FRCEN set reloads a
+    // counter; each submodule's is a few bus cycles after the last.
+    volatile uint16_t *ctrl2[NUM_PWM_PINS];
+    int num = 0;
+    for(int pin = 0; pin < NUM_PWM_PINS; pin++){
+        const PwmPinInfo *info = &pwm_pins[pin];
+        if(!m_outputs[pin].enabled || info->module == 0 || m_outputs[pin].period != m_staggerPeriod)
+            continue;
+        volatile uint16_t *c = &flexpwm[info->module]->SM[info->submodule].CTRL2;
+        bool seen = false;
+        for(int i = 0; i < num; i++)
+            seen |= (ctrl2[i] == c);
+        if(!seen)
+            ctrl2[num++] = c;
+    }
+    noInterrupts();
+    for(int i = 0; i < num; i++)
+        *ctrl2[i] |= FLEXPWM_SMCTRL2_FRCEN;
+    for(int i = 0; i < num; i++)
+        *ctrl2[i] |= FLEXPWM_SMCTRL2_FORCE;
+    for(int i = 0; i < num; i++)
+        *ctrl2[i] &= ~FLEXPWM_SMCTRL2_FRCEN;
+    interrupts();
+
+    pwm_stagger_service();
+    return true;
+}
+
+bool pwm_set_stagger(int mode){
+    if(mode < 0 || mode >= NUM_PWM_STAGGER_MODES)
+        return false;
+    m_stagger = mode;
+    pwm_stagger_service();
+    return true;
+}
+
+int pwm_get_stagger(void){
+    return m_stagger;
+}
+
+// Restagger the outputs for their current duties.
+int pwm_stagger_service(void){
+    if(m_staggerPeriod == 0)
+        return 0;
+
+    // The on-time of each output, at the longest the dither or the burst
+    // mode makes it.  X outputs are on at the end of the period, the others
+    // can be moved.  QuadTimer outputs run from their own counters, so they
+    // can't be placed against the others.
+    PwmPhase phases[NUM_PWM_PINS];
+    int pins[NUM_PWM_PINS];
+    int num = 0;
+    for(int pin = 0; pin < NUM_PWM_PINS; pin++){
+        PwmOutput *o = &m_outputs[pin];
+        if(!o->enabled || pwm_pins[pin].module == 0 || o->period != m_staggerPeriod)
+            continue;
+        noInterrupts();
+        uint32_t duty = o->duty;
+        if(duty != 0 && duty < o->burst_duty)
+            duty = o->burst_duty;
+        uint32_t start = o->start;
+        interrupts();
+        uint32_t length = min((uint32_t) (((uint64_t) duty * o->period + 0xFFFF) >> 16), o->period - 1);
+        phases[num].movable = (pwm_pins[pin].output != PWM_OUT_X);
+        phases[num].on.length = length;
+        phases[num].on.start = phases[num].movable ? start : o->period - length;
+        pins[num++] = pin;
+    }
+    int peak = plan_phases(phases, num, m_staggerPeriod, m_stagger);
+
+    // Load the new starts.  Restart the active synchronized reading if any
+    // moved, as its trigger may now be in an on-phase.
+    bool moved = false;
+    noInterrupts();
+    for(int i = 0; i < num; i++){
+        PwmOutput *o = &m_outputs[pins[i]];
+        if(!phases[i].movable || phases[i].on.start == o->start)
+            continue;
+        o->start = phases[i].on.start;
+        write_count(pins[i], o->count, o->period);
+        moved = true;
+    }
+    if(moved && m_active >= 0)
+        start_next(m_active);
+    interrupts();
+    return peak;
+}
+
+// Start sampling the given channels in the off-phase of their PWM.
+bool pwm_sync_begin(const int *pwm_pins_in, const int *adc_pins, const bool *enabled,
+                    int num_channels){
+    if(num_channels <= 0 || num_channels > NUMBER_OF_CHANNELS)
+        return false;
+
+    // Work out which outputs of each submodule are in use, so a free VALn
+    // register can be used for the trigger
+    uint8_t outputs_used[5][4] = {{0}};
+    for(int ch = 0; ch < num_channels; ch++){
+        int pin = pwm_pins_in[ch];
+        if(pin >= 0 && pin < NUM_PWM_PINS && pwm_pins[pin].module != 0)
+            outputs_used[pwm_pins[pin].module][pwm_pins[pin].submodule] |= 1 << pwm_pins[pin].output;
+    }
+
+    bool any_usable = false;
+    for(int ch = 0; ch < num_channels; ch++){
+        SyncChannel *c = &m_channels[ch];
+        int pin = pwm_pins_in[ch];
+        c->usable = false;
+        m_valid[ch] = false;
+        if(!enabled[ch] || pin < 0 || pin >= NUM_PWM_PINS || pwm_pins[pin].module == 0)
+            continue;
+
+        c->module = pwm_pins[pin].module;
+        c->submodule = pwm_pins[pin].submodule;
+        uint8_t used = outputs_used[c->module][c->submodule];
+        if(!(used & (1 << PWM_OUT_X)))
+            c->trigger_val = 0;
+        else if(!(used & (1 << PWM_OUT_B)))
+            c->trigger_val = 4;
+        else if(!(used & (1 << PWM_OUT_A)))
+            c->trigger_val = 2;
+        else
+            continue;
+
+        c->adc = -1;
+        for(int adc = ACQ_NUM_ADCS - 1; adc >= 0 && c->adc < 0; adc--){
+            c->adc_input = acquisition_adc_input(adc_pins[ch], adc);
+            if(c->adc_input >= 0)
+                c->adc = adc;
+        }
+        if(c->adc < 0)
+            continue;
+
+        c->usable = true;
+        any_usable = true;
+    }
+    m_num_channels = num_channels;
+    if(!any_usable)
+        return false;
+
+    // Enable the crossbar, and set up the sync triggers as single hardware
+    // triggered conversions using the spare ADC control register
+    CCM_CCGR2 |= CCM_CCGR2_XBAR1(CCM_CCGR_ON);
+    (&ADC1_HC0)[ACQ_SYNC_HC] = ADC_HC_ADCH(ACQ_ADC_ETC_INPUT);
+    (&ADC2_HC0)[ACQ_SYNC_HC] = ADC_HC_ADCH(ACQ_ADC_ETC_INPUT);
+    ADC_ETC_TRIG1_CTRL = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(0) | ADC_ETC_TRIG_CTRL_TRIG_PRIORITY(7);
+    ADC_ETC_TRIG5_CTRL = ADC_ETC_TRIG_CTRL_TRIG_CHAIN(0) | ADC_ETC_TRIG_CTRL_TRIG_PRIORITY(7);
+    ADC_ETC_DONE0_1_IRQ = SYNC_DONE1_FLAGS;
+    attachInterruptVector(IRQ_ADC_ETC1, pwm_sync_isr);
+    NVIC_ENABLE_IRQ(IRQ_ADC_ETC1);
+
+    pwm_sync_service();
+    return true;
+}
+
+// Restart the rotation if it has stopped, or if the active channel's trigger
+// has stopped firing.
+void pwm_sync_service(void){
+    noInterrupts();
+    if(m_active < 0)
+        start_next(0);
+    else if(millis() - m_active_since > PWM_SYNC_MAX_AGE_MS)
+        start_next(m_active + 1);
+    interrupts();
+}
+
+// Sum of the latest ACQ_AVERAGE_SAMPLES synchronized samples of a channel.
+bool pwm_sync_read_sum(int channel, uint32_t max_age_ms, uint32_t *sum){
+    if(channel < 0 || channel >= m_num_channels)
+        return false;
+
+    noInterrupts();
+    bool valid = m_valid[channel];
+    uint32_t time = m_time[channel];
+    uint32_t total = m_sum[channel];
+    interrupts();
+
+    if(!valid || millis() - time > max_age_ms)
+        return false;
+    *sum = total;
+    return true;
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPwm.h
+ * @brief Direct access to the FlexPWM hardware behind the TEC PWM pins.
+ * Duties are written straight to the compare registers, using every count of
+ * the PWM period rather than analogWrite()'s 8 bits, and can be dithered
+ * with a sigma-delta modulator so the average duty has 16 bits.  The outputs'
+ * on-times are staggered through the period, so the TECs don't all switch on
+ * together, which lowers the peak supply current and the switching noise.
+ *
+ * Seebeck channels are sampled in the off-phase of their own PWM: the FlexPWM
+ * submodule raises an output trigger, routed through XBAR1 to the ADC_ETC,
+ * so the voltage can be measured without switching the drive off.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_PWM_H
+#define THERMOELECTRIC_PWM_H
+
+#include "ThermoElectricGlobal.h"
+#include "ThermoElectricPwmPlan.h"
+
+#define PWM_SYNC_SETTLE_NS    2000  // Wait after the drive switches off
+#define PWM_SYNC_WINDOW_NS    3000  // Trigger latency plus one conversion
+#define PWM_SYNC_MAX_AGE_MS   100   // Oldest synchronized reading still used
+
+#define PWM_DUTY_ONE          65536 // Always on, for pwm_output_write()
+#define PWM_DITHER_RATE_HZ    1000  // Sigma-delta steps of each output
+#define PWM_DITHER_PRIORITY   192   // Below the acquisition timer
+
+// Drive a PWM pin at the given frequency, with the duty set by
+// pwm_output_write().  Returns false if the pin has no PWM timer.
+bool pwm_output_begin(int pin, float frequency);
+
+// Set the duty of a pin, from 0 to PWM_DUTY_ONE.  With dithering on, the
+// output alternates between the two nearest counts so that the average is
+// exact; otherwise it uses the nearest count.  Not reentrant; the caller
+// disables interrupts if the control interrupt could also write the pin.
+void pwm_output_write(int pin, uint32_t duty);
+
+// For outputs that can't run at low duties: below min_duty, switch the pin
+// between off and min_duty for whole slots of slot_ms, with the density of
+// the on slots giving the average duty.  A min_duty of 0 turns this off.
+void pwm_output_burst(int pin, uint32_t min_duty, uint32_t slot_ms);
+
+// Turn the sigma-delta dithering of all the outputs on or off.
+void pwm_set_dither(bool on);
+bool pwm_get_dither(void);
+
+// Restart the counters of the FlexPWM outputs together, so they stay in step
+// and their phases can be staggered.  Call once all the outputs have begun.
+// Returns false if there are no FlexPWM outputs.
+bool pwm_stagger_begin(void);
+
+// Choose how the outputs' phases are staggered (PwmStagger) and restagger
+// them.  Returns false for an unknown mode.
+bool pwm_set_stagger(int mode);
+int  pwm_get_stagger(void);
+
+// Restagger the outputs for their current duties, returning the most outputs
+// on at once.  Call this regularly from the main loop.
+int pwm_stagger_service(void);
+
+// Start sampling the given channels in the off-phase of their PWM.  Each
+// channel has a PWM pin and an analog pin; channels that aren't enabled, or
+// whose PWM pin isn't on a FlexPWM submodule, are skipped.  Must be called
+// after acquisition_begin().
+bool pwm_sync_begin(const int *pwm_pins, const int *adc_pins, const bool *enabled,
+                    int num_channels);
+
+// Restart the rotation through the channels if it has stopped because no
+// channel had a long enough off-phase, or move on if the active channel's
+// trigger has stopped firing.  Call this regularly from the main loop.
+void pwm_sync_service(void);
+
+// Sum of the latest ACQ_AVERAGE_SAMPLES synchronized samples of a channel.
+// Returns false if there is no reading newer than max_age_ms.
+bool pwm_sync_read_sum(int channel, uint32_t max_age_ms, uint32_t *sum);
+
+#endif
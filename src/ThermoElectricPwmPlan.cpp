@@ -0,0 +1,325 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPwmPlan.cpp
+ * @brief Implements the PWM timing calculations.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricPwmPlan.h"
+
+// Ticks from a to b going forward around the period
+static uint32_t ticks_between(uint32_t a, uint32_t b, uint32_t period){
+    return (b + period - a) % period;
+}
+
+// True if tick t is inside the on interval
+static bool tick_is_on(const PwmInterval *on, uint32_t t, uint32_t period){
+    return on->length >= period || ticks_between(on->start, t, period) < on->length;
+}
+
+// Find the tick at which to trigger an ADC conversion so that it lands in the
+// off-phase of every output sharing the PWM counter.
+bool plan_offphase_trigger(const PwmInterval *on, int num_on, uint32_t period,
+                           uint32_t settle, uint32_t window, uint32_t *trigger){
+    if(period == 0 || settle + window > period)
+        return false;
+
+    // Each off-phase starts where an output switches off and no other output
+    // is still on.  It lasts until the next output switches on.
+    bool found = false;
+    bool any_on = false;
+    uint32_t best_gap = 0;
+    uint32_t best_start = 0;
+    for(int i = 0; i < num_on; i++){
+        if(on[i].length == 0)
+            continue;
+        any_on = true;
+        if(on[i].length >= period)
+            return false;
+
+        uint32_t gap_start = (on[i].start + on[i].length) % period;
+        bool covered = false;
+        uint32_t gap = period;
+        for(int j = 0; j < num_on; j++){
+            if(on[j].length == 0)
+                continue;
+            if(j != i && tick_is_on(&on[j], gap_start, period)){
+                covered = true;
+                break;
+            }
+            uint32_t to_next = ticks_between(gap_start, on[j].start, period);
+            if(to_next < gap)
+                gap = to_next;
+        }
+        if(covered)
+            continue;
+        if(!found || gap > best_gap){
+            found = true;
+            best_gap = gap;
+            best_start = gap_start;
+        }
+    }
+
+    if(!any_on){
+        // Everything is off - any time will do
+        *trigger = settle;
+        return true;
+    }
+    if(!found || best_gap < settle + window)
+        return false;
+
+    *trigger = (best_start + settle) % period;
+    return true;
+}
+
+// Ticks that [a, a + a_len) and [b, b + b_len) have in common, neither wrapping
+static uint32_t overlap(uint32_t a, uint32_t a_len, uint32_t b, uint32_t b_len){
+    uint32_t first = (a > b) ? a : b;
+    uint32_t last = (a + a_len < b + b_len) ? a + a_len : b + b_len;
+    return (last > first) ? last - first : 0;
+}
+
+// Number of the placed outputs on at tick t
+static int count_on(const PwmPhase *outputs, const bool *placed, int num,
+                    uint32_t t, uint32_t period){
+    int n = 0;
+    for(int i = 0; i < num; i++){
+        if(placed[i] && outputs[i].on.length > 0 && tick_is_on(&outputs[i].on, t, period))
+            n++;
+    }
+    return n;
+}
+
+// Most placed outputs on at once, and the total of their on time, between
+// start and start + length.  The count can only go up where an output
+// switches on, so it's enough to look at those ticks.
+static void window_load(const PwmPhase *outputs, const bool *placed, int num,
+                        uint32_t start, uint32_t length, uint32_t period,
+                        int *peak, uint32_t *area){
+    *peak = count_on(outputs, placed, num, start, period);
+    *area = 0;
+    for(int i = 0; i < num; i++){
+        const PwmInterval *on = &outputs[i].on;
+        if(!placed[i] || on->length == 0)
+            continue;
+        if(ticks_between(start, on->start, period) < length){
+            int n = count_on(outputs, placed, num, on->start, period);
+            if(n > *peak)
+                *peak = n;
+        }
+        // The interval may wrap past the end of the period, the window can't
+        if(on->start + on->length <= period){
+            *area += overlap(start, length, on->start, on->length);
+        }
+        else{
+            *area += overlap(start, length, on->start, period - on->start);
+            *area += overlap(start, length, 0, on->start + on->length - period);
+        }
+    }
+}
+
+// True if two on intervals share any tick
+static bool intervals_overlap(const PwmInterval *a, const PwmInterval *b, uint32_t period){
+    if(a->length == 0 || b->length == 0)
+        return false;
+    return tick_is_on(a, b->start, period) || tick_is_on(b, a->start, period);
+}
+
+// Peak of a set of outputs
+static int phases_peak(const PwmPhase *outputs, int num_outputs, uint32_t period){
+    PwmInterval on[PLAN_MAX_OUTPUTS] = {};
+    for(int i = 0; i < num_outputs; i++)
+        on[i] = outputs[i].on;
+    return plan_peak_overlap(on, num_outputs, period);
+}
+
+// Place the movable outputs one at a time, longest first, each where it adds
+// least to the peak, then to the overlap, then nearest its even target.  The
+// best places start at the target, the ends of the period, or where another
+// output switches off, or end where one switches on.
+static void plan_greedy(PwmPhase *outputs, int num_outputs, uint32_t period,
+                        const uint32_t *target){
+    bool placed[PLAN_MAX_OUTPUTS];
+    int num_movable = 0;
+    for(int i = 0; i < num_outputs; i++){
+        placed[i] = !outputs[i].movable;
+        if(outputs[i].movable)
+            num_movable++;
+    }
+    for(int n = 0; n < num_movable; n++){
+        int next = -1;
+        for(int i = 0; i < num_outputs; i++){
+            if(!placed[i] && (next < 0 || outputs[i].on.length > outputs[next].on.length))
+                next = i;
+        }
+        PwmPhase *o = &outputs[next];
+        uint32_t length = o->on.length;
+        uint32_t latest = period - length;
+        uint32_t candidates[2 * PLAN_MAX_OUTPUTS + 3];
+        int num_candidates = 0;
+        candidates[num_candidates++] = target[next];
+        candidates[num_candidates++] = 0;
+        candidates[num_candidates++] = latest;
+        for(int i = 0; i < num_outputs; i++){
+            if(!placed[i] || outputs[i].on.length == 0)
+                continue;
+            uint32_t off = (outputs[i].on.start + outputs[i].on.length) % period;
+            if(off <= latest)
+                candidates[num_candidates++] = off;
+            if(outputs[i].on.start >= length && outputs[i].on.start - length <= latest)
+                candidates[num_candidates++] = outputs[i].on.start - length;
+        }
+
+        int best_peak = 0;
+        uint32_t best_area = 0, best_distance = 0;
+        for(int c = 0; c < num_candidates; c++){
+            int peak;
+            uint32_t area;
+            window_load(outputs, placed, num_outputs, candidates[c], length, period, &peak, &area);
+            uint32_t distance = (candidates[c] > target[next]) ? candidates[c] - target[next]
+                                                               : target[next] - candidates[c];
+            if(c == 0 || peak < best_peak ||
+               (peak == best_peak && (area < best_area ||
+                                      (area == best_area && distance < best_distance)))){
+                best_peak = peak;
+                best_area = area;
+                best_distance = distance;
+                o->on.start = candidates[c];
+            }
+        }
+        placed[next] = true;
+    }
+}
+
+// Pack the outputs into levels, each a set of outputs that don't overlap: the
+// fixed outputs first, then the movable ones longest first, each at the
+// earliest place it fits in the lowest level it fits in.  The peak is at most
+// the number of levels.
+static void plan_packed(PwmPhase *outputs, int num_outputs, uint32_t period){
+    int level[PLAN_MAX_OUTPUTS];
+    bool placed[PLAN_MAX_OUTPUTS];
+    for(int i = 0; i < num_outputs; i++)
+        placed[i] = false;
+    for(int pass = 0; pass < 2; pass++){
+        for(;;){
+            int next = -1;
+            for(int i = 0; i < num_outputs; i++){
+                if(!placed[i] && outputs[i].movable == (pass == 1) &&
+                   (next < 0 || outputs[i].on.length > outputs[next].on.length))
+                    next = i;
+            }
+            if(next < 0)
+                break;
+            PwmPhase *o = &outputs[next];
+            bool fits = false;
+            for(int l = 0; !fits; l++){
+                // Fixed outputs only have their own place; movable ones can
+                // start at 0 or where another output in the level ends
+                for(int c = -1; c < num_outputs && !fits; c++){
+                    if(o->movable){
+                        if(c >= 0 && !(placed[c] && level[c] == l))
+                            continue;
+                        uint32_t start = (c < 0) ? 0 : outputs[c].on.start + outputs[c].on.length;
+                        if(start + o->on.length > period)
+                            continue;
+                        o->on.start = start;
+                    }
+                    else if(c >= 0){
+                        break;
+                    }
+                    fits = true;
+                    for(int i = 0; i < num_outputs && fits; i++){
+                        if(placed[i] && level[i] == l && intervals_overlap(&outputs[i].on, &o->on, period))
+                            fits = false;
+                    }
+                }
+                if(fits)
+                    level[next] = l;
+            }
+            placed[next] = true;
+        }
+    }
+}
+
+// Choose the starts of the movable outputs in the given way.
+int plan_phases(PwmPhase *outputs, int num_outputs, uint32_t period, int stagger){
+    if(num_outputs > PLAN_MAX_OUTPUTS)
+        return -1;
+    if(period == 0 || num_outputs <= 0)
+        return 0;
+
+    // Evenly spaced targets for the movable outputs, in order, kept inside
+    // the period
+    int num_movable = 0;
+    for(int i = 0; i < num_outputs; i++){
+        if(outputs[i].movable)
+            num_movable++;
+    }
+    int movable = 0;
+    uint32_t target[PLAN_MAX_OUTPUTS] = {};
+    for(int i = 0; i < num_outputs; i++){
+        if(!outputs[i].movable)
+            continue;
+        if(outputs[i].on.length > period)
+            outputs[i].on.length = period;
+        uint32_t even = (uint32_t) ((uint64_t) period * movable++ / num_movable);
+        uint32_t latest = period - outputs[i].on.length;
+        target[i] = (even < latest) ? even : latest;
+        if(stagger != PWM_STAGGER_PLANNED)
+            outputs[i].on.start = (stagger == PWM_STAGGER_EVEN) ? target[i] : 0;
+    }
+    if(stagger != PWM_STAGGER_PLANNED)
+        return phases_peak(outputs, num_outputs, period);
+
+    // Neither way of placing the outputs always finds the lowest peak, so
+    // use whichever does better.  The greedy placement also spreads the
+    // outputs out, so it wins a tie.
+    PwmPhase packed[PLAN_MAX_OUTPUTS];
+    for(int i = 0; i < num_outputs; i++)
+        packed[i] = outputs[i];
+    plan_greedy(outputs, num_outputs, period, target);
+    plan_packed(packed, num_outputs, period);
+    int peak = phases_peak(outputs, num_outputs, period);
+    int packed_peak = phases_peak(packed, num_outputs, period);
+    if(packed_peak < peak){
+        for(int i = 0; i < num_outputs; i++)
+            outputs[i] = packed[i];
+        peak = packed_peak;
+    }
+    return peak;
+}
+
+// The most of the intervals that are on at once.
+int plan_peak_overlap(const PwmInterval *on, int num_on, uint32_t period){
+    int peak = 0;
+    for(int i = 0; i < num_on; i++){
+        if(on[i].length == 0)
+            continue;
+        int n = 0;
+        for(int j = 0; j < num_on; j++){
+            if(on[j].length > 0 && tick_is_on(&on[j], on[i].start, period))
+                n++;
+        }
+        if(n > peak)
+            peak = n;
+    }
+    return peak;
+}
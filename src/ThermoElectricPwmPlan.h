@@ -0,0 +1,75 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricPwmPlan.h
+ * @brief PWM timing calculations.  These work on a model of the PWM period in
+ * timer ticks and don't touch the hardware, so they can be built and checked
+ * on a host computer against a simulated PWM timeline.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_PWM_PLAN_H
+#define THERMOELECTRIC_PWM_PLAN_H
+
+#include <stdint.h>
+
+// The part of a PWM period during which an output is on, in timer ticks from
+// the start of the period.  The interval wraps past the end of the period if
+// start + length > period.  A length of zero means the output is off.
+typedef struct {
+    uint32_t start;
+    uint32_t length;
+} PwmInterval;
+
+// Find the tick at which to trigger an ADC conversion so that it lands in the
+// off-phase of every output sharing the PWM counter.  After an output switches
+// off, the trigger waits settle ticks, and the conversion needs another window
+// ticks (trigger latency plus conversion time) before any output switches on.
+// The longest off-phase is used.  Returns false if there is no off-phase long
+// enough; otherwise stores the trigger tick and returns true.
+bool plan_offphase_trigger(const PwmInterval *on, int num_on, uint32_t period,
+                           uint32_t settle, uint32_t window, uint32_t *trigger);
+
+// Ways of choosing the phases of the outputs.  The values are used in the
+// NCMD metrics, so don't renumber.
+enum PwmStagger {
+    PWM_STAGGER_ALIGNED = 0,    // Every output switches on at the start
+    PWM_STAGGER_EVEN,           // Spread evenly through the period
+    PWM_STAGGER_PLANNED,        // Placed to overlap as little as possible
+    NUM_PWM_STAGGER_MODES
+};
+
+#define PLAN_MAX_OUTPUTS  16
+
+// An output to be given a phase.  Outputs that can be moved are placed so
+// they don't wrap past the end of the period; the others stay where they are.
+typedef struct {
+    PwmInterval on;
+    bool        movable;
+} PwmPhase;
+
+// Choose the starts of the movable outputs in the given way.  Returns the
+// most outputs on at once, or -1 if there are more than PLAN_MAX_OUTPUTS.
+int plan_phases(PwmPhase *outputs, int num_outputs, uint32_t period, int stagger);
+
+// The most of the intervals that are on at once.
+int plan_peak_overlap(const PwmInterval *on, int num_on, uint32_t period);
+
+#endif
@@ -0,0 +1,109 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricScheduler.cpp
+ * @brief Implements the cooperative scheduler.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include "ThermoElectricScheduler.h"
+
+/*
+  Private variables
+*/
+static Task *m_tasks = NULL;
+static int   m_num_tasks = 0;
+
+// Microsecond times wrap every 71 minutes, so compare them by difference
+static bool time_reached(uint32_t now, uint32_t time){
+    return (int32_t) (now - time) >= 0;
+}
+
+// Start scheduling the tasks in the table, all released now.
+void scheduler_begin(Task *tasks, int num_tasks){
+    uint32_t now = micros();
+    for(int i = 0; i < num_tasks; i++)
+        tasks[i].release_us = now;
+    m_tasks = tasks;
+    m_num_tasks = num_tasks;
+    scheduler_reset();
+}
+
+// Run the due task with the earliest deadline, if any.
+bool scheduler_run(void){
+    uint32_t now = micros();
+    Task *next = NULL;
+    for(int i = 0; i < m_num_tasks; i++){
+        Task *task = &m_tasks[i];
+        if(!time_reached(now, task->release_us))
+            continue;
+        // Ties go to the task earlier in the table
+        if(next == NULL ||
+           (int32_t) ((task->release_us + task->deadline_us) - (next->release_us + next->deadline_us)) < 0)
+            next = task;
+    }
+    if(next == NULL)
+        return false;
+
+    uint32_t start = micros();
+    next->run();
+    uint32_t end = micros();
+
+    uint32_t runtime = end - start;
+    if(runtime > next->max_runtime_us)
+        next->max_runtime_us = runtime;
+    if(!time_reached(next->release_us + next->deadline_us, end))
+        next->missed++;
+    next->runs++;
+
+    // Release on the period grid, but don't try to catch up on releases that
+    // were missed entirely
+    next->release_us += next->period_us;
+    if(time_reached(end, next->release_us + next->period_us))
+        next->release_us = end;
+    return true;
+}
+
+// Write each task's statistics as "<name> n <runs>, missed <missed>, max
+// <runtime> us", separated by semicolons.
+bool scheduler_report(char *report, size_t size){
+    if(m_num_tasks == 0 || size == 0)
+        return false;
+    int len = 0;
+    report[0] = '\0';
+    for(int i = 0; i < m_num_tasks && len >= 0 && (size_t) len < size; i++){
+        const Task *task = &m_tasks[i];
+        len += snprintf(report + len, size - len, "%s%s n %lu, missed %lu, max %lu us",
+                        i > 0 ? "; " : "", task->name,
+                        (unsigned long) task->runs,
+                        (unsigned long) task->missed,
+                        (unsigned long) task->max_runtime_us);
+    }
+    return true;
+}
+
+// Clear every task's statistics.
+void scheduler_reset(void){
+    for(int i = 0; i < m_num_tasks; i++){
+        m_tasks[i].runs = 0;
+        m_tasks[i].missed = 0;
+        m_tasks[i].max_runtime_us = 0;
+    }
+}
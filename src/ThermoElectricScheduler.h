@@ -0,0 +1,65 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricScheduler.h
+ * @brief A small cooperative scheduler for the main loop.  Each task in the
+ * table runs at its own period and must finish within its deadline of being
+ * released.  Tasks are never preempted, so each one must return quickly
+ * instead of calling delay().
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_SCHEDULER_H
+#define THERMOELECTRIC_SCHEDULER_H
+
+#include "ThermoElectricGlobal.h"
+
+#define SCHEDULER_REPORT_LEN  512   // Longest report string, including the terminator
+
+typedef void (*TaskFunction)(void);
+
+typedef struct {
+    const char   *name;
+    TaskFunction  run;
+    uint32_t      period_us;      // Time between releases
+    uint32_t      deadline_us;    // Finish this long after release
+    // Filled in by the scheduler
+    uint32_t      release_us;     // When the task is next due
+    uint32_t      runs;
+    uint32_t      missed;         // Runs that finished after their deadline
+    uint32_t      max_runtime_us;
+} Task;
+
+// Start scheduling the tasks in the table, all released now.  The table must
+// stay valid while the scheduler is in use.
+void scheduler_begin(Task *tasks, int num_tasks);
+
+// Run the due task with the earliest deadline, if any.  Call this repeatedly
+// from loop().  Returns true if a task ran.
+bool scheduler_run(void);
+
+// Write each task's runs, missed deadlines and longest run time since the
+// last reset into a string.  Returns false if no tasks are scheduled.
+bool scheduler_report(char *report, size_t size);
+
+// Clear every task's statistics.
+void scheduler_reset(void);
+
+#endif
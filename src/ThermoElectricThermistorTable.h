@@ -0,0 +1,96 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file ThermoElectricThermistorTable.h
+ * @brief ADC count to temperature lookup table for the thermistor divider,
+ * built at compile time from the B parameter equation.  Temperatures are in
+ * integer millikelvin so the whole conversion runs in fixed point.  Doesn't
+ * depend on the Arduino core, so it can be checked on a host computer against
+ * the formula.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#ifndef THERMOELECTRIC_THERMISTOR_TABLE_H
+#define THERMOELECTRIC_THERMISTOR_TABLE_H
+
+#include <stdint.h>
+
+#define THERMISTOR_ADC_COUNTS  4096  // 12 bit ADC
+
+// One entry per ADC count, plus one so the last count can be interpolated.
+struct ThermistorTable {
+    int32_t millikelvin[THERMISTOR_ADC_COUNTS + 1];
+};
+
+// Natural log usable in a constant expression.  Scales x into [1, 2) by powers
+// of two, then sums the series ln(m) = 2 atanh((m - 1) / (m + 1)).
+constexpr double const_ln(double x){
+    const double LN2 = 0.693147180559945309417;
+    int exponent = 0;
+    while(x >= 2.0){ x /= 2.0; exponent++; }
+    while(x < 1.0){ x *= 2.0; exponent--; }
+    double z = (x - 1.0) / (x + 1.0);
+    double z2 = z * z;
+    double term = z;
+    double sum = 0.0;
+    for(int n = 1; n < 60; n += 2){
+        sum += term / n;
+        term *= z2;
+    }
+    return 2.0 * sum + exponent * LN2;
+}
+
+// Temperature of the thermistor at a (possibly fractional) ADC count.  The
+// thermistor is on the supply side of a divider with series_ohms to ground,
+// so the ADC reference cancels out.  Counts are kept off 0 and full scale,
+// where the resistance goes to infinity or zero.
+constexpr double thermistor_celsius(double counts, double nominal_ohms, double bcoefficient,
+                                    double nominal_kelvin, double series_ohms){
+    if(counts < 0.5)
+        counts = 0.5;
+    if(counts > THERMISTOR_ADC_COUNTS - 0.5)
+        counts = THERMISTOR_ADC_COUNTS - 0.5;
+    double thermistance = series_ohms * (THERMISTOR_ADC_COUNTS / counts - 1.0);
+    return 1.0 / (1.0 / nominal_kelvin + bcoefficient * const_ln(thermistance / nominal_ohms)) - 273.15;
+}
+
+constexpr ThermistorTable make_thermistor_table(double nominal_ohms, double bcoefficient,
+                                                double nominal_kelvin, double series_ohms){
+    ThermistorTable table = {};
+    for(int counts = 0; counts <= THERMISTOR_ADC_COUNTS; counts++)
+        table.millikelvin[counts] = (int32_t) ((thermistor_celsius(counts, nominal_ohms, bcoefficient,
+                                                                   nominal_kelvin, series_ohms)
+                                                + 273.15) * 1000.0 + 0.5);
+    return table;
+}
+
+// Temperature in millikelvin for the sum of 2^shift ADC samples, which is the
+// average count in fixed point with shift fraction bits.  The fraction
+// interpolates between table entries.
+inline int32_t thermistor_lookup(const ThermistorTable &table, uint32_t sum, int shift){
+    uint32_t index = sum >> shift;
+    if(index >= THERMISTOR_ADC_COUNTS)
+        return table.millikelvin[THERMISTOR_ADC_COUNTS];
+    int32_t frac = (int32_t) (sum & ((1u << shift) - 1));
+    int32_t low = table.millikelvin[index];
+    return low + (((table.millikelvin[index + 1] - low) * frac) >> shift);
+}
+
+#endif
@@ -10,6 +10,8 @@
 
 
 #include "cf_sparkplug.h"
+#include "ThermoElectricProfiler.h"
+#include <pb_encode.h>
 
 
 /*
@@ -20,13 +22,79 @@
 char cf_sparkplug_error[MAX_CF_SPARKPLUG_ERROR_LEN] = "No error";
 
 // Sparkplug variables
-static uint8_t encode_buffer[BIN_BUF_SIZE];  // Buffer to store encoded binary data for Sparkplug
+static uint8_t will_buffer[WILL_BUF_SIZE];  // Buffer to store the encoded Will payload
+
+// State of the output stream that encodes a payload straight to the brokers.
+// The encoder's many small writes are gathered into a chunk before going to
+// the sockets.
+typedef struct {
+    PubSubClient *brokers;
+    int           num_brokers;
+    uint32_t      sending;      // Bit mask of the brokers still being written
+    size_t        fill;         // Bytes waiting in the chunk
+    uint8_t       chunk[STREAM_CHUNK_SIZE];
+} PublishStream;
+
+static PublishStream m_stream;
+
+// A compiled payload, patched in place for each message
+typedef struct {
+    MetricSpec *metric;
+    uint16_t    start;              // Its metrics field in the buffer
+    uint8_t     length;
+    bool        sending;            // In the message being published
+    uint16_t    timestamp_offset;
+    uint16_t    value_offset;
+} CompiledMetric;
+
+typedef struct {
+    int            num_metrics;     // 0 if nothing is compiled
+    size_t         header_len;      // Payload timestamp and seq fields
+    uint16_t       timestamp_offset;
+    uint16_t       seq_offset;
+    CompiledMetric metrics[MAX_COMPILED_METRICS];
+    uint8_t        buffer[COMPILED_BUF_SIZE];
+} CompiledPayload;
+
+static CompiledPayload m_compiled;
+
+// NBIRTH metrics with the encoding of their names, aliases and datatypes
+// cached, and that of their timestamps and values kept until they change
+typedef struct {
+    unsigned long long timestamp;   // Encoded in dynamic
+    uint64_t    value;              // Bits of the value encoded in dynamic
+    uint16_t    static_offset;      // Name, alias and datatype fields, in statics
+    uint8_t     static_len;
+    uint8_t     dynamic_len;        // Timestamp and value fields, 0 if stale
+    uint8_t     dynamic[BIRTH_DYNAMIC_LEN];
+} BirthMetric;
+
+typedef struct {
+    MetricSpec  *metrics;           // The array cached, NULL if none
+    int          num_metrics;
+    BirthMetric *cache;
+    uint8_t     *statics;
+} BirthCache;
+
+static BirthCache m_birth;
+
+// Batches of samples added to the module payload, written after its metrics
+typedef struct {
+    MetricSpec  *metric;
+    const float *values;
+    const unsigned long long *timestamps;
+    int          count;
+} SampleBatch;
+
+static SampleBatch m_batches[MAX_SAMPLE_BATCHES];
+static int         m_num_batches = 0;
 
 static uint8_t m_seq = 0;   // The message sequence number (wraps at 255 back to 0)
 
 // Module-level metrics and payload for publishing messages
 static unsigned int  m_max_metrics = 0;
 static Metric       *m_metrics = NULL;
+static MetricSpec  **m_metric_specs = NULL;   // Where each of m_metrics came from
 static Payload       m_payload = org_eclipse_tahu_protobuf_Payload_init_default;
 
 
@@ -53,11 +121,15 @@ void set_max_metrics(unsigned int max_metrics){
     // Adjust the size of the allocated memory to handle the specified number
     // of metrics
     m_max_metrics = max_metrics;
-    if(m_max_metrics > 0)
+    if(m_max_metrics > 0){
         m_metrics = (Metric *) realloc(m_metrics, m_max_metrics * sizeof(*m_metrics));
+        m_metric_specs = (MetricSpec **) realloc(m_metric_specs, m_max_metrics * sizeof(*m_metric_specs));
+    }
     else{
         free(m_metrics);
         m_metrics = NULL;
+        free(m_metric_specs);
+        m_metric_specs = NULL;
     }
 
     // Discard any metrics from the current payload beyond the new maximum
@@ -293,9 +365,75 @@ MetricSpec * find_received_metric(MetricSpec *metrics, int num_metrics, Metric *
 }
 
 
-// Mark the metric with the specified variable as updated.  This also sets its
-// timestamp.  Returns false if the metric can't be found; otherwise returns
-// true.
+// The metric's value as a number, for its deadband.  Strings have none.
+static double metric_number(const MetricSpec *metric){
+    switch(metric->datatype){
+    case METRIC_DATA_TYPE_BOOLEAN:
+        return *(bool *) metric->variable ? 1 : 0;
+    case METRIC_DATA_TYPE_INT64:
+        return (double) *(uint64_t *) metric->variable;
+    case METRIC_DATA_TYPE_FLOAT:
+        return *(float *) metric->variable;
+    }
+    return 0;
+}
+
+// Whether an update to the metric at the given time should be reported: it
+// has no deadband or maximum silence, it's already waiting to be reported,
+// it's never been reported, it's been silent too long, or its value has moved
+// out of the deadband around the value last reported.
+static bool metric_needs_report(const MetricSpec *metric, unsigned long long timestamp){
+    if((metric->deadband == 0 && metric->max_silence == 0) || metric->updated ||
+       metric->reported_at == 0 || metric->datatype == METRIC_DATA_TYPE_STRING)
+        return true;
+    if(metric->max_silence > 0 && timestamp - metric->reported_at >= metric->max_silence)
+        return true;
+
+    double value = metric_number(metric);
+    if(isnan(value) || isnan(metric->reported))
+        return isnan(value) != isnan(metric->reported);
+    double band = metric->relative ? metric->deadband * fabs(metric->reported) : metric->deadband;
+    return fabs(value - metric->reported) > band;
+}
+
+// Note the value and time of a metric in a published message, for its
+// deadband.
+static void metric_reported(MetricSpec *metric){
+    metric->reported = metric_number(metric);
+    metric->reported_at = metric->timestamp;
+}
+
+// Note the metrics and samples in the module payload as reported, once it's
+// been published.  If it wasn't, their deadbands stay around the values last
+// published, so the next update outside them is sent again.
+static void payload_reported(void){
+    for(unsigned int i = 0; i < m_payload.metrics_count; i++)
+        metric_reported(m_metric_specs[i]);
+    for(int i = 0; i < m_num_batches; i++)
+        metric_reported(m_batches[i].metric);
+}
+
+
+// Give the metric a deadband and maximum silence, for report-by-exception.
+// Returns false if the handle is null or the deadband is negative; otherwise
+// returns true.
+bool set_metric_deadband(MetricSpec *metric, float deadband, bool relative,
+                         uint32_t max_silence){
+    if(metric == NULL || !(deadband >= 0)){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Invalid metric deadband");
+        return false;
+    }
+    metric->deadband = deadband;
+    metric->relative = relative;
+    metric->max_silence = max_silence;
+    return true;
+}
+
+
+// Mark the metric with the specified variable as updated, if its deadband
+// allows.  This also sets its timestamp.  Returns false if the metric can't
+// be found; otherwise returns true.
 bool update_metric(MetricSpec *metrics, int num_metrics, void *variable){
     MetricSpec *metric = find_metric_by_variable(metrics, num_metrics, variable);
     if(metric == NULL)
@@ -303,6 +441,44 @@ bool update_metric(MetricSpec *metrics, int num_metrics, void *variable){
         return false;
 
     // Found the metric - mark it as updated and set its timestamp to now
+    return update_metric_handle(metric);
+}
+
+
+// Mark the metric referred to by the handle as updated, if its deadband
+// allows.  This also sets its timestamp.  Returns false if the handle is
+// null; otherwise returns true.
+bool update_metric_handle(MetricSpec *metric){
+    if(metric == NULL){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Null metric handle");
+        return false;
+    }
+
+    // Mark it as updated and set its timestamp to now, unless it hasn't
+    // moved enough to report
+    unsigned long long timestamp = m_gettimestamp();
+    if(metric_needs_report(metric, timestamp)){
+        metric->updated = true;
+        metric->timestamp = timestamp;
+    }
+
+    // Success
+    return true;
+}
+
+
+// Mark the metric referred to by the handle as updated, whatever its
+// deadband.  This also sets its timestamp.  Returns false if the handle is
+// null; otherwise returns true.
+bool force_update_metric_handle(MetricSpec *metric){
+    if(metric == NULL){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Null metric handle");
+        return false;
+    }
+
+    // Mark it as updated and set its timestamp to now
     metric->updated = true;
     metric->timestamp = m_gettimestamp();
 
@@ -311,6 +487,39 @@ bool update_metric(MetricSpec *metrics, int num_metrics, void *variable){
 }
 
 
+// Mark all the metrics referred to by the array of handles as updated, if
+// their deadbands allow, giving them all the same timestamp.  Returns false
+// if any of the handles is null; otherwise returns true.
+bool update_metric_handles(MetricSpec **metrics, int num_metrics){
+    // Check the parameters are valid
+    if(metrics == NULL || num_metrics <= 0){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Empty metric handle array");
+        return false;
+    }
+
+    // Read the timestamp once for the whole set
+    unsigned long long timestamp = m_gettimestamp();
+
+    bool success = true;
+    for(int idx = 0; idx < num_metrics; idx++){
+        MetricSpec *metric = metrics[idx];
+        if(metric == NULL){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Null metric handle #%d", idx);
+            success = false;
+            continue;
+        }
+        if(metric_needs_report(metric, timestamp)){
+            metric->updated = true;
+            metric->timestamp = timestamp;
+        }
+    }
+
+    return success;
+}
+
+
 // Connect to the specified broker with the specified node ID and will topic
 // using the current module payload.  Returns true if successful, or false if
 // an error occurs.
@@ -326,16 +535,16 @@ bool connect(PubSubClient *broker, const char *nodeId, const char *willTopic){
 
     // Encode the module payload to a buffer
     sparkplugb_arduino_encoder encoder;
-    int msg_len = encoder.encode(&m_payload, encode_buffer, BIN_BUF_SIZE);
+    int msg_len = encoder.encode(&m_payload, will_buffer, WILL_BUF_SIZE);
     //### What is an invalid value for msg_len?
-    if(msg_len <= 0 || msg_len > BIN_BUF_SIZE){
+    if(msg_len <= 0 || msg_len > WILL_BUF_SIZE){
         snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
                  "Failed to encode Will payload: %d", msg_len);
         return false;
     }
 
     // Try to connect to the broker, registering the will message
-    if(!broker->connect(nodeId, willTopic, 0, false, encode_buffer, msg_len)){
+    if(!broker->connect(nodeId, willTopic, 0, false, will_buffer, msg_len)){
         // Can't connect
         snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
                  "Broker refused connection");
@@ -351,9 +560,8 @@ bool connect(PubSubClient *broker, const char *nodeId, const char *willTopic){
 // message will be published before disconnecting using the specified topic and
 // the current module payload.
 //### Disconnect gracefully (no NDEATH) or abruptly (NDEATH published after timeout)?
-//### There doesn't appear to be any way in PubSubClient to break the
-//    connection without sending the MQTT_DISCONNECT message, so we may
-//    have to publish NDEATH explicitly.
+//### PubSubClient::abort() breaks the connection without sending the
+//    MQTT_DISCONNECT message, if the broker should publish NDEATH instead.
 void disconnect(PubSubClient *broker, const char *finalTopic){
     // Only disconnect if currently connected
     if(broker != NULL && broker->connected()){
@@ -374,6 +582,7 @@ void set_up_next_payload(void){
     m_payload.metrics_count = 0;  // Start off with no metrics
     m_payload.has_seq = true;
     m_payload.seq = m_seq;
+    m_num_batches = 0;            // Or samples
 }
 
 
@@ -439,6 +648,7 @@ bool add_metric_to_payload(bool full, MetricSpec *metric){
         if(metric->timestamp == 0)
             metric->timestamp = m_gettimestamp();
 
+        m_metric_specs[m_payload.metrics_count] = metric;
         Metric *next_metric = &m_metrics[m_payload.metrics_count];
         m_payload.metrics_count++;
 
@@ -537,17 +747,81 @@ bool add_metrics(bool full, MetricSpec *metrics, int num_metrics){
 }
 
 
-// Publish the module payload with the specified topic to all the brokers.
-// Doesn't publish to brokers that we're not connected to or if the payload has
-// no metrics.  Note that this sends a duplicate of the message to each broker,
-// so the seq and timestamp fields will be identical.  Returns true if it
-// successfully published to at least one broker; otherwise, returns false.
-bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *topic){
-    // Since the function returns false if we're not connected to any brokers,
-    // an empty error message indicates no error
-    strcpy(cf_sparkplug_error, "");
-
+// Add a batch of timestamped samples of a FLOAT metric to the module payload,
+// oldest first.  The newest stands for the metric's current value, so it
+// takes the place of an update to the metric in this payload.  The arrays
+// must stay valid until the payload is published.  Returns false if an error
+// occurs; otherwise returns true.
+bool add_metric_samples(MetricSpec *metric, const float *values,
+                        const unsigned long long *timestamps, int count){
     // Check the parameters are valid
+    if(metric == NULL || values == NULL || timestamps == NULL || count <= 0){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Empty sample batch");
+        return false;
+    }
+    if(metric->datatype != METRIC_DATA_TYPE_FLOAT){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Can't batch metric %s of datatype %u", metric->name,
+                 (unsigned int) metric->datatype);
+        return false;
+    }
+    if(m_num_batches >= MAX_SAMPLE_BATCHES){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Too many sample batches");
+        return false;
+    }
+
+    SampleBatch *batch = &m_batches[m_num_batches++];
+    batch->metric = metric;
+    batch->values = values;
+    batch->timestamps = timestamps;
+    batch->count = count;
+
+    metric->updated = false;
+    metric->timestamp = timestamps[count - 1];
+
+    // Success
+    return true;
+}
+
+
+// Send the bytes gathered in the stream's chunk to each broker still being
+// written.  A broker that takes less than all of them is dropped from the
+// stream.  Returns false if no brokers are left.
+static bool stream_flush(PublishStream *ps){
+    if(ps->fill > 0){
+        for(int i = 0; i < ps->num_brokers; i++){
+            if((ps->sending & (1UL << i)) &&
+               ps->brokers[i].write(ps->chunk, ps->fill) != ps->fill)
+                ps->sending &= ~(1UL << i);
+        }
+        ps->fill = 0;
+    }
+    return ps->sending != 0;
+}
+
+// nanopb output stream callback, gathering the encoded bytes into chunks.
+static bool stream_write(pb_ostream_t *stream, const pb_byte_t *buf, size_t count){
+    PublishStream *ps = (PublishStream *) stream->state;
+    while(count > 0){
+        size_t n = STREAM_CHUNK_SIZE - ps->fill;
+        if(n > count)
+            n = count;
+        memcpy(ps->chunk + ps->fill, buf, n);
+        ps->fill += n;
+        buf += n;
+        count -= n;
+        if(ps->fill == STREAM_CHUNK_SIZE && !stream_flush(ps))
+            return false;
+    }
+    return true;
+}
+
+
+// Check the broker array and topic for publishing.  Returns false with the
+// error message set if they aren't valid.
+static bool check_publish_args(PubSubClient *broker_array, int num_brokers, const char *topic){
     if(broker_array == NULL || num_brokers <= 0){
         snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
                  "Empty broker array");
@@ -557,25 +831,83 @@ bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *to
         snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error), "Null topic");
         return false;
     }
-
-    // Include the current metrics list in the payload
-    m_payload.metrics = m_metrics;
-
-    // Don't publish if the payload doesn't contain any metrics
-    if(m_payload.metrics_count == 0 || m_payload.metrics == NULL){
-        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error), "No metrics");
+    if(num_brokers > MAX_PUBLISH_BROKERS){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Too many brokers: %d", num_brokers);
         return false;
     }
+    return true;
+}
 
-    // Set the payload timestamp
-    unsigned long long timestamp = m_gettimestamp();
-    m_payload.timestamp = timestamp;
 
-    // Encode the payload to a buffer
-    sparkplugb_arduino_encoder encoder;
-    int msg_len = encoder.encode(&m_payload, encode_buffer, BIN_BUF_SIZE);
+// Writes extra_len more bytes of an already encoded payload to the stream.
+typedef bool (*WriteExtra)(pb_ostream_t *stream);
+
+// Encode the fields of one sample as a Metric: its alias, timestamp,
+// datatype, whether it's historical, and its value.
+static bool encode_sample(pb_ostream_t *stream, const SampleBatch *batch, int idx){
+    bool historical = idx < batch->count - 1;
+    return pb_encode_tag(stream, PB_WT_VARINT, org_eclipse_tahu_protobuf_Payload_Metric_alias_tag) &&
+           pb_encode_varint(stream, batch->metric->alias) &&
+           pb_encode_tag(stream, PB_WT_VARINT, org_eclipse_tahu_protobuf_Payload_Metric_timestamp_tag) &&
+           pb_encode_varint(stream, batch->timestamps[idx]) &&
+           pb_encode_tag(stream, PB_WT_VARINT, org_eclipse_tahu_protobuf_Payload_Metric_datatype_tag) &&
+           pb_encode_varint(stream, METRIC_DATA_TYPE_FLOAT) &&
+           (!historical ||
+            (pb_encode_tag(stream, PB_WT_VARINT, org_eclipse_tahu_protobuf_Payload_Metric_is_historical_tag) &&
+             pb_encode_varint(stream, 1))) &&
+           pb_encode_tag(stream, PB_WT_32BIT, org_eclipse_tahu_protobuf_Payload_Metric_float_value_tag) &&
+           pb_encode_fixed32(stream, &batch->values[idx]);
+}
 
-    bool published = false;
+// Write the module payload's samples to the stream, each as a metrics field
+// of the payload.  A sizing stream gives their length.
+static bool write_samples(pb_ostream_t *stream){
+    for(int b = 0; b < m_num_batches; b++){
+        const SampleBatch *batch = &m_batches[b];
+        for(int idx = 0; idx < batch->count; idx++){
+            pb_ostream_t sizing = PB_OSTREAM_SIZING;
+            if(!encode_sample(&sizing, batch, idx) ||
+               !pb_encode_tag(stream, PB_WT_STRING, org_eclipse_tahu_protobuf_Payload_metrics_tag) ||
+               !pb_encode_varint(stream, sizing.bytes_written) ||
+               !encode_sample(stream, batch, idx))
+                return false;
+        }
+    }
+    return true;
+}
+
+// Publish the encoded module payload, followed by extra_len bytes from
+// write_extra if it's given and then the payload's samples, to all the
+// brokers we're connected to.  The
+// payload is sized first, then encoded once and streamed to all the brokers
+// together.  Returns true if it successfully published to at least one
+// broker; otherwise, returns false.
+static bool publish_stream(PubSubClient *broker_array, int num_brokers, const char *topic,
+                           WriteExtra write_extra, size_t extra_len){
+    // Size the payload, for the MQTT header.  PubSubClient builds the header
+    // with a 16-bit length, which also covers the topic and its length.
+    uint32_t encode_start = ARM_DWT_CYCCNT;
+    size_t msg_len;
+    if(!pb_get_encoded_size(&msg_len, org_eclipse_tahu_protobuf_Payload_fields, &m_payload)){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Failed to size payload");
+        return false;
+    }
+    pb_ostream_t sizing = PB_OSTREAM_SIZING;
+    write_samples(&sizing);
+    extra_len += sizing.bytes_written;
+    if(extra_len + msg_len + strlen(topic) + 2 > UINT16_MAX){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Payload too large: %u", (unsigned int) (extra_len + msg_len));
+        return false;
+    }
+
+    // Start the message on each broker we're connected to
+    m_stream.brokers = broker_array;
+    m_stream.num_brokers = num_brokers;
+    m_stream.sending = 0;
+    m_stream.fill = 0;
     for(int i = 0; i < num_brokers; ++i){
         PubSubClient *broker = &broker_array[i];
 
@@ -583,17 +915,83 @@ bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *to
         if(!broker->connected())
             continue;
 
-        // Send the message to the broker
-        if(!broker->publish(topic, encode_buffer, msg_len, false)){
+        if(!broker->beginPublish(topic, extra_len + msg_len, false)){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Failed to publish message to broker%d: %s", i, topic);
+            continue;
+        }
+        m_stream.sending |= 1UL << i;
+    }
+    uint32_t started = m_stream.sending;
+    if(started == 0)
+        return false;
+
+    // Encode the payload once, then add the extra bytes and the samples,
+    // writing them to all of them
+    pb_ostream_t stream = {stream_write, &m_stream, extra_len + msg_len, 0};
+    bool encoded = pb_encode(&stream, org_eclipse_tahu_protobuf_Payload_fields, &m_payload) &&
+                   (write_extra == NULL || write_extra(&stream)) && write_samples(&stream) &&
+                   stream_flush(&m_stream) && stream.bytes_written == extra_len + msg_len;
+    profile_record(PROBE_ENCODE, ARM_DWT_CYCCNT - encode_start);
+
+    bool published = false;
+    for(int i = 0; i < num_brokers; ++i){
+        if(!(started & (1UL << i)))
+            continue;
+        if(!encoded || !(m_stream.sending & (1UL << i))){
+            // The broker has the header of a message that never got all its
+            // bytes, and would take whatever we send next as the rest of it,
+            // so close the socket without sending anything more, not even a
+            // DISCONNECT.  The broker sees the connection lost and publishes
+            // our Will, and we reconnect and rebirth.
             snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
                      "Failed to publish message to broker%d: %s", i, topic);
+            broker_array[i].abort();
             continue;
         }
+        broker_array[i].endPublish();
 
         // Success
         published = true;
     }
 
+    // Return true if we published to at least one broker
+    return published;
+}
+
+
+// Publish the module payload with the specified topic to all the brokers.
+// Doesn't publish to brokers that we're not connected to or if the payload has
+// no metrics or samples.  Note that this sends a duplicate of the message to
+// each broker, so the seq and timestamp fields will be identical.  Returns
+// true if it successfully published to at least one broker; otherwise,
+// returns false.
+bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *topic){
+    // Since the function returns false if we're not connected to any brokers,
+    // an empty error message indicates no error
+    strcpy(cf_sparkplug_error, "");
+
+    // Check the parameters are valid
+    if(!check_publish_args(broker_array, num_brokers, topic))
+        return false;
+
+    // Include the current metrics list in the payload
+    m_payload.metrics = m_metrics;
+
+    // Don't publish if the payload doesn't contain any metrics or samples
+    if((m_payload.metrics_count == 0 || m_payload.metrics == NULL) && m_num_batches == 0){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error), "No metrics");
+        return false;
+    }
+
+    // Set the payload timestamp
+    unsigned long long timestamp = m_gettimestamp();
+    m_payload.timestamp = timestamp;
+
+    bool published = publish_stream(broker_array, num_brokers, topic, NULL, 0);
+    if(published)
+        payload_reported();
+
     // Increment the sequence number if the payload was published and had a
     // sequence number
     if(published && m_payload.has_seq)
@@ -615,6 +1013,481 @@ bool publish_metrics(PubSubClient *broker_array, int num_brokers, const char *to
 }
 
 
+// Protobuf key for a field, to go in front of its value.
+static uint64_t compiled_key(uint32_t field, pb_wire_type_t wire_type){
+    return ((uint64_t) field << 3) | wire_type;
+}
+
+// Append a protobuf varint to the compiled payload.  Returns the new length,
+// or 0 if it doesn't fit.
+static size_t compiled_varint(size_t length, uint64_t value){
+    do{
+        if(length >= COMPILED_BUF_SIZE)
+            return 0;
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        m_compiled.buffer[length++] = value ? (byte | 0x80) : byte;
+    } while(value);
+    return length;
+}
+
+// Write a varint padded out to len bytes with continuation bits, which
+// protobuf decoders accept, so that any value up to 7 * len bits fits the
+// same space.  Returns false, leaving the bytes unchanged, if it doesn't fit.
+static bool patch_varint(uint8_t *dest, uint64_t value, int len){
+    if(len < 10 && (value >> (7 * len)) != 0)
+        return false;
+    for(int i = 0; i < len - 1; i++){
+        dest[i] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    dest[len - 1] = value & 0x7F;
+    return true;
+}
+
+
+// Compile a payload of the metrics referred to by the array of handles: the
+// payload's timestamp and seq, then a metrics field for each metric with its
+// alias, timestamp, datatype and value, in that order.  Each metrics field
+// stands on its own, so any of them can be left out of a message.  Only BOOLEAN, INT64 and FLOAT metrics can be
+// compiled.  Returns false if the metrics can't be compiled.
+bool compile_payload(MetricSpec **metrics, int num_metrics){
+    m_compiled.num_metrics = 0;
+    if(metrics == NULL || num_metrics <= 0 || num_metrics > MAX_COMPILED_METRICS){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Can't compile %d metrics", num_metrics);
+        return false;
+    }
+
+    // Payload timestamp and seq, patched when publishing
+    size_t length = compiled_varint(0, compiled_key(org_eclipse_tahu_protobuf_Payload_timestamp_tag, PB_WT_VARINT));
+    m_compiled.timestamp_offset = length;
+    length += COMPILED_TIMESTAMP_LEN;
+    length = compiled_varint(length, compiled_key(org_eclipse_tahu_protobuf_Payload_seq_tag, PB_WT_VARINT));
+    m_compiled.seq_offset = length;
+    length += COMPILED_SEQ_LEN;
+    m_compiled.header_len = length;
+
+    for(int idx = 0; idx < num_metrics; idx++){
+        MetricSpec *metric = metrics[idx];
+        if(metric == NULL){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Null metric handle");
+            return false;
+        }
+
+        // The value's key and width
+        uint64_t value_key;
+        size_t value_len;
+        switch(metric->datatype){
+        case METRIC_DATA_TYPE_BOOLEAN:
+            value_key = compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_boolean_value_tag, PB_WT_VARINT);
+            value_len = 1;
+            break;
+        case METRIC_DATA_TYPE_INT64:
+            value_key = compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_long_value_tag, PB_WT_VARINT);
+            value_len = 10;
+            break;
+        case METRIC_DATA_TYPE_FLOAT:
+            value_key = compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_float_value_tag, PB_WT_32BIT);
+            value_len = 4;
+            break;
+        default:
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Can't compile metric %s of datatype %u", metric->name,
+                     (unsigned int) metric->datatype);
+            return false;
+        }
+
+        // Encode the metric into the space after its key and length, which
+        // are put in front of it once its length is known
+        size_t start = length + 2;
+        size_t end = compiled_varint(start, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_alias_tag, PB_WT_VARINT));
+        end = end ? compiled_varint(end, metric->alias) : 0;
+        end = end ? compiled_varint(end, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_timestamp_tag, PB_WT_VARINT)) : 0;
+        size_t timestamp_offset = end;
+        end = end ? end + COMPILED_TIMESTAMP_LEN : 0;
+        end = end ? compiled_varint(end, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_datatype_tag, PB_WT_VARINT)) : 0;
+        end = end ? compiled_varint(end, metric->datatype) : 0;
+        end = end ? compiled_varint(end, value_key) : 0;
+        size_t value_offset = end;
+        end = end ? end + value_len : 0;
+        if(end == 0 || end > COMPILED_BUF_SIZE || end - start > 127){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "No room to compile metric %s", metric->name);
+            return false;
+        }
+        m_compiled.buffer[length] = compiled_key(org_eclipse_tahu_protobuf_Payload_metrics_tag, PB_WT_STRING);
+        m_compiled.buffer[length + 1] = end - start;
+
+        m_compiled.metrics[idx].metric = metric;
+        m_compiled.metrics[idx].start = length;
+        m_compiled.metrics[idx].length = end - length;
+        m_compiled.metrics[idx].sending = false;
+        m_compiled.metrics[idx].timestamp_offset = timestamp_offset;
+        m_compiled.metrics[idx].value_offset = value_offset;
+        length = end;
+    }
+
+    m_compiled.num_metrics = num_metrics;
+    return true;
+}
+
+
+// Patch the compiled payload with the current values of the metrics being
+// sent, and the timestamp and seq for the next message.  Returns false if a
+// timestamp is too big for its space.
+static bool patch_compiled_payload(unsigned long long timestamp){
+    if(!patch_varint(&m_compiled.buffer[m_compiled.timestamp_offset], timestamp, COMPILED_TIMESTAMP_LEN))
+        return false;
+    patch_varint(&m_compiled.buffer[m_compiled.seq_offset], m_seq, COMPILED_SEQ_LEN);
+
+    for(int idx = 0; idx < m_compiled.num_metrics; idx++){
+        CompiledMetric *compiled = &m_compiled.metrics[idx];
+        MetricSpec *metric = compiled->metric;
+        if(!compiled->sending)
+            continue;
+        uint8_t *value = &m_compiled.buffer[compiled->value_offset];
+        if(metric->timestamp == 0)
+            metric->timestamp = timestamp;
+        if(!patch_varint(&m_compiled.buffer[compiled->timestamp_offset], metric->timestamp, COMPILED_TIMESTAMP_LEN))
+            return false;
+        switch(metric->datatype){
+        case METRIC_DATA_TYPE_BOOLEAN:
+            *value = *(bool *) metric->variable ? 1 : 0;
+            break;
+        case METRIC_DATA_TYPE_INT64:
+            patch_varint(value, *(uint64_t *) metric->variable, 10);
+            break;
+        case METRIC_DATA_TYPE_FLOAT:
+            memcpy(value, metric->variable, 4);  // Little-endian, as protobuf
+            break;
+        }
+    }
+    return true;
+}
+
+
+// Write the compiled payload's header and the metrics being sent to the
+// stream.
+static bool write_compiled_payload(pb_ostream_t *stream){
+    if(!pb_write(stream, m_compiled.buffer, m_compiled.header_len))
+        return false;
+    for(int idx = 0; idx < m_compiled.num_metrics; idx++){
+        const CompiledMetric *compiled = &m_compiled.metrics[idx];
+        if(compiled->sending && !pb_write(stream, &m_compiled.buffer[compiled->start], compiled->length))
+            return false;
+    }
+    return true;
+}
+
+
+// Publish the metrics in the array that have been updated, like
+// publish_metrics() with full false.  The compiled metrics that have been
+// updated are sent from the compiled payload, patched in place, and only the
+// other updated metrics are encoded.  Returns true if it successfully
+// published to at least one broker; otherwise, returns false.
+bool publish_compiled_metrics(PubSubClient *broker_array, int num_brokers, const char *topic,
+                              MetricSpec *metrics, int num_metrics){
+    // Pick out the compiled metrics to send
+    size_t extra_len = m_compiled.header_len;
+    bool compiled = false;
+    for(int idx = 0; idx < m_compiled.num_metrics; idx++){
+        CompiledMetric *cm = &m_compiled.metrics[idx];
+        cm->sending = cm->metric->updated;
+        if(cm->sending){
+            extra_len += cm->length;
+            compiled = true;
+        }
+    }
+    if(!compiled || !m_payload.has_seq)
+        return publish_metrics(broker_array, num_brokers, topic, false, metrics, num_metrics);
+
+    strcpy(cf_sparkplug_error, "");
+    if(!check_publish_args(broker_array, num_brokers, topic))
+        return false;
+
+    unsigned long long timestamp = m_gettimestamp();
+    uint32_t patch_start = ARM_DWT_CYCCNT;
+    bool patched = patch_compiled_payload(timestamp);
+    profile_record(PROBE_ENCODE, ARM_DWT_CYCCNT - patch_start);
+    if(!patched)
+        return publish_metrics(broker_array, num_brokers, topic, false, metrics, num_metrics);
+
+    // The compiled metrics are sent, and the payload carries any others
+    for(int idx = 0; idx < m_compiled.num_metrics; idx++){
+        if(m_compiled.metrics[idx].sending)
+            m_compiled.metrics[idx].metric->updated = false;
+    }
+    if(!add_metrics(false, metrics, num_metrics))
+        return false;
+    m_payload.metrics = m_metrics;
+
+    // The compiled payload has the timestamp and seq
+    m_payload.has_timestamp = false;
+    m_payload.has_seq = false;
+    bool published = publish_stream(broker_array, num_brokers, topic,
+                                    write_compiled_payload, extra_len);
+    m_payload.has_timestamp = true;
+    m_payload.has_seq = true;
+
+    if(published){
+        payload_reported();
+        for(int idx = 0; idx < m_compiled.num_metrics; idx++){
+            if(m_compiled.metrics[idx].sending)
+                metric_reported(m_compiled.metrics[idx].metric);
+        }
+        m_seq++;
+    }
+    return published;
+}
+
+
+// Put a protobuf varint in the buffer, which must have room for 10 bytes.
+// Returns the number of bytes used.
+static size_t put_varint(uint8_t *dest, uint64_t value){
+    size_t length = 0;
+    while(value >= 0x80){
+        dest[length++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    dest[length++] = value;
+    return length;
+}
+
+// Number of bytes in the protobuf varint for a value.
+static size_t varint_size(uint64_t value){
+    size_t length = 1;
+    while(value >= 0x80){
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+
+// The metric's value, as the raw bits cached with its encoding.  Strings are
+// always read from the variable, so they have none.
+static uint64_t birth_value(const MetricSpec *metric){
+    uint64_t value = 0;
+    switch(metric->datatype){
+    case METRIC_DATA_TYPE_BOOLEAN:
+        value = *(bool *) metric->variable ? 1 : 0;
+        break;
+    case METRIC_DATA_TYPE_INT64:
+        value = *(uint64_t *) metric->variable;
+        break;
+    case METRIC_DATA_TYPE_FLOAT:
+        memcpy(&value, metric->variable, sizeof(float));
+        break;
+    }
+    return value;
+}
+
+// Encode the timestamp and value fields of a cached birth metric, if they're
+// stale.  A string metric's cached fields end with its value's key, and the
+// string itself is written from the variable.
+static void refresh_birth_metric(BirthMetric *cached, const MetricSpec *metric){
+    uint64_t value = birth_value(metric);
+    if(cached->dynamic_len > 0 && cached->timestamp == metric->timestamp && cached->value == value)
+        return;
+    cached->timestamp = metric->timestamp;
+    cached->value = value;
+
+    uint8_t *dest = cached->dynamic;
+    dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_timestamp_tag, PB_WT_VARINT));
+    dest += put_varint(dest, metric->timestamp);
+    switch(metric->datatype){
+    case METRIC_DATA_TYPE_BOOLEAN:
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_boolean_value_tag, PB_WT_VARINT));
+        dest += put_varint(dest, value);
+        break;
+    case METRIC_DATA_TYPE_INT64:
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_long_value_tag, PB_WT_VARINT));
+        dest += put_varint(dest, value);
+        break;
+    case METRIC_DATA_TYPE_FLOAT:
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_float_value_tag, PB_WT_32BIT));
+        memcpy(dest, metric->variable, sizeof(float));  // Little-endian, as protobuf
+        dest += sizeof(float);
+        break;
+    case METRIC_DATA_TYPE_STRING:
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_string_value_tag, PB_WT_STRING));
+        break;
+    }
+    cached->dynamic_len = dest - cached->dynamic;
+}
+
+// A string metric's value, never null.
+static const char *birth_string(const MetricSpec *metric){
+    const char *string = *(const char **) metric->variable;
+    return string != NULL ? string : "";
+}
+
+// Length of a cached birth metric's Metric message, and its string value if
+// it has one.
+static size_t birth_metric_size(int idx, size_t *string_len){
+    const MetricSpec *metric = &m_birth.metrics[idx];
+    const BirthMetric *cached = &m_birth.cache[idx];
+    size_t size = cached->static_len + cached->dynamic_len;
+    *string_len = 0;
+    if(metric->datatype == METRIC_DATA_TYPE_STRING){
+        *string_len = strlen(birth_string(metric));
+        size += varint_size(*string_len) + *string_len;
+    }
+    return size;
+}
+
+
+// Cache the parts of the NBIRTH encoding of the metrics in the array that
+// never change, for publish_birth_metrics().  Only BOOLEAN, INT64, FLOAT and
+// STRING metrics can be cached.  Returns false if they can't be cached.
+bool cache_birth_metrics(MetricSpec *metrics, int num_metrics){
+    // Forget any earlier cache
+    free(m_birth.cache);
+    free(m_birth.statics);
+    memset(&m_birth, 0, sizeof(m_birth));
+
+    if(metrics == NULL || num_metrics <= 0){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Empty metrics array");
+        return false;
+    }
+
+    // The name, alias and datatype fields of each metric
+    size_t statics_len = 0;
+    for(int idx = 0; idx < num_metrics; idx++){
+        MetricSpec *metric = &metrics[idx];
+        size_t name_len = strlen(metric->name);
+        size_t len = 3 + varint_size(name_len) + name_len + varint_size(metric->alias) +
+                     varint_size(metric->datatype);
+        if(len > UINT8_MAX){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Metric name too long to cache: %s", metric->name);
+            return false;
+        }
+        if(metric->datatype != METRIC_DATA_TYPE_BOOLEAN && metric->datatype != METRIC_DATA_TYPE_INT64 &&
+           metric->datatype != METRIC_DATA_TYPE_FLOAT   && metric->datatype != METRIC_DATA_TYPE_STRING){
+            snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                     "Can't cache metric %s of datatype %u", metric->name,
+                     (unsigned int) metric->datatype);
+            return false;
+        }
+        statics_len += len;
+    }
+    if(statics_len > UINT16_MAX){
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "Too many metrics to cache");
+        return false;
+    }
+
+    m_birth.cache = (BirthMetric *) calloc(num_metrics, sizeof(*m_birth.cache));
+    m_birth.statics = (uint8_t *) malloc(statics_len);
+    if(m_birth.cache == NULL || m_birth.statics == NULL){
+        free(m_birth.cache);
+        free(m_birth.statics);
+        memset(&m_birth, 0, sizeof(m_birth));
+        snprintf(cf_sparkplug_error, sizeof(cf_sparkplug_error),
+                 "No memory to cache %d metrics", num_metrics);
+        return false;
+    }
+
+    size_t offset = 0;
+    for(int idx = 0; idx < num_metrics; idx++){
+        MetricSpec *metric = &metrics[idx];
+        BirthMetric *cached = &m_birth.cache[idx];
+        uint8_t *dest = &m_birth.statics[offset];
+        size_t name_len = strlen(metric->name);
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_name_tag, PB_WT_STRING));
+        dest += put_varint(dest, name_len);
+        memcpy(dest, metric->name, name_len);
+        dest += name_len;
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_alias_tag, PB_WT_VARINT));
+        dest += put_varint(dest, metric->alias);
+        dest += put_varint(dest, compiled_key(org_eclipse_tahu_protobuf_Payload_Metric_datatype_tag, PB_WT_VARINT));
+        dest += put_varint(dest, metric->datatype);
+        cached->static_offset = offset;
+        cached->static_len = dest - &m_birth.statics[offset];
+        cached->dynamic_len = 0;  // Stale
+        offset += cached->static_len;
+    }
+
+    m_birth.metrics = metrics;
+    m_birth.num_metrics = num_metrics;
+    return true;
+}
+
+
+// Write the cached birth metrics to the stream, each as a metrics field of
+// the payload.
+static bool write_birth_metrics(pb_ostream_t *stream){
+    for(int idx = 0; idx < m_birth.num_metrics; idx++){
+        const MetricSpec *metric = &m_birth.metrics[idx];
+        const BirthMetric *cached = &m_birth.cache[idx];
+        size_t string_len;
+        size_t size = birth_metric_size(idx, &string_len);
+
+        uint8_t header[12];
+        size_t header_len = put_varint(header, compiled_key(org_eclipse_tahu_protobuf_Payload_metrics_tag, PB_WT_STRING));
+        header_len += put_varint(&header[header_len], size);
+        if(!pb_write(stream, header, header_len) ||
+           !pb_write(stream, &m_birth.statics[cached->static_offset], cached->static_len) ||
+           !pb_write(stream, cached->dynamic, cached->dynamic_len))
+            return false;
+        if(metric->datatype == METRIC_DATA_TYPE_STRING){
+            header_len = put_varint(header, string_len);
+            if(!pb_write(stream, header, header_len) ||
+               !pb_write(stream, (const pb_byte_t *) birth_string(metric), string_len))
+                return false;
+        }
+    }
+    return true;
+}
+
+
+// Publish the module payload followed by all the metrics in the array with
+// their names, like publish_metrics() with full true.  If the array is the
+// one cached by cache_birth_metrics(), the metrics are written from the
+// cache, re-encoding only the values that have changed.  Returns true if it
+// successfully published to at least one broker; otherwise, returns false.
+bool publish_birth_metrics(PubSubClient *broker_array, int num_brokers, const char *topic,
+                           MetricSpec *metrics, int num_metrics){
+    if(metrics == NULL || metrics != m_birth.metrics || num_metrics != m_birth.num_metrics)
+        return publish_metrics(broker_array, num_brokers, topic, true, metrics, num_metrics);
+
+    strcpy(cf_sparkplug_error, "");
+    if(!check_publish_args(broker_array, num_brokers, topic))
+        return false;
+
+    // Bring the cache up to date, as adding the metrics to the payload would
+    unsigned long long timestamp = m_gettimestamp();
+    size_t extra_len = 0;
+    for(int idx = 0; idx < num_metrics; idx++){
+        MetricSpec *metric = &metrics[idx];
+        metric->updated = false;
+        if(metric->timestamp == 0)
+            metric->timestamp = timestamp;
+        refresh_birth_metric(&m_birth.cache[idx], metric);
+        size_t string_len;
+        size_t size = birth_metric_size(idx, &string_len);
+        extra_len += 1 + varint_size(size) + size;
+    }
+
+    m_payload.metrics = m_metrics;
+    m_payload.timestamp = timestamp;
+    bool published = publish_stream(broker_array, num_brokers, topic,
+                                    write_birth_metrics, extra_len);
+    if(published){
+        payload_reported();
+        for(int idx = 0; idx < num_metrics; idx++)
+            metric_reported(&metrics[idx]);
+    }
+    if(published && m_payload.has_seq)
+        m_seq++;
+    return published;
+}
+
+
 // Check to see if a received message is a Primary Host state message.  If it
 // is, handle it and return true, even if it's invalid; otherwise return false.
 bool process_host_state_message(const char *topic, byte *payload, unsigned int len,
@@ -32,7 +32,18 @@
 #define NCMD_MESSAGE_TYPE     "NCMD"            // Node command message identifier
 #define DCMD_MESSAGE_TYPE     "DCMD"            // Device command message identifier
 
-#define BIN_BUF_SIZE  2048  // Binary data buffer size for Sparkplug
+#define MQTT_BUF_SIZE      2048   // PubSubClient buffer, for received commands and the connect packet
+#define WILL_BUF_SIZE      256    // Encoded Will (NDEATH) payload
+#define STREAM_CHUNK_SIZE  256    // Encoded payload bytes gathered per socket write
+#define MAX_PUBLISH_BROKERS 32    // Brokers one payload can be streamed to at once
+
+// Compiled payloads, see compile_payload()
+#define COMPILED_BUF_SIZE       1024
+#define MAX_COMPILED_METRICS    48
+#define COMPILED_TIMESTAMP_LEN  7     // Varint bytes for each timestamp, to 2^49 ms
+#define COMPILED_SEQ_LEN        2
+#define BIRTH_DYNAMIC_LEN       24    // Timestamp and value fields of a cached birth metric
+#define MAX_SAMPLE_BATCHES      16    // Batches of samples one payload can carry
 
 #define NODE_TOPIC(type, node_id)               SPARKPLUG_VERSION "/" GROUP_ID "/" type "/" node_id
 #define DEVICE_TOPIC(type, node_id, device_id)  SPARKPLUG_VERSION "/" GROUP_ID "/" type "/" node_id "/" device_id
@@ -55,6 +66,14 @@ typedef struct
     void         *variable;
     bool          updated;
     unsigned long long timestamp;
+
+    // Report-by-exception, set with set_metric_deadband().  With both zero
+    // every update is reported.
+    float         deadband;     // Least change reported, 0 for any change
+    bool          relative;     // Deadband is a fraction of the last value reported
+    uint32_t      max_silence;  // Most milliseconds between reports, 0 for no limit
+    double        reported;     // Value last published
+    unsigned long long reported_at;  // And its timestamp, 0 if never
 } MetricSpec;
 
 
@@ -103,11 +122,38 @@ MetricSpec * find_metric_by_variable(MetricSpec *metrics, int num_metrics,
 // type doesn't match, or if the metric is read-only.
 MetricSpec * find_received_metric(MetricSpec *metrics, int num_metrics, Metric *metric);
 
-// Mark the metric with the specified variable as updated.  This also sets its
-// timestamp.  Returns false if the metric can't be found; otherwise returns
+// Give the metric a deadband and maximum silence, for report-by-exception:
+// an update is then only reported when the value has moved more than the
+// deadband from the value last reported, or after max_silence milliseconds
+// without a report.  A relative deadband is a fraction of the value last
+// reported.  Booleans report any change, and strings every update.  Returns
+// false if the handle is null or the deadband is negative; otherwise returns
 // true.
+bool set_metric_deadband(MetricSpec *metric, float deadband, bool relative,
+                         uint32_t max_silence);
+
+// Mark the metric with the specified variable as updated, if its deadband
+// allows.  This also sets its timestamp.  Returns false if the metric can't
+// be found; otherwise returns true.
 bool update_metric(MetricSpec *metrics, int num_metrics, void *variable);
 
+// Mark the metric referred to by the handle as updated, if its deadband
+// allows.  A handle is the pointer returned by find_metric_by_variable() or
+// find_metric_by_alias(), looked up once during setup so that no search is
+// needed on every update.  This also sets its timestamp.  Returns false if
+// the handle is null; otherwise returns true.
+bool update_metric_handle(MetricSpec *metric);
+
+// Mark the metric referred to by the handle as updated, whatever its
+// deadband, e.g. to echo a command.  This also sets its timestamp.  Returns
+// false if the handle is null; otherwise returns true.
+bool force_update_metric_handle(MetricSpec *metric);
+
+// Mark all the metrics referred to by the array of handles as updated, if
+// their deadbands allow, giving them all the same timestamp.  Returns false
+// if any of the handles is null; otherwise returns true.
+bool update_metric_handles(MetricSpec **metrics, int num_metrics);
+
 // Connect to the specified broker with the specified node ID and will topic
 // using the current module payload.  Returns true if successful, or false if
 // an error occurs.
@@ -141,11 +187,25 @@ bool add_metric(bool full, MetricSpec *metrics, int num_metrics, void *variable,
 // Returns false if an error occurs; otherwise returns true.
 bool add_metrics(bool full, MetricSpec *metrics, int num_metrics);
 
+// Add a batch of timestamped samples of a FLOAT metric to the module payload,
+// oldest first.  Each is sent as the metric with its own timestamp, and all
+// but the newest are marked as historical.  The metric's variable should hold
+// the newest value, which takes its timestamp.  The arrays must stay valid
+// until the payload is published.  Returns false if the batch is empty or
+// invalid, or the payload already has MAX_SAMPLE_BATCHES batches; otherwise
+// returns true.
+bool add_metric_samples(MetricSpec *metric, const float *values,
+                        const unsigned long long *timestamps, int count);
+
 // Publish the module payload with the specified topic to all the brokers.
 // Doesn't publish to brokers that we're not connected to or if the payload has
-// no metrics.  Note that this sends a duplicate of the message to each broker,
-// so the seq and timestamp fields will be identical.  Returns true if it
-// successfully published to at least one broker; otherwise, returns false.
+// no metrics or samples.  Note that this sends a duplicate of the message to
+// each broker, so the seq and timestamp fields will be identical.  The payload
+// is encoded straight to the brokers' sockets rather than into a buffer, so
+// its size is only limited by PubSubClient's 16-bit packet length.  A broker
+// that fails partway through the message is disconnected, as its connection
+// can't be recovered.  Returns true if it successfully published to at least
+// one broker; otherwise, returns false.
 bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *topic);
 
 // Add the specified metrics to the module payload and publish it.  This
@@ -155,6 +215,35 @@ bool publish_payload(PubSubClient *broker_array, int num_brokers, const char *to
 bool publish_metrics(PubSubClient *broker_array, int num_brokers, const char *topic,
                      bool full, MetricSpec *metrics, int num_metrics);
 
+// Compile a payload of the metrics referred to by the array of handles, for
+// publish_compiled_metrics().  The payload is encoded once, leaving fixed-size
+// room for each timestamp and value, so each message only has to patch them
+// in place.  Only BOOLEAN, INT64 and FLOAT metrics can be compiled.  Returns
+// false if the metrics can't be compiled.
+bool compile_payload(MetricSpec **metrics, int num_metrics);
+
+// Publish the updated metrics in the array like publish_metrics() with full
+// false.  The compiled metrics that have been updated are sent from the
+// compiled payload and only the other updated metrics are encoded.  Returns true if it successfully
+// published to at least one broker; otherwise, returns false.
+bool publish_compiled_metrics(PubSubClient *broker_array, int num_brokers, const char *topic,
+                              MetricSpec *metrics, int num_metrics);
+
+// Cache the parts of the NBIRTH encoding of the metrics in the array that
+// never change, their names, aliases and datatypes, for
+// publish_birth_metrics().  Only BOOLEAN, INT64, FLOAT and STRING metrics can
+// be cached.  Returns false if they can't be cached.
+bool cache_birth_metrics(MetricSpec *metrics, int num_metrics);
+
+// Publish the module payload followed by all the metrics in the array with
+// their names, like publish_metrics() with full true.  If the array is the
+// one cached by cache_birth_metrics(), the metrics are written from the
+// cache, re-encoding only the values that have changed; otherwise it falls
+// back to publish_metrics().  Returns true if it successfully published to at
+// least one broker; otherwise, returns false.
+bool publish_birth_metrics(PubSubClient *broker_array, int num_brokers, const char *topic,
+                           MetricSpec *metrics, int num_metrics);
+
 // Check to see if a received message is a Primary Host state message.  If it
 // is, handle it and return true, even if it's invalid; otherwise return false.
 bool process_host_state_message(const char *topic, byte *payload, unsigned int len,
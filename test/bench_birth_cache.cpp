@@ -0,0 +1,183 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file bench_birth_cache.cpp
+ * @brief Checks that an NBIRTH written from the cached metric encodings
+ * decodes with nanopb to the same metrics as the generic encoding, as values
+ * and timestamps change between births, and times the two.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include "cf_sparkplug.h"
+
+#define NUM_METRICS  200    // About the size of NodeMetrics
+#define TEXT_LEN     80
+
+static float       m_float[NUM_METRICS];
+static bool        m_bool[NUM_METRICS];
+static uint64_t    m_int[NUM_METRICS];
+static char        m_text[NUM_METRICS][TEXT_LEN];
+static const char *m_string[NUM_METRICS];
+static char        names[NUM_METRICS][48];
+static MetricSpec  metrics[NUM_METRICS];
+
+static uint64_t bdSeq = 3;
+static MetricSpec bdSeqMetric[] = {
+    {"bdSeq", 0, false, METRIC_DATA_TYPE_INT64, &bdSeq, false, 0},
+};
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+static unsigned long long now_ms = 1760000000000ULL;
+static unsigned long long get_timestamp(void){
+    return now_ms;
+}
+
+// A mix of every type that can be cached, with names as long as the
+// channel metrics'
+static void set_up_metrics(void){
+    for(int i = 0; i < NUM_METRICS; i++){
+        snprintf(names[i], sizeof(names[i]), "Inputs/Some Metric Name Channel%d", i);
+        m_string[i] = m_text[i];
+        MetricSpec *m = &metrics[i];
+        *m = {names[i], (unsigned) (1 + i), true, 0, NULL, false, 0};
+        switch(i % 4){
+        case 0: m->datatype = METRIC_DATA_TYPE_FLOAT;   m->variable = &m_float[i];  break;
+        case 1: m->datatype = METRIC_DATA_TYPE_BOOLEAN; m->variable = &m_bool[i];   break;
+        case 2: m->datatype = METRIC_DATA_TYPE_INT64;   m->variable = &m_int[i];    break;
+        case 3: m->datatype = METRIC_DATA_TYPE_STRING;  m->variable = &m_string[i]; break;
+        }
+    }
+}
+
+// Decode both births with nanopb and compare them metric by metric
+static void check_same(PubSubClient *generic, PubSubClient *cached, const char *what){
+    CHECK(cached->message.size() == cached->declared, "%s: %zu bytes sent, %u declared",
+          what, cached->message.size(), cached->declared);
+    sparkplugb_arduino_decoder g, c;
+    bool decoded = g.decode(generic->message.data(), generic->message.size()) &&
+                   c.decode(cached->message.data(), cached->message.size());
+    CHECK(decoded, "%s: cached birth doesn't decode", what);
+    if(decoded){
+        const Payload *p = &g.payload, *q = &c.payload;
+        CHECK(p->timestamp == q->timestamp && p->seq == q->seq, "%s: header differs", what);
+        CHECK(p->metrics_count == NUM_METRICS + 1, "%s: %d metrics", what, (int) p->metrics_count);
+        CHECK(p->metrics_count == q->metrics_count, "%s: %d metrics, cached %d", what,
+              (int) p->metrics_count, (int) q->metrics_count);
+        for(unsigned i = 0; i < p->metrics_count; i++){
+            const Metric *x = &p->metrics[i];
+            bool same = false;
+            for(unsigned j = 0; j < q->metrics_count; j++){
+                const Metric *y = &q->metrics[j];
+                if(x->alias == y->alias && !strcmp(x->name, y->name)){
+                    same = x->timestamp == y->timestamp && x->datatype == y->datatype &&
+                           x->which_value == y->which_value;
+                    if(x->datatype == METRIC_DATA_TYPE_STRING)
+                        same = same && !strcmp(x->value.string_value, y->value.string_value);
+                    else
+                        same = same && !memcmp(&x->value, &y->value, sizeof(uint64_t));
+                }
+            }
+            CHECK(same, "%s: metric %d differs", what, (int) x->alias);
+        }
+    }
+    g.free_payload();
+    c.free_payload();
+}
+
+// Births as the metrics change between them: a fifth updated each time,
+// strings changing length, and some timestamps cleared
+static void test_round_trip(void){
+    PubSubClient generic, cached;
+    for(int k = 0; k < 100; k++){
+        now_ms += 1000;
+        for(int i = 0; i < NUM_METRICS; i++){
+            if((i + k) % 5 == 0){
+                m_float[i] = sinf(i * k);
+                m_bool[i] = !m_bool[i];
+                m_int[i] = (uint64_t) k << (i % 50);
+                snprintf(m_text[i], TEXT_LEN, "s%d-%d%s", i, k, (k % 3) ? "" : " and a longer text");
+                update_metric_handle(&metrics[i]);
+            }
+        }
+        if(k % 10 == 0){
+            for(int i = 0; i < NUM_METRICS; i += 7)
+                metrics[i].timestamp = 0;
+        }
+
+        // The generic birth gives unset timestamps the payload's, so give
+        // the cached birth the same starting point
+        unsigned long long timestamps[NUM_METRICS];
+        for(int i = 0; i < NUM_METRICS; i++)
+            timestamps[i] = metrics[i].timestamp;
+        set_up_nbirth_payload();
+        add_metrics(true, bdSeqMetric, 1);
+        CHECK(publish_metrics(&generic, 1, "t", true, metrics, NUM_METRICS), "generic: %s", cf_sparkplug_error);
+        for(int i = 0; i < NUM_METRICS; i++)
+            metrics[i].timestamp = timestamps[i];
+        set_up_nbirth_payload();
+        add_metrics(true, bdSeqMetric, 1);
+        CHECK(publish_birth_metrics(&cached, 1, "t", metrics, NUM_METRICS), "cached: %s", cf_sparkplug_error);
+
+        char what[32];
+        snprintf(what, sizeof(what), "birth %d", k);
+        check_same(&generic, &cached, what);
+    }
+}
+
+template<typename F>
+static double time_us(F publish, int births){
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < births; i++){
+        set_up_nbirth_payload();
+        add_metrics(true, bdSeqMetric, 1);
+        publish();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / births;
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    set_up_metrics();
+    CHECK(check_metrics(bdSeqMetric, 1, 1), "%s", cf_sparkplug_error);
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+    set_max_metrics(NUM_METRICS + 1);
+    CHECK(cache_birth_metrics(metrics, NUM_METRICS), "cache: %s", cf_sparkplug_error);
+    test_round_trip();
+
+    PubSubClient broker;
+    const int births = 20000;
+    double generic_us = time_us([&]{ publish_metrics(&broker, 1, "t", true, metrics, NUM_METRICS); }, births);
+    double cached_us = time_us([&]{ publish_birth_metrics(&broker, 1, "t", metrics, NUM_METRICS); }, births);
+    printf("NBIRTH of %d metrics on the host, %zu bytes: generic %.1f us, cached %.1f us\n",
+           NUM_METRICS, broker.message.size(), generic_us, cached_us);
+    CHECK(cached_us < generic_us, "cached no faster");
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
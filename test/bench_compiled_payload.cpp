@@ -0,0 +1,182 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file bench_compiled_payload.cpp
+ * @brief Checks that the NDATA sent from a compiled payload, with its padded
+ * varints, decodes with nanopb to the same metrics as the generic encoding,
+ * and times the two.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include "cf_sparkplug.h"
+
+#define NUM_CHANNELS  12
+#define NUM_COMPILED  (3 * NUM_CHANNELS)
+#define NUM_METRICS   (NUM_COMPILED + 2)
+
+static float    m_pwr[NUM_CHANNELS];
+static bool     m_dir[NUM_CHANNELS];
+static float    m_data[NUM_CHANNELS];
+static float    m_other = 0;
+static uint64_t m_count = 0;
+static MetricSpec metrics[NUM_METRICS];
+static MetricSpec *handles[NUM_COMPILED];
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+static unsigned long long now_ms = 1760000000000ULL;
+static unsigned long long get_timestamp(void){
+    return now_ms;
+}
+
+// The channels' power, direction and data metrics are compiled, as in
+// ThermoElectricNetwork.cpp, and two node metrics are left to the generic
+// encoder
+static void set_up_metrics(void){
+    for(int c = 0; c < NUM_CHANNELS; c++){
+        metrics[3 * c]     = {"Inputs/Power",      (unsigned) (1 + 3 * c), true,  METRIC_DATA_TYPE_FLOAT,   &m_pwr[c],  false, 0};
+        metrics[3 * c + 1] = {"Outputs/Direction", (unsigned) (2 + 3 * c), false, METRIC_DATA_TYPE_BOOLEAN, &m_dir[c],  false, 0};
+        metrics[3 * c + 2] = {"Outputs/Data",      (unsigned) (3 + 3 * c), false, METRIC_DATA_TYPE_FLOAT,   &m_data[c], false, 0};
+    }
+    metrics[NUM_COMPILED]     = {"Node/Other", NUM_COMPILED + 1, true, METRIC_DATA_TYPE_FLOAT, &m_other, false, 0};
+    metrics[NUM_COMPILED + 1] = {"Node/Count", NUM_COMPILED + 2, true, METRIC_DATA_TYPE_INT64, &m_count, false, 0};
+    for(int i = 0; i < NUM_COMPILED; i++)
+        handles[i] = &metrics[i];
+}
+
+// Decode both messages with nanopb and compare them metric by metric.  The
+// compiled message was published second, so its sequence number is one on.
+static void check_same(PubSubClient *generic, PubSubClient *compiled, const char *what){
+    CHECK(compiled->message.size() == compiled->declared, "%s: %zu bytes sent, %u declared",
+          what, compiled->message.size(), compiled->declared);
+    sparkplugb_arduino_decoder g, c;
+    bool decoded = g.decode(generic->message.data(), generic->message.size()) &&
+                   c.decode(compiled->message.data(), compiled->message.size());
+    CHECK(decoded, "%s: compiled message doesn't decode", what);
+    if(decoded){
+        const Payload *p = &g.payload, *q = &c.payload;
+        CHECK(p->timestamp == q->timestamp, "%s: payload timestamp %llu, compiled %llu", what,
+              (unsigned long long) p->timestamp, (unsigned long long) q->timestamp);
+        CHECK(q->has_seq && q->seq == (p->seq + 1) % 256, "%s: seq %llu after %llu", what,
+              (unsigned long long) q->seq, (unsigned long long) p->seq);
+        CHECK(p->metrics_count > 0, "%s: no metrics", what);
+        CHECK(p->metrics_count == q->metrics_count, "%s: %d metrics, compiled %d", what,
+              (int) p->metrics_count, (int) q->metrics_count);
+        for(unsigned i = 0; i < p->metrics_count; i++){
+            const Metric *x = &p->metrics[i];
+            bool same = false;
+            for(unsigned j = 0; j < q->metrics_count; j++){
+                const Metric *y = &q->metrics[j];
+                if(x->alias == y->alias)
+                    same = x->timestamp == y->timestamp && x->datatype == y->datatype &&
+                           x->which_value == y->which_value && !memcmp(&x->value, &y->value, sizeof(x->value));
+            }
+            CHECK(same, "%s: metric %d differs", what, (int) x->alias);
+        }
+    }
+    g.free_payload();
+    c.free_payload();
+}
+
+// Publish the same updates both ways
+template<typename F>
+static void publish_both(PubSubClient *generic, PubSubClient *compiled, F update){
+    set_up_next_payload();
+    update();
+    publish_metrics(generic, 1, "t", false, metrics, NUM_METRICS);
+    set_up_next_payload();
+    update();
+    publish_compiled_metrics(compiled, 1, "t", metrics, NUM_METRICS);
+}
+
+static void test_round_trip(void){
+    PubSubClient generic, compiled;
+    for(int k = 0; k < 200; k++){
+        now_ms += 6000;
+        for(int c = 0; c < NUM_CHANNELS; c++){
+            m_pwr[c] = sinf(k + c) * 100;
+            m_dir[c] = (k + c) & 1;
+            m_data[c] = k * 0.001f + c - 6;
+        }
+        m_other = -k;
+        m_count = 1ULL << (k % 64);
+        bool extra = k % 3 == 0;
+        // A metric never timestamped takes the payload's, which is shorter
+        // than the room left for it
+        if(k % 7 == 0)
+            handles[5]->timestamp = 0;
+        publish_both(&generic, &compiled, [extra]{
+            update_metric_handles(handles, NUM_COMPILED);
+            if(extra){
+                update_metric_handle(&metrics[NUM_COMPILED]);
+                update_metric_handle(&metrics[NUM_COMPILED + 1]);
+            }
+        });
+        char what[32];
+        snprintf(what, sizeof(what), "message %d", k);
+        check_same(&generic, &compiled, what);
+    }
+
+    // Some of the compiled metrics left out
+    publish_both(&generic, &compiled, []{
+        update_metric_handles(handles, 5);
+        update_metric_handle(&metrics[NUM_COMPILED]);
+    });
+    check_same(&generic, &compiled, "partial update");
+    printf("generic %zu bytes, compiled %zu bytes for a partial update\n",
+           generic.message.size(), compiled.message.size());
+}
+
+template<typename F>
+static double time_us(F publish, int messages){
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < messages; i++){
+        set_up_next_payload();
+        update_metric_handles(handles, NUM_COMPILED);
+        publish();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(end - start).count() / messages;
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    set_up_metrics();
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+    CHECK(compile_payload(handles, NUM_COMPILED), "compile: %s", cf_sparkplug_error);
+    test_round_trip();
+
+    PubSubClient broker;
+    const int messages = 100000;
+    double generic_us = time_us([&]{ publish_metrics(&broker, 1, "t", false, metrics, NUM_METRICS); }, messages);
+    size_t generic_bytes = broker.message.size();
+    double compiled_us = time_us([&]{ publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS); }, messages);
+    printf("NDATA of %d channel metrics on the host: generic %.2f us, %zu bytes; compiled %.2f us, %zu bytes\n",
+           NUM_COMPILED, generic_us, generic_bytes, compiled_us, broker.message.size());
+    CHECK(compiled_us < generic_us, "compiled no faster");
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
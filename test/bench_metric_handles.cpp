@@ -0,0 +1,154 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file bench_metric_handles.cpp
+ * @brief Times a publish cycle's channel metric updates done the old way, by
+ * searching the metric table for each variable, against the handles looked
+ * up once, and checks that both mark the same metrics.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include "cf_sparkplug.h"
+
+#define NUM_CHANNELS   12
+#define NUM_METRICS    47   // Size of NodeMetrics
+#define FIRST_CHANNEL  11   // Where its channel metrics start
+
+static float    m_pwr[NUM_CHANNELS];
+static bool     m_dir[NUM_CHANNELS];
+static float    m_data[NUM_CHANNELS];
+static uint64_t m_other[NUM_METRICS];
+static MetricSpec metrics[NUM_METRICS];
+static MetricSpec *handles[NUM_CHANNELS][3];
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+// Counts the timestamp reads, which are an NTP clock read on the module
+static unsigned long long timestamps = 0;
+static unsigned long long get_timestamp(void){
+    timestamps++;
+    return 1700000000000ULL + timestamps;
+}
+
+// A table laid out like NodeMetrics, with the channels' power, direction and
+// data metrics after the node metrics
+static void set_up_metrics(void){
+    for(int i = 0; i < NUM_METRICS; i++){
+        int channel = (i - FIRST_CHANNEL) % NUM_CHANNELS;
+        int kind = (i - FIRST_CHANNEL) / NUM_CHANNELS;
+        MetricSpec *m = &metrics[i];
+        m->name = "Metric";
+        m->alias = i + 1;
+        if(i >= FIRST_CHANNEL && kind == 0){
+            m->writable = true;
+            m->datatype = METRIC_DATA_TYPE_FLOAT;
+            m->variable = &m_pwr[channel];
+        }
+        else if(i >= FIRST_CHANNEL && kind == 1){
+            m->datatype = METRIC_DATA_TYPE_BOOLEAN;
+            m->variable = &m_dir[channel];
+        }
+        else if(i >= FIRST_CHANNEL && kind == 2){
+            m->datatype = METRIC_DATA_TYPE_FLOAT;
+            m->variable = &m_data[channel];
+        }
+        else{
+            m->datatype = METRIC_DATA_TYPE_INT64;
+            m->variable = &m_other[i];
+        }
+    }
+    for(int c = 0; c < NUM_CHANNELS; c++){
+        handles[c][0] = find_metric_by_variable(metrics, NUM_METRICS, &m_pwr[c]);
+        handles[c][1] = find_metric_by_variable(metrics, NUM_METRICS, &m_dir[c]);
+        handles[c][2] = find_metric_by_variable(metrics, NUM_METRICS, &m_data[c]);
+    }
+}
+
+static void clear_updates(void){
+    for(int i = 0; i < NUM_METRICS; i++)
+        metrics[i].updated = false;
+}
+
+// Before: each of the 12 publish_data() calls in a cycle updated every
+// channel's metrics, searching the table for each
+static void cycle_by_search(void){
+    for(int call = 0; call < NUM_CHANNELS; call++){
+        for(int c = 0; c < NUM_CHANNELS; c++){
+            update_metric(metrics, NUM_METRICS, &m_pwr[c]);
+            update_metric(metrics, NUM_METRICS, &m_dir[c]);
+            update_metric(metrics, NUM_METRICS, &m_data[c]);
+        }
+    }
+}
+
+// After: each call updates its own channel through the handles
+static void cycle_by_handle(void){
+    for(int c = 0; c < NUM_CHANNELS; c++)
+        update_metric_handles(handles[c], 3);
+}
+
+template<typename F>
+static double time_us(F cycle, int cycles, unsigned long long *reads){
+    timestamps = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < cycles; i++)
+        cycle();
+    auto end = std::chrono::steady_clock::now();
+    *reads = timestamps / cycles;
+    return std::chrono::duration<double, std::micro>(end - start).count() / cycles;
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    set_up_metrics();
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+
+    // Both ways mark exactly the channel metrics
+    bool by_search[NUM_METRICS];
+    clear_updates();
+    cycle_by_search();
+    for(int i = 0; i < NUM_METRICS; i++)
+        by_search[i] = metrics[i].updated;
+    clear_updates();
+    cycle_by_handle();
+    int marked = 0;
+    for(int i = 0; i < NUM_METRICS; i++){
+        CHECK(metrics[i].updated == by_search[i], "metric %d marked differently", i);
+        marked += metrics[i].updated;
+    }
+    CHECK(marked == 3 * NUM_CHANNELS, "%d metrics marked", marked);
+
+    const int cycles = 20000;
+    unsigned long long search_reads, handle_reads;
+    double search_us = time_us(cycle_by_search, cycles, &search_reads);
+    double handle_us = time_us(cycle_by_handle, cycles, &handle_reads);
+    printf("publish cycle on the host: by search %.2f us with %llu timestamp reads, "
+           "by handle %.3f us with %llu\n", search_us, search_reads, handle_us, handle_reads);
+    CHECK(handle_reads == NUM_CHANNELS, "%llu timestamp reads by handle", handle_reads);
+    CHECK(handle_us < search_us, "handles no faster");
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
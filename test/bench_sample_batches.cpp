@@ -0,0 +1,207 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file bench_sample_batches.cpp
+ * @brief Checks that batches of data samples decode with nanopb to one metric
+ * per sample with its own timestamp, all but the newest historical, through
+ * both the compiled and generic NDATA, and times a batched NDATA against one
+ * carrying a sample per channel.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <chrono>
+#include "cf_sparkplug.h"
+
+#define NUM_CHANNELS  12
+#define NUM_METRICS   (3 * NUM_CHANNELS)
+#define NUM_SAMPLES   60    // A 6 s batch interval of 100 ms samples
+
+static float    m_pwr[NUM_CHANNELS];
+static bool     m_dir[NUM_CHANNELS];
+static float    m_data[NUM_CHANNELS];
+static MetricSpec metrics[NUM_METRICS];
+static MetricSpec *handles[NUM_METRICS];
+
+static float              values[NUM_CHANNELS][NUM_SAMPLES];       // Oldest first
+static unsigned long long times[NUM_CHANNELS][NUM_SAMPLES];
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+static unsigned long long now_ms = 1760000000000ULL;
+static unsigned long long get_timestamp(void){
+    return now_ms;
+}
+
+// The channels' power, direction and data metrics, compiled as in
+// ThermoElectricNetwork.cpp
+static void set_up_metrics(void){
+    for(int c = 0; c < NUM_CHANNELS; c++){
+        metrics[3 * c]     = {"Inputs/Power",      (unsigned) (1 + 3 * c), true,  METRIC_DATA_TYPE_FLOAT,   &m_pwr[c],  false, 0};
+        metrics[3 * c + 1] = {"Outputs/Direction", (unsigned) (2 + 3 * c), false, METRIC_DATA_TYPE_BOOLEAN, &m_dir[c],  false, 0};
+        metrics[3 * c + 2] = {"Outputs/Data",      (unsigned) (3 + 3 * c), false, METRIC_DATA_TYPE_FLOAT,   &m_data[c], false, 0};
+    }
+    for(int i = 0; i < NUM_METRICS; i++)
+        handles[i] = &metrics[i];
+}
+
+// A batch of samples 100 ms apart for each channel, ending now, with the
+// newest in the data variable
+static void fill_batches(void){
+    for(int c = 0; c < NUM_CHANNELS; c++){
+        for(int k = 0; k < NUM_SAMPLES; k++){
+            values[c][k] = 20 + c + k * 0.01f;
+            times[c][k] = now_ms - (NUM_SAMPLES - 1 - k) * 100;
+        }
+        m_data[c] = values[c][NUM_SAMPLES - 1];
+        m_pwr[c] = c;
+    }
+}
+
+static void add_batches(int samples){
+    for(int c = 0; c < NUM_CHANNELS; c++)
+        CHECK(add_metric_samples(handles[3 * c + 2], values[c] + NUM_SAMPLES - samples,
+                                 times[c] + NUM_SAMPLES - samples, samples),
+              "channel %d: %s", c, cf_sparkplug_error);
+}
+
+// Decode the message and check that each channel's data metrics are its
+// samples, oldest first, with only the newest not historical.  The other
+// metrics should be the power and direction metrics if they were updated.
+static void check_batches(PubSubClient *broker, int samples, bool updated, const char *what){
+    CHECK(broker->message.size() == broker->declared, "%s: %zu bytes sent, %u declared",
+          what, broker->message.size(), broker->declared);
+    sparkplugb_arduino_decoder d;
+    bool decoded = d.decode(broker->message.data(), broker->message.size());
+    CHECK(decoded, "%s: doesn't decode", what);
+    if(decoded){
+        const Payload *p = &d.payload;
+        int others = updated ? 2 * NUM_CHANNELS : 0;
+        CHECK((int) p->metrics_count == NUM_CHANNELS * samples + others, "%s: %d metrics",
+              what, (int) p->metrics_count);
+        int next[NUM_CHANNELS] = {0};
+        for(unsigned i = 0; i < p->metrics_count; i++){
+            const Metric *m = &p->metrics[i];
+            int c = (m->alias - 1) / 3;
+            CHECK(m->alias >= 1 && m->alias <= NUM_METRICS, "%s: alias %d", what, (int) m->alias);
+            if(m->alias < 1 || m->alias > NUM_METRICS)
+                continue;
+            bool historical = m->has_is_historical && m->is_historical;
+            if((m->alias - 1) % 3 != 2){
+                CHECK(updated && !historical, "%s: metric %d", what, (int) m->alias);
+                continue;
+            }
+            int k = NUM_SAMPLES - samples + next[c]++;
+            CHECK(k < NUM_SAMPLES, "%s: channel %d has too many samples", what, c);
+            if(k >= NUM_SAMPLES)
+                continue;
+            CHECK(m->timestamp == times[c][k] && m->value.float_value == values[c][k],
+                  "%s: channel %d sample %d differs", what, c, k);
+            CHECK(historical == (k < NUM_SAMPLES - 1), "%s: channel %d sample %d historical %d",
+                  what, c, k, historical);
+        }
+        for(int c = 0; c < NUM_CHANNELS; c++)
+            CHECK(next[c] == samples, "%s: channel %d has %d samples", what, c, next[c]);
+    }
+    d.free_payload();
+}
+
+static void test_batches(void){
+    PubSubClient broker;
+    fill_batches();
+    now_ms += 50;
+
+    // The power and direction metrics updated, the data from the batches,
+    // which replace the data metrics' pending updates
+    set_up_next_payload();
+    update_metric_handles(handles, NUM_METRICS);
+    add_batches(NUM_SAMPLES);
+    CHECK(publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS), "compiled: %s", cf_sparkplug_error);
+    check_batches(&broker, NUM_SAMPLES, true, "compiled");
+    CHECK(metrics[2].timestamp == times[0][NUM_SAMPLES - 1], "data timestamp %llu",
+          metrics[2].timestamp);
+    printf("NDATA of %d x %d samples: %zu bytes\n", NUM_CHANNELS, NUM_SAMPLES, broker.message.size());
+
+    set_up_next_payload();
+    update_metric_handles(handles, NUM_METRICS);
+    add_batches(NUM_SAMPLES);
+    CHECK(publish_metrics(&broker, 1, "t", false, metrics, NUM_METRICS), "generic: %s", cf_sparkplug_error);
+    check_batches(&broker, NUM_SAMPLES, true, "generic");
+
+    // Samples alone, and a single sample, which isn't historical
+    set_up_next_payload();
+    add_batches(3);
+    CHECK(publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS), "samples only: %s", cf_sparkplug_error);
+    check_batches(&broker, 3, false, "samples only");
+    set_up_next_payload();
+    add_batches(1);
+    CHECK(publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS), "one sample: %s", cf_sparkplug_error);
+    check_batches(&broker, 1, false, "one sample");
+
+    // Published batches are gone from the next payload
+    set_up_next_payload();
+    CHECK(!publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS), "empty payload published");
+
+    // Empty batches and more than the payload can carry are refused
+    set_up_next_payload();
+    CHECK(!add_metric_samples(handles[2], values[0], times[0], 0), "empty batch added");
+    for(int i = 0; i < MAX_SAMPLE_BATCHES; i++)
+        CHECK(add_metric_samples(handles[2], values[0], times[0], 1), "batch %d refused", i);
+    CHECK(!add_metric_samples(handles[2], values[0], times[0], 1), "batch %d added", MAX_SAMPLE_BATCHES);
+}
+
+template<typename F>
+static double time_us(F add, int messages, size_t *bytes){
+    PubSubClient broker;
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < messages; i++){
+        set_up_next_payload();
+        add();
+        publish_compiled_metrics(&broker, 1, "t", metrics, NUM_METRICS);
+    }
+    auto end = std::chrono::steady_clock::now();
+    *bytes = broker.message.size();
+    return std::chrono::duration<double, std::micro>(end - start).count() / messages;
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    set_up_metrics();
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+    CHECK(compile_payload(handles, NUM_METRICS), "compile: %s", cf_sparkplug_error);
+    test_batches();
+
+    const int messages = 2000;
+    size_t batched_bytes, single_bytes;
+    double batched_us = time_us([]{ add_batches(NUM_SAMPLES); }, messages, &batched_bytes);
+    double single_us = time_us([]{
+        for(int c = 0; c < NUM_CHANNELS; c++)
+            force_update_metric_handle(handles[3 * c + 2]);
+    }, messages, &single_bytes);
+    printf("on the host: %d x %d samples %.1f us, %zu bytes (%.1f bytes a sample); "
+           "one sample a channel %.2f us, %zu bytes\n", NUM_CHANNELS, NUM_SAMPLES, batched_us,
+           batched_bytes, (double) batched_bytes / (NUM_CHANNELS * NUM_SAMPLES), single_us, single_bytes);
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
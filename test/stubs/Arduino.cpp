@@ -0,0 +1,15 @@
+// Host versions of the Arduino core functions in Arduino.h
+#include <Arduino.h>
+#include <chrono>
+
+volatile uint32_t ARM_DWT_CYCCNT, ARM_DEMCR, ARM_DWT_CTRL;
+
+static const auto start = std::chrono::steady_clock::now();
+
+uint32_t millis(void){
+    return (uint32_t) std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint32_t micros(void){
+    return (uint32_t) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
@@ -0,0 +1,24 @@
+// Just enough of the Arduino core to build the messaging code on a host
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef uint8_t byte;
+
+#define F_CPU_ACTUAL  600000000
+
+// The cycle counter the profiler reads
+extern volatile uint32_t ARM_DWT_CYCCNT, ARM_DEMCR, ARM_DWT_CTRL;
+#define ARM_DEMCR_TRCENA        (1 << 24)
+#define ARM_DWT_CTRL_CYCCNTENA  (1 << 0)
+
+uint32_t millis(void);
+uint32_t micros(void);
+
+#endif
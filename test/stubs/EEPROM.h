@@ -0,0 +1,5 @@
+// ThermoElectricGlobal.h includes the EEPROM library, which the host code
+// doesn't use
+#ifndef EEPROM_H
+#define EEPROM_H
+#endif
@@ -0,0 +1,42 @@
+// A PubSubClient that keeps the last message streamed to it, so tests can
+// decode what would have been sent to the broker
+#ifndef PUBSUBCLIENT_H
+#define PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <vector>
+
+class PubSubClient {
+ public:
+    std::vector<uint8_t> message;   // Payload of the last message
+    unsigned int declared = 0;      // Length given to beginPublish()
+    bool up = true;
+    size_t room = SIZE_MAX;         // Bytes the socket takes before failing
+    int disconnects = 0;            // DISCONNECT packets sent
+
+    bool connect(const char *, const char *, uint8_t, bool, const uint8_t *, unsigned int){ return up = true; }
+    // Like the real one, this writes DISCONNECT to the socket
+    void disconnect(void){
+        const uint8_t packet[] = {0xE0, 0x00};
+        write(packet, sizeof(packet));
+        disconnects++;
+        up = false;
+    }
+    void abort(void){ up = false; }
+    bool connected(void){ return up; }
+    bool beginPublish(const char *, unsigned int length, bool){
+        declared = length;
+        message.clear();
+        return true;
+    }
+    size_t write(const uint8_t *buffer, size_t size){
+        if(size > room)
+            size = room;
+        room -= size;
+        message.insert(message.end(), buffer, buffer + size);
+        return size;
+    }
+    int endPublish(void){ return 1; }
+};
+
+#endif
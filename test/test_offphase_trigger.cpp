@@ -0,0 +1,183 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file test_offphase_trigger.cpp
+ * @brief Checks that the ADC trigger planned for a Seebeck channel, plus its
+ * settling time and conversion, stays inside the off-phase of every output
+ * on the PWM counter, on a simulated PWM timeline.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "ThermoElectricPwmPlan.h"
+
+// The module's timing: a 50 kHz period, and PWM_SYNC_SETTLE_NS and
+// PWM_SYNC_WINDOW_NS in ticks of the 150 MHz bus clock
+#define PERIOD  3000
+#define SETTLE  300
+#define WINDOW  450
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+// True if any output is on at tick t
+static bool timeline_on(const PwmInterval *on, int num_on, uint32_t t, uint32_t period){
+    for(int i = 0; i < num_on; i++){
+        if(on[i].length >= period)
+            return true;
+        if(on[i].length > 0 && (t + period - on[i].start) % period < on[i].length)
+            return true;
+    }
+    return false;
+}
+
+// True if every output is off from settle ticks before the trigger until the
+// conversion finishes
+static bool quiet_around(const PwmInterval *on, int num_on, uint32_t period,
+                        uint32_t trigger, uint32_t settle, uint32_t window){
+    for(uint32_t k = 0; k < settle + window; k++){
+        if(timeline_on(on, num_on, (trigger + period - settle + k) % period, period))
+            return false;
+    }
+    return true;
+}
+
+// True if there's a trigger anywhere in the period that would do
+static bool any_quiet(const PwmInterval *on, int num_on, uint32_t period,
+                      uint32_t settle, uint32_t window){
+    if(settle + window > period)
+        return false;
+    for(uint32_t t = 0; t < period; t++){
+        if(quiet_around(on, num_on, period, t, settle, window))
+            return true;
+    }
+    return false;
+}
+
+// Plan the trigger and check it against the timeline.  Returns whether a
+// trigger was planned.
+static bool check_plan(const PwmInterval *on, int num_on, uint32_t period,
+                       uint32_t settle, uint32_t window, const char *what){
+    uint32_t trigger = 0;
+    bool planned = plan_offphase_trigger(on, num_on, period, settle, window, &trigger);
+    if(planned){
+        CHECK(trigger < period, "%s: trigger %u outside the period", what, trigger);
+        CHECK(quiet_around(on, num_on, period, trigger, settle, window),
+              "%s: trigger %u overlaps an on-phase", what, trigger);
+    }
+    CHECK(planned == any_quiet(on, num_on, period, settle, window),
+          "%s: planned %d but an off-phase %s", what, planned,
+          planned ? "doesn't exist" : "exists");
+    return planned;
+}
+
+// One output swept from 0 to 100% duty in 0.5% steps, at several phases.
+// The trigger is found exactly when the off-time is long enough.
+static void test_duty_sweep(void){
+    int planned = 0, cases = 0;
+    for(int half_pct = 0; half_pct <= 200; half_pct++){
+        uint32_t length = (uint32_t) (PERIOD * half_pct / 200);
+        for(uint32_t start = 0; start < PERIOD; start += 125){
+            PwmInterval on = {start, length};
+            char what[48];
+            snprintf(what, sizeof(what), "%.1f%% at %u", half_pct / 2.0, start);
+            bool ok = check_plan(&on, 1, PERIOD, SETTLE, WINDOW, what);
+            CHECK(ok == (PERIOD - length >= SETTLE + WINDOW), "%s: planned %d", what, ok);
+            planned += ok;
+            cases++;
+        }
+    }
+    printf("one output: %d of %d duties and phases have a trigger\n", planned, cases);
+}
+
+// The A, B and X outputs of a submodule together, at random duties and
+// phases, as the stagger may leave them
+static void test_submodule(void){
+    int planned = 0;
+    const int trials = 20000;
+    for(int trial = 0; trial < trials; trial++){
+        PwmInterval on[3];
+        int num_on = 1 + rand() % 3;
+        for(int i = 0; i < num_on; i++){
+            uint32_t length = (rand() % 4 == 0) ? 0 : rand() % (PERIOD / 2);
+            on[i].length = length;
+            // X switches on at the end of the period, A and B anywhere
+            on[i].start = (i == 2) ? PERIOD - length : rand() % PERIOD;
+        }
+        planned += check_plan(on, num_on, PERIOD, SETTLE, WINDOW, "submodule");
+    }
+    printf("submodule: %d of %d random timelines have a trigger\n", planned, trials);
+}
+
+// The edges: everything off, always on, the shortest off-time that will do
+// and one tick less, and timings that can't fit in the period
+static void test_edges(void){
+    uint32_t trigger = 0;
+
+    PwmInterval off[2] = {{0, 0}, {1500, 0}};
+    CHECK(plan_offphase_trigger(off, 2, PERIOD, SETTLE, WINDOW, &trigger), "0%% refused");
+    CHECK(trigger == SETTLE, "0%%: trigger %u", trigger);
+    CHECK(plan_offphase_trigger(off, 0, PERIOD, SETTLE, WINDOW, &trigger), "no outputs refused");
+
+    PwmInterval full = {0, PERIOD};
+    CHECK(!plan_offphase_trigger(&full, 1, PERIOD, SETTLE, WINDOW, &trigger), "100%% planned");
+    PwmInterval full_late = {1234, PERIOD};
+    CHECK(!plan_offphase_trigger(&full_late, 1, PERIOD, SETTLE, WINDOW, &trigger), "100%% at a phase planned");
+    PwmInterval with_full[2] = {{0, 100}, {500, PERIOD}};
+    CHECK(!plan_offphase_trigger(with_full, 2, PERIOD, SETTLE, WINDOW, &trigger), "100%% beside another planned");
+
+    // The shortest off-time: the conversion ends on the tick the output
+    // switches back on
+    for(uint32_t start = 0; start < PERIOD; start += 250){
+        PwmInterval on = {start, PERIOD - SETTLE - WINDOW};
+        CHECK(check_plan(&on, 1, PERIOD, SETTLE, WINDOW, "minimum off-time"), "minimum off-time at %u refused", start);
+        plan_offphase_trigger(&on, 1, PERIOD, SETTLE, WINDOW, &trigger);
+        CHECK(trigger == (start + on.length + SETTLE) % PERIOD, "minimum off-time at %u: trigger %u", start, trigger);
+        CHECK((trigger + WINDOW) % PERIOD == start, "minimum off-time at %u: conversion ends at %u",
+              start, (trigger + WINDOW) % PERIOD);
+        on.length++;
+        CHECK(!check_plan(&on, 1, PERIOD, SETTLE, WINDOW, "one tick short"), "one tick short at %u planned", start);
+    }
+
+    // Two outputs leaving the minimum gap between them, the other gap shorter
+    PwmInterval two[2] = {{0, 1000}, {1000 + SETTLE + WINDOW, PERIOD - 1000 - SETTLE - WINDOW - 100}};
+    CHECK(check_plan(two, 2, PERIOD, SETTLE, WINDOW, "two outputs"), "two outputs refused");
+    plan_offphase_trigger(two, 2, PERIOD, SETTLE, WINDOW, &trigger);
+    CHECK(trigger == 1000 + SETTLE, "two outputs: trigger %u", trigger);
+
+    // Touching outputs leave no off-phase between them
+    PwmInterval touching[2] = {{0, 1500}, {1500, 1400}};
+    CHECK(!check_plan(touching, 2, PERIOD, SETTLE, WINDOW, "touching"), "touching outputs planned");
+
+    CHECK(!plan_offphase_trigger(off, 2, SETTLE + WINDOW - 1, SETTLE, WINDOW, &trigger), "timing longer than the period planned");
+    CHECK(!plan_offphase_trigger(off, 2, 0, SETTLE, WINDOW, &trigger), "zero period planned");
+}
+
+int main(void){
+    srand(1);
+    test_duty_sweep();
+    test_submodule();
+    test_edges();
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
@@ -0,0 +1,101 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file test_publish_stream.cpp
+ * @brief Checks that a payload streamed to the brokers arrives whole at each
+ * one that takes it, and that a broker whose socket fails partway through is
+ * dropped without anything more being written to it.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include "cf_sparkplug.h"
+
+#define NUM_METRICS  40
+
+static float      values[NUM_METRICS];
+static MetricSpec metrics[NUM_METRICS];
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+static unsigned long long get_timestamp(void){
+    return 1760000000000ULL;
+}
+
+// Publish every metric to the brokers
+static bool publish_all(PubSubClient *brokers, int num_brokers){
+    set_up_next_payload();
+    for(int i = 0; i < NUM_METRICS; i++){
+        values[i] = i * 0.5f;
+        update_metric_handle(&metrics[i]);
+    }
+    return publish_metrics(brokers, num_brokers, "t", false, metrics, NUM_METRICS);
+}
+
+// The whole message arrived and decodes to every metric
+static void check_whole(PubSubClient *broker, const char *what){
+    CHECK(broker->message.size() == broker->declared, "%s: %zu bytes of %u", what,
+          broker->message.size(), broker->declared);
+    sparkplugb_arduino_decoder d;
+    CHECK(d.decode(broker->message.data(), broker->message.size()) &&
+          d.payload.metrics_count == NUM_METRICS, "%s: doesn't decode", what);
+    d.free_payload();
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    for(int i = 0; i < NUM_METRICS; i++)
+        metrics[i] = {"Metric", (unsigned) (i + 1), false, METRIC_DATA_TYPE_FLOAT, &values[i], false, 0};
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+
+    PubSubClient brokers[2];
+    CHECK(publish_all(brokers, 2), "%s", cf_sparkplug_error);
+    check_whole(&brokers[0], "broker 0");
+    check_whole(&brokers[1], "broker 1");
+
+    // The second broker's socket fails partway through, at every point in the
+    // message.  It's dropped without a DISCONNECT, which would land inside the
+    // publish, and the first still gets the whole message.
+    size_t length = brokers[0].declared;
+    for(size_t room = 0; room < length; room++){
+        brokers[0] = PubSubClient();
+        brokers[1] = PubSubClient();
+        brokers[1].room = room;
+        CHECK(publish_all(brokers, 2), "room %zu: %s", room, cf_sparkplug_error);
+        check_whole(&brokers[0], "the other broker");
+        CHECK(!brokers[1].connected(), "room %zu: failed broker still connected", room);
+        CHECK(brokers[1].disconnects == 0, "room %zu: DISCONNECT sent into the publish", room);
+        CHECK(brokers[1].message.size() == room, "room %zu: %zu bytes written", room,
+              brokers[1].message.size());
+    }
+
+    // With every broker failing, nothing is published
+    brokers[0] = PubSubClient();
+    brokers[0].room = length / 2;
+    CHECK(!publish_all(brokers, 1), "failed publish reported as published");
+    CHECK(!brokers[0].connected() && brokers[0].disconnects == 0, "failed broker not dropped");
+    printf("a %zu byte message failed at every byte: the failed broker was dropped each time\n", length);
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
@@ -0,0 +1,288 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file test_pwm_plan.cpp
+ * @brief Checks the PWM phase planning against a simulated PWM timeline: the
+ * even spread, packing of duties that fill the period, and the peak overlap
+ * of each stagger mode.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Built in, so the greedy and packed placements can be checked on their own
+#include "ThermoElectricPwmPlan.cpp"
+
+#define PERIOD  3000    // FlexPWM ticks in a 50 kHz period
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+// Most outputs on at once, tick by tick
+static int timeline_peak(const PwmPhase *outputs, int num, uint32_t period){
+    int peak = 0;
+    for(uint32_t t = 0; t < period; t++){
+        int n = 0;
+        for(int i = 0; i < num; i++){
+            const PwmInterval *on = &outputs[i].on;
+            if(on->length >= period || (on->length > 0 && (t + period - on->start) % period < on->length))
+                n++;
+        }
+        if(n > peak)
+            peak = n;
+    }
+    return peak;
+}
+
+// No plan can do better than the total on time spread over the period, or
+// than the peak of the outputs it can't move
+static int lower_bound(const PwmPhase *outputs, int num, uint32_t period){
+    uint64_t total = 0;
+    PwmPhase fixed[PLAN_MAX_OUTPUTS];
+    int num_fixed = 0;
+    for(int i = 0; i < num; i++){
+        total += outputs[i].on.length;
+        if(!outputs[i].movable)
+            fixed[num_fixed++] = outputs[i];
+    }
+    int bound = (int) ((total + period - 1) / period);
+    int fixed_peak = timeline_peak(fixed, num_fixed, period);
+    return (fixed_peak > bound) ? fixed_peak : bound;
+}
+
+// Fixed outputs stay put and movable ones don't wrap
+static void check_placement(const PwmPhase *before, const PwmPhase *after, int num,
+                            uint32_t period, const char *how){
+    for(int i = 0; i < num; i++){
+        if(!before[i].movable)
+            CHECK(after[i].on.start == before[i].on.start, "%s moved fixed output %d", how, i);
+        else
+            CHECK(after[i].on.start + after[i].on.length <= period, "%s wrapped output %d", how, i);
+        CHECK(after[i].on.length == before[i].on.length, "%s changed the length of output %d", how, i);
+    }
+}
+
+static void random_outputs(PwmPhase *outputs, int num, uint32_t period){
+    for(int i = 0; i < num; i++){
+        uint32_t length = (rand() % 5 == 0) ? 0 : rand() % (period + 1);
+        if(rand() % 3 == 0)
+            length = rand() % (period / 4);
+        outputs[i].on.length = length;
+        outputs[i].movable = rand() % 6 != 0;
+        // Fixed outputs are X outputs, which switch on at the end of the period
+        outputs[i].on.start = outputs[i].movable ? rand() % period : period - length;
+    }
+}
+
+// plan_peak_overlap() against the timeline, including wrapped and full
+// length intervals
+static void test_peak_overlap(void){
+    for(int trial = 0; trial < 2000; trial++){
+        int num = 1 + rand() % PLAN_MAX_OUTPUTS;
+        PwmPhase outputs[PLAN_MAX_OUTPUTS];
+        PwmInterval on[PLAN_MAX_OUTPUTS];
+        for(int i = 0; i < num; i++){
+            outputs[i].on.start = rand() % PERIOD;
+            outputs[i].on.length = (rand() % 8 == 0) ? PERIOD : rand() % (PERIOD + 1);
+            on[i] = outputs[i].on;
+        }
+        int peak = plan_peak_overlap(on, num, PERIOD);
+        CHECK(peak == timeline_peak(outputs, num, PERIOD), "peak overlap %d, timeline %d",
+              peak, timeline_peak(outputs, num, PERIOD));
+    }
+}
+
+// Even stagger: the k'th movable output of n starts at k/n of the period,
+// moved back only as far as it needs so as not to wrap
+static void test_even_spread(void){
+    PwmPhase outputs[12];
+    for(int i = 0; i < 12; i++){
+        outputs[i].on.length = 300 + 200 * (i % 3);
+        outputs[i].on.start = 0;
+        outputs[i].movable = true;
+    }
+    outputs[11].on.length = 2900;
+    int peak = plan_phases(outputs, 12, PERIOD, PWM_STAGGER_EVEN);
+    for(int i = 0; i < 12; i++){
+        uint32_t even = PERIOD * i / 12;
+        uint32_t latest = PERIOD - outputs[i].on.length;
+        uint32_t expect = (even < latest) ? even : latest;
+        CHECK(outputs[i].on.start == expect, "even start %d is %u, not %u", i, outputs[i].on.start, expect);
+    }
+    CHECK(peak == timeline_peak(outputs, 12, PERIOD), "even peak %d, timeline %d",
+          peak, timeline_peak(outputs, 12, PERIOD));
+
+    // The spacing only counts the movable outputs, so 10 movable outputs
+    // beside 2 fixed ones are a tenth of the period apart, with no gap left
+    // at the end of the period
+    for(int i = 0; i < 12; i++){
+        outputs[i].on.length = 250;
+        outputs[i].movable = i >= 2;
+        outputs[i].on.start = PERIOD - 250;
+    }
+    plan_phases(outputs, 12, PERIOD, PWM_STAGGER_EVEN);
+    for(int i = 2; i < 12; i++)
+        CHECK(outputs[i].on.start == (uint32_t) (PERIOD * (i - 2) / 10), "even start %d is %u with fixed outputs",
+              i, outputs[i].on.start);
+}
+
+// Duties that add up to whole periods pack into that many levels
+static void test_packed_duties(void){
+    static const uint32_t sets[][8] = {
+        {1800, 1200, 2100, 900, 0},                 // 60+40, 70+30
+        {1500, 1500, 1500, 1500, 1500, 1500, 0},    // 6 x 50%
+        {2000, 2000, 1000, 1000, 0},                // 2 periods, uneven
+        {750, 750, 750, 750, 2250, 750, 0},
+    };
+    for(unsigned s = 0; s < sizeof(sets) / sizeof(sets[0]); s++){
+        PwmPhase outputs[PLAN_MAX_OUTPUTS], before[PLAN_MAX_OUTPUTS];
+        int num = 0;
+        uint32_t total = 0;
+        for(; sets[s][num] != 0; num++){
+            outputs[num].on.start = 0;
+            outputs[num].on.length = sets[s][num];
+            outputs[num].movable = true;
+            total += sets[s][num];
+            before[num] = outputs[num];
+        }
+        PwmPhase packed[PLAN_MAX_OUTPUTS];
+        for(int i = 0; i < num; i++)
+            packed[i] = outputs[i];
+        plan_packed(packed, num, PERIOD);
+        check_placement(before, packed, num, PERIOD, "packed");
+        int levels = (int) (total / PERIOD);
+        CHECK(timeline_peak(packed, num, PERIOD) == levels, "set %u packs into %d, not %d levels",
+              s, timeline_peak(packed, num, PERIOD), levels);
+
+        int peak = plan_phases(outputs, num, PERIOD, PWM_STAGGER_PLANNED);
+        check_placement(before, outputs, num, PERIOD, "planned");
+        CHECK(peak == levels, "set %u planned peak %d, not %d", s, peak, levels);
+        CHECK(peak == timeline_peak(outputs, num, PERIOD), "set %u planned peak %d, timeline %d",
+              s, peak, timeline_peak(outputs, num, PERIOD));
+    }
+}
+
+// The planned stagger uses the better of the greedy and packed placements,
+// preferring greedy, and does no worse than either other mode
+static void test_planned_reduction(void){
+    const int trials = 3000;
+    long total_peak[NUM_PWM_STAGGER_MODES] = {0};
+    int at_bound = 0, packed_chosen = 0;
+    for(int trial = 0; trial < trials; trial++){
+        int num = 1 + rand() % 12;
+        PwmPhase base[PLAN_MAX_OUTPUTS];
+        random_outputs(base, num, PERIOD);
+
+        int peak[NUM_PWM_STAGGER_MODES];
+        PwmPhase planned[PLAN_MAX_OUTPUTS];
+        for(int mode = 0; mode < NUM_PWM_STAGGER_MODES; mode++){
+            PwmPhase outputs[PLAN_MAX_OUTPUTS];
+            for(int i = 0; i < num; i++)
+                outputs[i] = base[i];
+            peak[mode] = plan_phases(outputs, num, PERIOD, mode);
+            check_placement(base, outputs, num, PERIOD, "plan_phases");
+            CHECK(peak[mode] == timeline_peak(outputs, num, PERIOD), "mode %d peak %d, timeline %d",
+                  mode, peak[mode], timeline_peak(outputs, num, PERIOD));
+            total_peak[mode] += peak[mode];
+            if(mode == PWM_STAGGER_PLANNED)
+                for(int i = 0; i < num; i++)
+                    planned[i] = outputs[i];
+        }
+        CHECK(peak[PWM_STAGGER_PLANNED] <= peak[PWM_STAGGER_ALIGNED], "planned %d worse than aligned %d",
+              peak[PWM_STAGGER_PLANNED], peak[PWM_STAGGER_ALIGNED]);
+        CHECK(peak[PWM_STAGGER_PLANNED] >= lower_bound(base, num, PERIOD), "planned %d below the bound",
+              peak[PWM_STAGGER_PLANNED]);
+        if(peak[PWM_STAGGER_PLANNED] == lower_bound(base, num, PERIOD))
+            at_bound++;
+
+        // Repeat the two placements plan_phases() chooses between
+        PwmPhase greedy[PLAN_MAX_OUTPUTS], packed[PLAN_MAX_OUTPUTS];
+        uint32_t target[PLAN_MAX_OUTPUTS];
+        for(int i = 0; i < num; i++)
+            greedy[i] = base[i];
+        plan_phases(greedy, num, PERIOD, PWM_STAGGER_EVEN);
+        for(int i = 0; i < num; i++){
+            target[i] = greedy[i].on.start;
+            packed[i] = greedy[i];
+        }
+        plan_greedy(greedy, num, PERIOD, target);
+        plan_packed(packed, num, PERIOD);
+        check_placement(base, greedy, num, PERIOD, "greedy");
+        check_placement(base, packed, num, PERIOD, "packed");
+        int greedy_peak = timeline_peak(greedy, num, PERIOD);
+        int packed_peak = timeline_peak(packed, num, PERIOD);
+        int best = (packed_peak < greedy_peak) ? packed_peak : greedy_peak;
+        CHECK(peak[PWM_STAGGER_PLANNED] == best, "planned %d, greedy %d, packed %d",
+              peak[PWM_STAGGER_PLANNED], greedy_peak, packed_peak);
+        const PwmPhase *chosen = (packed_peak < greedy_peak) ? packed : greedy;
+        bool same = true;
+        for(int i = 0; i < num; i++)
+            same = same && planned[i].on.start == chosen[i].on.start;
+        CHECK(same, "planned didn't use the %s placement", (packed_peak < greedy_peak) ? "packed" : "greedy");
+        if(packed_peak < greedy_peak)
+            packed_chosen++;
+    }
+    printf("mean peak over %d random sets: aligned %.2f, even %.2f, planned %.2f\n", trials,
+           (double) total_peak[PWM_STAGGER_ALIGNED] / trials, (double) total_peak[PWM_STAGGER_EVEN] / trials,
+           (double) total_peak[PWM_STAGGER_PLANNED] / trials);
+    printf("planned at the lower bound %d/%d, packed placement chosen %d times\n",
+           at_bound, trials, packed_chosen);
+    CHECK(total_peak[PWM_STAGGER_PLANNED] < total_peak[PWM_STAGGER_EVEN], "planned no better than even");
+}
+
+// The module's case: 10 TECs and 2 fixed X outputs, all at 10%
+static void test_module_case(void){
+    int peak[NUM_PWM_STAGGER_MODES];
+    for(int mode = 0; mode < NUM_PWM_STAGGER_MODES; mode++){
+        PwmPhase outputs[12];
+        for(int i = 0; i < 12; i++){
+            outputs[i].on.length = 300;
+            outputs[i].movable = i >= 2;
+            outputs[i].on.start = PERIOD - 300;
+        }
+        peak[mode] = plan_phases(outputs, 12, PERIOD, mode);
+    }
+    printf("12 outputs at 10%%: peak aligned %d, even %d, planned %d\n",
+           peak[PWM_STAGGER_ALIGNED], peak[PWM_STAGGER_EVEN], peak[PWM_STAGGER_PLANNED]);
+    CHECK(peak[PWM_STAGGER_ALIGNED] == 10, "aligned peak %d", peak[PWM_STAGGER_ALIGNED]);
+    CHECK(peak[PWM_STAGGER_PLANNED] == 2, "planned peak %d", peak[PWM_STAGGER_PLANNED]);
+}
+
+static void test_limits(void){
+    PwmPhase outputs[PLAN_MAX_OUTPUTS + 1] = {};
+    CHECK(plan_phases(outputs, PLAN_MAX_OUTPUTS + 1, PERIOD, PWM_STAGGER_PLANNED) == -1, "too many outputs");
+    CHECK(plan_phases(outputs, 0, PERIOD, PWM_STAGGER_PLANNED) == 0, "no outputs");
+    CHECK(plan_phases(outputs, 4, PERIOD, PWM_STAGGER_PLANNED) == 0, "all off");
+}
+
+int main(void){
+    srand(1);
+    test_peak_overlap();
+    test_even_spread();
+    test_packed_duties();
+    test_planned_reduction();
+    test_module_case();
+    test_limits();
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
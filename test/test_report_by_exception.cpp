@@ -0,0 +1,138 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file test_report_by_exception.cpp
+ * @brief Checks that metrics with a deadband are only reported when they move
+ * out of it or have been silent too long, and that a message that fails to
+ * publish leaves them measured against the value last published.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <stdio.h>
+#include "cf_sparkplug.h"
+
+#define NUM_METRICS  3
+#define DEADBAND     0.01f
+#define SILENCE_MS   60000
+
+static float      m_data[2];
+static bool       m_dir;
+static MetricSpec metrics[NUM_METRICS] = {
+    {"Outputs/Data",      1, false, METRIC_DATA_TYPE_FLOAT,   &m_data[0], false, 0},
+    {"Outputs/Direction", 2, false, METRIC_DATA_TYPE_BOOLEAN, &m_dir,     false, 0},
+    {"Outputs/Data",      3, false, METRIC_DATA_TYPE_FLOAT,   &m_data[1], false, 0},
+};
+static MetricSpec *handles[NUM_METRICS] = {&metrics[0], &metrics[1], &metrics[2]};
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+static unsigned long long now_ms = 1760000000000ULL;
+static unsigned long long get_timestamp(void){
+    return now_ms;
+}
+
+// Update every metric 6 s on and publish them, compiled or not.  Returns the
+// aliases reported as a bit mask, or -1 if nothing was published.
+static int publish_cycle(PubSubClient *broker, bool compiled){
+    now_ms += 6000;
+    set_up_next_payload();
+    update_metric_handles(handles, NUM_METRICS);
+    bool published = compiled ? publish_compiled_metrics(broker, 1, "t", metrics, NUM_METRICS) :
+                                publish_metrics(broker, 1, "t", false, metrics, NUM_METRICS);
+    if(!published)
+        return -1;
+    sparkplugb_arduino_decoder d;
+    int reported = 0;
+    if(d.decode(broker->message.data(), broker->message.size())){
+        for(unsigned i = 0; i < d.payload.metrics_count; i++)
+            reported |= 1 << d.payload.metrics[i].alias;
+    }
+    d.free_payload();
+    return reported;
+}
+
+static void test_deadband(bool compiled){
+    const char *how = compiled ? "compiled" : "generic";
+    PubSubClient broker;
+    for(int i = 0; i < NUM_METRICS; i++){
+        metrics[i].reported_at = 0;
+        CHECK(set_metric_deadband(&metrics[i], (i == 1) ? 0 : DEADBAND, false, SILENCE_MS), "deadband");
+    }
+    m_data[0] = m_data[1] = 20;
+    m_dir = false;
+
+    // Everything is reported the first time, then nothing until a value moves
+    // out of its deadband
+    int reported = publish_cycle(&broker, compiled);
+    CHECK(reported == 0xE, "%s: first reports %x", how, reported);
+    m_data[0] = 20.005f;
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == -1, "%s: change inside the deadband reported %x", how, reported);
+    m_data[0] = 20.02f;
+    m_dir = true;
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == 0x6, "%s: changes out of the deadband reported %x", how, reported);
+
+    // A value out of its deadband in a message that's lost is still reported
+    // when the broker is back
+    m_data[1] = 21;
+    broker.up = false;
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == -1, "%s: published with no broker", how);
+    broker.up = true;
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == 0x8, "%s: lost change reported %x", how, reported);
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == -1, "%s: change reported again %x", how, reported);
+
+    // And when the socket fails partway through the message
+    m_data[1] = 22;
+    broker.room = 10;
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == -1, "%s: published to a failed socket", how);
+    broker = PubSubClient();
+    reported = publish_cycle(&broker, compiled);
+    CHECK(reported == 0x8, "%s: change lost in a failed socket reported %x", how, reported);
+
+    // Every metric is reported again within the maximum silence, though
+    // nothing changes
+    int seen = 0;
+    for(int cycle = 0; cycle < SILENCE_MS / 6000; cycle++){
+        reported = publish_cycle(&broker, compiled);
+        if(reported > 0)
+            seen |= reported;
+    }
+    CHECK(seen == 0xE, "%s: %x reported after the maximum silence", how, seen);
+    printf("%s: reported by exception, with lost reports sent again\n", how);
+}
+
+int main(void){
+    set_gettimestamp_callback(get_timestamp);
+    CHECK(check_metrics(metrics, NUM_METRICS, NUM_METRICS + 1), "%s", cf_sparkplug_error);
+    CHECK(compile_payload(handles, NUM_METRICS), "compile: %s", cf_sparkplug_error);
+    test_deadband(false);
+    test_deadband(true);
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}
@@ -0,0 +1,159 @@
+/*******************************************************************************
+Copyright 2022
+Steward Observatory Engineering & Technical Services, University of Arizona
+
+This program is free software: you can redistribute it and/or modify it under
+the terms of the GNU General Public License as published by the Free Software
+Foundation, either version 3 of the License, or any later version.
+
+This program is distributed in the hope that it will be useful, but WITHOUT ANY
+WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License along with
+this program. If not, see <https://www.gnu.org/licenses/>.
+*******************************************************************************/
+
+/**
+ * @file test_thermistor_table.cpp
+ * @brief Compares the thermistor lookup table with the B parameter equation
+ * in double precision, for both thermistors and every ADC count, and times
+ * the lookup against the equation.
+ * @version (see TEC_VERSION in ThermoElectricGlobal.h)
+ * @date 2022-06-01
+ *
+ * @copyright Copyright (c) 2022
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include "ThermoElectricThermistorTable.h"
+
+#define SHIFT  4    // ACQ_AVERAGE_SHIFT: readings are sums of 16 samples
+
+// The thermistors in ThermoElectricController.cpp
+struct ThermistorParams {
+    const char *name;
+    double nominal_ohms;
+    double bcoefficient;
+};
+static const ThermistorParams thermistors[] = {
+    {"thermistor_10K", 10000, 2.514458134e-4},
+    {"thermistor_2K",  2200,  2.544529262e-4},
+};
+#define TEMPERATURENOMINAL  298.15
+#define SERIESRESISTOR      10000
+
+static constexpr ThermistorTable table_10k =
+    make_thermistor_table(10000, 2.514458134e-4, TEMPERATURENOMINAL, SERIESRESISTOR);
+static constexpr ThermistorTable table_2k =
+    make_thermistor_table(2200, 2.544529262e-4, TEMPERATURENOMINAL, SERIESRESISTOR);
+static const ThermistorTable *tables[] = {&table_10k, &table_2k};
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if(!(cond)){ \
+    if(failures++ < 20){ printf("FAIL line %d: ", __LINE__); printf(__VA_ARGS__); printf("\n"); } } } while(0)
+
+// The B parameter equation with the library log, clamped as the table is
+static double equation_celsius(double counts, const ThermistorParams *t){
+    if(counts < 0.5)
+        counts = 0.5;
+    if(counts > THERMISTOR_ADC_COUNTS - 0.5)
+        counts = THERMISTOR_ADC_COUNTS - 0.5;
+    double thermistance = SERIESRESISTOR * (THERMISTOR_ADC_COUNTS / counts - 1.0);
+    return 1.0 / (1.0 / TEMPERATURENOMINAL + t->bcoefficient * log(thermistance / t->nominal_ohms)) - 273.15;
+}
+
+// The conversion the table replaced: a float equation on the average count
+static float old_celsius(uint32_t sum, const ThermistorParams *t){
+    int raw_data = sum >> SHIFT;
+    float voltage = raw_data * 3.3 / 4096.0;
+    float thermistance = 10000 * ((3.3 / voltage) - 1);
+    return (1 / ((1 / TEMPERATURENOMINAL) + t->bcoefficient * log(thermistance / t->nominal_ohms))) - 273.15;
+}
+
+static double lookup_celsius(const ThermistorTable *table, uint32_t sum){
+    return thermistor_lookup(*table, sum, SHIFT) / 1000.0 - 273.15;
+}
+
+// Every table entry is the equation rounded to the millikelvin
+static void test_entries(const ThermistorTable *table, const ThermistorParams *t){
+    double worst = 0;
+    int worst_counts = 0;
+    for(int counts = 0; counts <= THERMISTOR_ADC_COUNTS; counts++){
+        double error = fabs(table->millikelvin[counts] / 1000.0 - 273.15 - equation_celsius(counts, t));
+        if(error > worst){
+            worst = error;
+            worst_counts = counts;
+        }
+    }
+    printf("%s: table entries within %.4f C of the equation (worst at count %d)\n",
+           t->name, worst, worst_counts);
+    CHECK(worst <= 0.0005 + 1e-9, "%s: table entry %d off by %.6f C", t->name, worst_counts, worst);
+}
+
+// Interpolated lookups of every 16-sample sum, by how far the count is from
+// either end of the ADC range.  Near the ends the curve bends too sharply to
+// interpolate well, but those temperatures are far outside what the TECs see.
+static void test_interpolation(const ThermistorTable *table, const ThermistorParams *t){
+    static const struct {
+        int margin;         // Counts from either end left out
+        double limit;       // Largest allowed error, C
+    } ranges[] = {
+        {128, 0.002},
+        {64,  0.0025},
+        {16,  0.05},
+        {1,   -1},          // Reported, not checked
+    };
+    for(unsigned r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++){
+        int margin = ranges[r].margin;
+        double worst = 0;
+        uint32_t worst_sum = 0;
+        for(uint32_t sum = (uint32_t) margin << SHIFT; sum <= (uint32_t) (THERMISTOR_ADC_COUNTS - margin) << SHIFT; sum++){
+            double error = fabs(lookup_celsius(table, sum) - equation_celsius((double) sum / (1 << SHIFT), t));
+            if(error > worst){
+                worst = error;
+                worst_sum = sum;
+            }
+        }
+        double low = equation_celsius(margin, t), high = equation_celsius(THERMISTOR_ADC_COUNTS - margin, t);
+        printf("%s: counts %d to %d (%.1f to %.1f C): within %.4f C (worst at %.2f C)\n", t->name,
+               margin, THERMISTOR_ADC_COUNTS - margin, low, high, worst,
+               equation_celsius((double) worst_sum / (1 << SHIFT), t));
+        if(ranges[r].limit > 0)
+            CHECK(worst <= ranges[r].limit, "%s: counts %d to %d off by %.4f C", t->name,
+                  margin, THERMISTOR_ADC_COUNTS - margin, worst);
+    }
+}
+
+// Nanoseconds per conversion of every 16-sample sum
+template<typename F>
+static double time_ns(F convert){
+    const int repeats = 100;
+    volatile double total = 0;
+    auto start = std::chrono::steady_clock::now();
+    for(int r = 0; r < repeats; r++)
+        for(uint32_t sum = 0; sum < (THERMISTOR_ADC_COUNTS << SHIFT); sum++)
+            total = total + convert(sum);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / repeats / (THERMISTOR_ADC_COUNTS << SHIFT);
+}
+
+int main(void){
+    for(int i = 0; i < 2; i++){
+        test_entries(tables[i], &thermistors[i]);
+        test_interpolation(tables[i], &thermistors[i]);
+    }
+
+    const ThermistorParams *t = &thermistors[0];
+    double lookup_ns = time_ns([](uint32_t sum){ return (double) thermistor_lookup(table_10k, sum, SHIFT); });
+    double old_ns = time_ns([t](uint32_t sum){ return (double) old_celsius(sum, t); });
+    double equation_ns = time_ns([t](uint32_t sum){ return equation_celsius((double) sum / (1 << SHIFT), t); });
+    printf("host time per conversion: lookup %.2f ns, old float equation %.2f ns, double equation %.2f ns\n",
+           lookup_ns, old_ns, equation_ns);
+
+    printf("%s: %d failures\n", (failures == 0) ? "PASS" : "FAIL", failures);
+    return failures != 0;
+}